@@ -0,0 +1,101 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+/**
+*	@brief hash map from target address to T
+*	@note entries are kept in insertion order in a dense vector indexed by an open addressing table
+*/
+template <typename T>
+class AddressMap
+{
+public:
+	typedef std::pair<ULONG64, T> Entry;
+	typedef typename std::vector<Entry>::iterator iterator;
+
+	AddressMap()
+	: buckets_(INITIAL_BUCKETS, -1)
+	{
+	}
+
+	/**
+	*	@brief value of key, NULL if not found
+	*/
+	T *Find(ULONG64 key)
+	{
+		int index = buckets_[Lookup(key)];
+		return index >= 0 ? &entries_[index].second : NULL;
+	}
+
+	/**
+	*	@brief value of key, inserted by T() if not found
+	*/
+	T &operator[](ULONG64 key)
+	{
+		size_t bucket = Lookup(key);
+		if (buckets_[bucket] < 0)
+		{
+			buckets_[bucket] = (int)entries_.size();
+			entries_.push_back(Entry(key, T()));
+			if (entries_.size() * 2 > buckets_.size())
+			{
+				Grow();
+				return entries_.back().second;
+			}
+		}
+		return entries_[buckets_[bucket]].second;
+	}
+
+	size_t size() const { return entries_.size(); }
+	iterator begin() { return entries_.begin(); }
+	iterator end() { return entries_.end(); }
+
+	void clear()
+	{
+		entries_.clear();
+		buckets_.assign(INITIAL_BUCKETS, -1);
+	}
+
+private:
+	enum { INITIAL_BUCKETS = 256 };
+
+	std::vector<Entry> entries_;
+
+	/**
+	*	@brief index in entries_, -1 for empty
+	*	@note the size is a power of 2 and kept at least twice of the number of entries
+	*/
+	std::vector<int> buckets_;
+
+	/**
+	*	@brief bucket of key or the empty bucket to insert it
+	*/
+	size_t Lookup(ULONG64 key) const
+	{
+		const size_t mask = buckets_.size() - 1;
+		size_t bucket = Hash(key) & mask;
+		while (buckets_[bucket] >= 0 && entries_[buckets_[bucket]].first != key)
+		{
+			bucket = (bucket + 1) & mask;
+		}
+		return bucket;
+	}
+
+	/**
+	*	@brief spread aligned addresses over buckets
+	*/
+	static size_t Hash(ULONG64 key)
+	{
+		return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+	}
+
+	void Grow()
+	{
+		buckets_.assign(buckets_.size() * 2, -1);
+		for (size_t i = 0; i < entries_.size(); i++)
+		{
+			buckets_[Lookup(entries_[i].first)] = (int)i;
+		}
+	}
+};
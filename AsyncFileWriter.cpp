@@ -0,0 +1,174 @@
+#include "common.h"
+#include "AsyncFileWriter.h"
+
+AsyncFileWriter::AsyncFileWriter(size_t bufferSize)
+: file_(INVALID_HANDLE_VALUE)
+, bufferSize_(bufferSize)
+, current_(0)
+, used_(0)
+, thread_(NULL)
+, ready_(NULL)
+, idle_(NULL)
+, pending_(NULL)
+, pendingSize_(0)
+, stop_(false)
+, failed_(FALSE)
+, lastError_(0)
+, written_(0)
+{
+	buffers_[0].resize(bufferSize);
+	buffers_[1].resize(bufferSize);
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	Close();
+}
+
+void AsyncFileWriter::Open(HANDLE file)
+{
+	file_ = file;
+	ready_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+	idle_ = CreateEvent(NULL, FALSE, TRUE, NULL);
+	if (ready_ != NULL && idle_ != NULL)
+	{
+		thread_ = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	}
+	if (thread_ == NULL)
+	{
+		dprintf("%s: CreateThread failed %d, write synchronously\n", __FUNCTION__, GetLastError());
+	}
+}
+
+BOOL AsyncFileWriter::Close()
+{
+	if (used_ != 0)
+	{
+		Submit();
+	}
+	if (thread_ != NULL)
+	{
+		WaitIdle();
+		StopThread();
+	}
+	if (ready_ != NULL)
+	{
+		CloseHandle(ready_);
+		ready_ = NULL;
+	}
+	if (idle_ != NULL)
+	{
+		CloseHandle(idle_);
+		idle_ = NULL;
+	}
+	if (file_ != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file_);
+		file_ = INVALID_HANDLE_VALUE;
+	}
+	return !failed_;
+}
+
+void AsyncFileWriter::AppendSlow(const char *data, size_t size)
+{
+	while (size != 0)
+	{
+		if (used_ == bufferSize_)
+		{
+			Submit();
+		}
+		size_t length = bufferSize_ - used_;
+		if (length > size)
+		{
+			length = size;
+		}
+		memcpy(&buffers_[current_][used_], data, length);
+		used_ += length;
+		data += length;
+		size -= length;
+	}
+}
+
+void AsyncFileWriter::Submit()
+{
+	if (file_ == INVALID_HANDLE_VALUE)
+	{
+		// drop output after a failure
+		used_ = 0;
+		return;
+	}
+	if (thread_ == NULL)
+	{
+		Write(&buffers_[current_][0], (DWORD)used_);
+		used_ = 0;
+		if (failed_)
+		{
+			dprintf("%s: WriteFile failed %d (written %d)\n", __FUNCTION__, lastError_, written_);
+			CloseHandle(file_);
+			file_ = INVALID_HANDLE_VALUE;
+		}
+		return;
+	}
+
+	WaitIdle();
+	if (file_ == INVALID_HANDLE_VALUE)
+	{
+		used_ = 0;
+		return;
+	}
+	pending_ = &buffers_[current_][0];
+	pendingSize_ = (DWORD)used_;
+	SetEvent(ready_);
+	current_ ^= 1;
+	used_ = 0;
+}
+
+void AsyncFileWriter::WaitIdle()
+{
+	WaitForSingleObject(idle_, INFINITE);
+	if (failed_ && file_ != INVALID_HANDLE_VALUE)
+	{
+		dprintf("%s: WriteFile failed %d (written %d)\n", __FUNCTION__, lastError_, written_);
+		StopThread();
+		CloseHandle(file_);
+		file_ = INVALID_HANDLE_VALUE;
+	}
+}
+
+void AsyncFileWriter::StopThread()
+{
+	if (thread_ == NULL)
+	{
+		return;
+	}
+	stop_ = true;
+	SetEvent(ready_);
+	WaitForSingleObject(thread_, INFINITE);
+	CloseHandle(thread_);
+	thread_ = NULL;
+}
+
+void AsyncFileWriter::Write(const char *data, DWORD size)
+{
+	if (!WriteFile(file_, data, size, &written_, NULL) || written_ != size)
+	{
+		failed_ = TRUE;
+		lastError_ = GetLastError();
+	}
+}
+
+DWORD WINAPI AsyncFileWriter::ThreadProc(LPVOID parameter)
+{
+	AsyncFileWriter *writer = (AsyncFileWriter *)parameter;
+	for (;;)
+	{
+		WaitForSingleObject(writer->ready_, INFINITE);
+		if (writer->stop_)
+		{
+			break;
+		}
+		writer->Write(writer->pending_, writer->pendingSize_);
+		SetEvent(writer->idle_);
+	}
+	return 0;
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+*	@brief write a file through two large buffers, a writer thread writes one while the other is filled
+*	@note errors of the writer thread are reported by dprintf on the caller thread
+*/
+class AsyncFileWriter
+{
+public:
+	/**
+	*	@brief constructor
+	*	@param bufferSize [in] size of each of the two buffers
+	*/
+	AsyncFileWriter(size_t bufferSize);
+
+	/**
+	*	@brief destructor
+	*	@note closes the file if not closed yet
+	*/
+	~AsyncFileWriter();
+
+	/**
+	*	@brief start writing to the file
+	*	@param file [in] opened file, closed by Close
+	*	@note writes synchronously if the writer thread cannot be created
+	*/
+	void Open(HANDLE file);
+
+	/**
+	*	@brief write the rest, stop the writer thread and close the file
+	*	@return FALSE if any write failed
+	*/
+	BOOL Close();
+
+	/**
+	*	@brief true if opened and no write failed
+	*/
+	bool IsOpen() const { return file_ != INVALID_HANDLE_VALUE; }
+
+	/**
+	*	@brief append bytes
+	*/
+	void Append(const char *data, size_t size)
+	{
+		if (used_ + size <= bufferSize_)
+		{
+			memcpy(&buffers_[current_][used_], data, size);
+			used_ += size;
+		}
+		else
+		{
+			AppendSlow(data, size);
+		}
+	}
+
+	/**
+	*	@brief append a string
+	*/
+	void Append(const std::string &str)
+	{
+		Append(str.data(), str.size());
+	}
+
+	/**
+	*	@brief append a literal
+	*/
+	template <size_t N>
+	void Append(const char (&literal)[N])
+	{
+		Append(literal, N - 1);
+	}
+
+	/**
+	*	@brief append a number in upper case hex without leading zeros (same as %I64X)
+	*/
+	void AppendHex(ULONG64 value)
+	{
+		static const char digits[] = "0123456789ABCDEF";
+		char buffer[16];
+		char *ptr = buffer + sizeof(buffer);
+		do
+		{
+			*--ptr = digits[value & 0xf];
+			value >>= 4;
+		} while (value != 0);
+		Append(ptr, buffer + sizeof(buffer) - ptr);
+	}
+
+private:
+	HANDLE file_;
+
+	const size_t bufferSize_;
+
+	/**
+	*	@brief buffers_[current_] is filled by Append, the other one is written by the thread
+	*/
+	std::vector<char> buffers_[2];
+	int current_;
+
+	/**
+	*	@brief bytes used in buffers_[current_]
+	*/
+	size_t used_;
+
+	/**
+	*	@brief writer thread, NULL if writing synchronously
+	*/
+	HANDLE thread_;
+
+	/**
+	*	@brief signaled when pending_ is given to the thread or stop_ is set
+	*/
+	HANDLE ready_;
+
+	/**
+	*	@brief signaled when the thread finished writing pending_
+	*/
+	HANDLE idle_;
+
+	/**
+	*	@brief buffer given to the thread
+	*/
+	const char *pending_;
+	DWORD pendingSize_;
+
+	/**
+	*	@brief request to the thread to exit
+	*/
+	bool stop_;
+
+	/**
+	*	@brief result of the last write of the thread
+	*/
+	BOOL failed_;
+	DWORD lastError_;
+	DWORD written_;
+
+	/**
+	*	@brief append bytes not fitting in the buffer
+	*/
+	void AppendSlow(const char *data, size_t size);
+
+	/**
+	*	@brief give buffers_[current_] to the thread and switch to the other buffer
+	*	@note waits until the thread finished the previous buffer
+	*/
+	void Submit();
+
+	/**
+	*	@brief wait for the thread and report its failure
+	*/
+	void WaitIdle();
+
+	/**
+	*	@brief let the idle thread exit and wait for it
+	*/
+	void StopThread();
+
+	/**
+	*	@brief write size bytes to the file and record the result
+	*/
+	void Write(const char *data, DWORD size);
+
+	static DWORD WINAPI ThreadProc(LPVOID parameter);
+
+	/**
+	*	@brief copy constructor (disabled)
+	*/
+	AsyncFileWriter(const AsyncFileWriter&);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	AsyncFileWriter& operator=(const AsyncFileWriter&);
+};
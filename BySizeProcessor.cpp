@@ -1,44 +1,82 @@
-#include <windows.h>
 #include "common.h"
 #include "BySizeProcessor.h"
+#include <algorithm>
+#include <vector>
 
 BySizeProcessor::BySizeProcessor(ULONG64 size)
 : size_(size)
 {
 }
 
-void BySizeProcessor::Register(ULONG64 ustAddress,
-		ULONG64 size, ULONG64 address,
-		ULONG64 userSize, ULONG64 userAddress)
+void BySizeProcessor::RegisterBatch(const HeapRecord *records, size_t count)
 {
-	UNREFERENCED_PARAMETER(size);
-	UNREFERENCED_PARAMETER(address);
-	UNREFERENCED_PARAMETER(userAddress);
-
-	if (size_ != 0 && userSize != size_)
+	for (const HeapRecord *itr = records; itr != records + count; ++itr)
 	{
-		// ignore other size
-		return;
+		if (size_ != 0 && itr->userSize != size_)
+		{
+			// ignore other size
+			continue;
+		}
+
+		std::map<ULONG64, SizeRecord>::iterator found = records_.find(itr->userSize);
+		if (found == records_.end())
+		{
+			found = records_.insert(std::make_pair(itr->userSize, SizeRecord())).first;
+			found->second.userSize = itr->userSize;
+			found->second.count = 0;
+		}
+		SizeRecord &record = found->second;
+		record.count++;
+		record.ustAddress.insert(itr->ustAddress);
 	}
+}
+
+/**
+*	@brief order of SizeRecords, larger first
+*/
+class SizeRecordOrder
+{
+public:
+	SizeRecordOrder(ReportOptions::SortKey sortKey) : sortKey_(sortKey) {}
 
-	std::map<ULONG64, SizeRecord>::iterator itr = records_.find(userSize);
-	if (itr == records_.end())
+	template <typename T>
+	bool operator()(const T *lhs, const T *rhs) const
 	{
-		SizeRecord record;
-		record.userSize = userSize;
-		record.count = 1;
-		record.ustAddress.insert(ustAddress);
-		records_[userSize] = record;
+		ULONG64 left = GetKey(*lhs);
+		ULONG64 right = GetKey(*rhs);
+		if (left != right)
+		{
+			return left > right;
+		}
+		return lhs->userSize < rhs->userSize;
 	}
-	else
+
+private:
+	const ReportOptions::SortKey sortKey_;
+
+	template <typename T>
+	ULONG64 GetKey(const T &record) const
 	{
-		SizeRecord &record = itr->second;
-		record.count++;
-		record.ustAddress.insert(ustAddress);
+		switch (sortKey_)
+		{
+		case ReportOptions::SORT_TOTAL:
+			return record.userSize * record.count;
+		case ReportOptions::SORT_MAX:
+		case ReportOptions::SORT_AVERAGE:
+			return record.userSize;
+		default:
+			return record.count;
+		}
 	}
-}
 
-void BySizeProcessor::Print()
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	SizeRecordOrder& operator=(const SizeRecordOrder&);
+};
+
+void BySizeProcessor::Print(const ReportOptions &options)
 {
 	if (size_ != 0)
 	{
@@ -50,11 +88,22 @@ void BySizeProcessor::Print()
 		return;
 	}
 
-	std::multiset<SizeRecord> sorted;
+	// drop records under thresholds, then sort only the printed ones
+	std::vector<const SizeRecord *> sorted;
+	sorted.reserve(records_.size());
 	for (std::map<ULONG64, SizeRecord>::iterator itr = records_.begin(); itr != records_.end(); ++itr)
 	{
-		sorted.insert(itr->second);
+		if (itr->second.userSize * itr->second.count >= options.minTotal && itr->second.count >= options.minCount)
+		{
+			sorted.push_back(&itr->second);
+		}
+	}
+	std::vector<const SizeRecord *>::iterator end = sorted.end();
+	if (options.top != 0 && options.top < sorted.size())
+	{
+		end = sorted.begin() + (size_t)options.top;
 	}
+	std::partial_sort(sorted.begin(), end, sorted.end(), SizeRecordOrder(options.sortKey));
 
 	if (IsPtr64())
 	{
@@ -64,14 +113,18 @@ void BySizeProcessor::Print()
 	{
 		dprintf("userSize(   count)     ust0,     ust1,...\n");
 	}
-	for (std::multiset<SizeRecord>::reverse_iterator itr = sorted.rbegin(); itr != sorted.rend(); ++itr)
+	for (std::vector<const SizeRecord *>::iterator itr = sorted.begin(); itr != end; ++itr)
 	{
-		dprintf("%p(%p)", itr->userSize, itr->count);
-		for (std::set<ULONG64>::iterator itr_ = itr->ustAddress.begin(); itr_ != itr->ustAddress.end(); ++itr_)
+		dprintf("%p(%p)", (*itr)->userSize, (*itr)->count);
+		for (std::set<ULONG64>::const_iterator itr_ = (*itr)->ustAddress.begin(); itr_ != (*itr)->ustAddress.end(); ++itr_)
 		{
 			dprintf("%p,", *itr_);
 		}
 		dprintf("\n");
 	}
+	if (end != sorted.end())
+	{
+		dprintf("%d more records\n", (ULONG)(sorted.end() - end));
+	}
 	dprintf("\n");
 }
@@ -3,6 +3,7 @@
 #include <map>
 #include <set>
 #include "IProcessor.h"
+#include "ReportOptions.h"
 
 class BySizeProcessor : public IProcessor
 {
@@ -11,10 +12,6 @@ private:
 		ULONG64 userSize;
 		ULONG64 count;
 		std::set<ULONG64> ustAddress;
-		bool operator< (const BySizeProcessor::SizeRecord& rhs) const
-		{
-			return count < rhs.count;
-		}
 	};
 
 	/**
@@ -46,11 +43,9 @@ public:
 	void StartHeap(ULONG64 /*heapAddress*/) {}
 
 	/**
-	*	@copydoc IProcessor::Register()
+	*	@copydoc IProcessor::RegisterBatch()
 	*/
-	void Register(ULONG64 ustAddress,
-		ULONG64 size, ULONG64 address,
-		ULONG64 userSize, ULONG64 userAddress);
+	void RegisterBatch(const HeapRecord *records, size_t count);
 
 	/**
 	*	@copydoc IProcessor::FinishHeap()
@@ -59,6 +54,7 @@ public:
 
 	/**
 	*	@brief print summary of heap usage
+	*	@param options [in] selection and order of printed records
 	*/
-	void Print();
+	void Print(const ReportOptions &options);
 };
@@ -0,0 +1,35 @@
+#include "common.h"
+#include "CompositeProcessor.h"
+
+CompositeProcessor::CompositeProcessor()
+{
+}
+
+void CompositeProcessor::Add(IProcessor *processor)
+{
+	processors_.push_back(processor);
+}
+
+void CompositeProcessor::StartHeap(ULONG64 heapAddress)
+{
+	for (std::vector<IProcessor *>::iterator itr = processors_.begin(); itr != processors_.end(); ++itr)
+	{
+		(*itr)->StartHeap(heapAddress);
+	}
+}
+
+void CompositeProcessor::RegisterBatch(const HeapRecord *records, size_t count)
+{
+	for (std::vector<IProcessor *>::iterator itr = processors_.begin(); itr != processors_.end(); ++itr)
+	{
+		(*itr)->RegisterBatch(records, count);
+	}
+}
+
+void CompositeProcessor::FinishHeap(ULONG64 heapAddress)
+{
+	for (std::vector<IProcessor *>::iterator itr = processors_.begin(); itr != processors_.end(); ++itr)
+	{
+		(*itr)->FinishHeap(heapAddress);
+	}
+}
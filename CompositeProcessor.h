@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include "IProcessor.h"
+
+/**
+*	@brief pass heap entries to several processors in one heap walk
+*/
+class CompositeProcessor : public IProcessor
+{
+private:
+	/**
+	*	@brief processors in the order added, not owned
+	*/
+	std::vector<IProcessor *> processors_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	CompositeProcessor& operator=(const CompositeProcessor&);
+
+public:
+	/**
+	*	@brief constructor
+	*/
+	CompositeProcessor();
+
+	/**
+	*	@brief add a processor
+	*	@param processor [in] processor which must live until the walk finishes
+	*/
+	void Add(IProcessor *processor);
+
+	/**
+	*	@copydoc IProcessor::StartHeap()
+	*/
+	void StartHeap(ULONG64 heapAddress);
+
+	/**
+	*	@copydoc IProcessor::RegisterBatch()
+	*/
+	void RegisterBatch(const HeapRecord *records, size_t count);
+
+	/**
+	*	@copydoc IProcessor::FinishHeap()
+	*/
+	void FinishHeap(ULONG64 heapAddress);
+};
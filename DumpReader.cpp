@@ -0,0 +1,511 @@
+#include "common.h"
+#include "DumpReader.h"
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// minidump structures (see MINIDUMP_* in dbghelp.h)
+#pragma pack(push, 4)
+struct DumpHeader {
+	ULONG32 Signature;
+	ULONG32 Version;
+	ULONG32 NumberOfStreams;
+	ULONG32 StreamDirectoryRva;
+	ULONG32 CheckSum;
+	ULONG32 TimeDateStamp;
+	ULONG64 Flags;
+};
+
+struct DumpLocation {
+	ULONG32 DataSize;
+	ULONG32 Rva;
+};
+
+struct DumpDirectory {
+	ULONG32 StreamType;
+	DumpLocation Location;
+};
+
+struct DumpMemoryDescriptor {
+	ULONG64 StartOfMemoryRange;
+	DumpLocation Memory;
+};
+
+struct DumpMemoryDescriptor64 {
+	ULONG64 StartOfMemoryRange;
+	ULONG64 DataSize;
+};
+
+struct DumpModule {
+	ULONG64 BaseOfImage;
+	ULONG32 SizeOfImage;
+	ULONG32 CheckSum;
+	ULONG32 TimeDateStamp;
+	ULONG32 ModuleNameRva;
+	ULONG32 VersionInfo[13];
+	DumpLocation CvRecord;
+	DumpLocation MiscRecord;
+	ULONG64 Reserved0;
+	ULONG64 Reserved1;
+};
+
+struct DumpThread {
+	ULONG32 ThreadId;
+	ULONG32 SuspendCount;
+	ULONG32 PriorityClass;
+	ULONG32 Priority;
+	ULONG64 Teb;
+	DumpMemoryDescriptor Stack;
+	DumpLocation ThreadContext;
+};
+
+struct DumpSystemInfo {
+	USHORT ProcessorArchitecture;
+	USHORT ProcessorLevel;
+	USHORT ProcessorRevision;
+	UCHAR NumberOfProcessors;
+	UCHAR ProductType;
+	ULONG32 MajorVersion;
+	ULONG32 MinorVersion;
+	ULONG32 BuildNumber;
+	ULONG32 PlatformId;
+	ULONG32 CSDVersionRva;
+};
+#pragma pack(pop)
+
+#define DUMP_SIGNATURE 0x504d444d // "MDMP"
+
+#define THREAD_LIST_STREAM 3
+#define MODULE_LIST_STREAM 4
+#define MEMORY_LIST_STREAM 5
+#define EXCEPTION_STREAM 6
+#define SYSTEM_INFO_STREAM 7
+#define MEMORY64_LIST_STREAM 9
+
+#define ARCHITECTURE_IA64 6
+#define ARCHITECTURE_AMD64 9
+#define ARCHITECTURE_ARM64 12
+
+DumpReader::DumpReader()
+#ifdef _WIN32
+: file_(INVALID_HANDLE_VALUE)
+, mapping_(NULL)
+#else
+: file_(-1)
+#endif
+, view_(NULL)
+, fileSize_(0)
+, isPtr64_(false)
+, teb_(0)
+, osVersion_(0)
+{
+}
+
+DumpReader::~DumpReader()
+{
+#ifdef _WIN32
+	if (view_ != NULL)
+	{
+		UnmapViewOfFile(view_);
+	}
+	if (mapping_ != NULL)
+	{
+		CloseHandle(mapping_);
+	}
+	if (file_ != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file_);
+	}
+#else
+	if (view_ != NULL)
+	{
+		munmap(const_cast<UCHAR *>(view_), (size_t)fileSize_);
+	}
+	if (file_ >= 0)
+	{
+		close(file_);
+	}
+#endif
+}
+
+bool DumpReader::Map(const char *path)
+{
+#ifdef _WIN32
+	file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_ == INVALID_HANDLE_VALUE)
+	{
+		dprintf("cannot open %s (%d)\n", path, GetLastError());
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0)
+	{
+		dprintf("cannot get size of %s\n", path);
+		return false;
+	}
+	fileSize_ = size.QuadPart;
+	mapping_ = CreateFileMapping(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping_ == NULL)
+	{
+		dprintf("cannot map %s (%d)\n", path, GetLastError());
+		return false;
+	}
+	view_ = static_cast<const UCHAR *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+	if (view_ == NULL)
+	{
+		dprintf("cannot map %s (%d)\n", path, GetLastError());
+		return false;
+	}
+#else
+	file_ = open(path, O_RDONLY);
+	if (file_ < 0)
+	{
+		dprintf("cannot open %s\n", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(file_, &st) != 0 || st.st_size == 0)
+	{
+		dprintf("cannot get size of %s\n", path);
+		return false;
+	}
+	fileSize_ = st.st_size;
+	void *view = mmap(NULL, (size_t)fileSize_, PROT_READ, MAP_PRIVATE, file_, 0);
+	if (view == MAP_FAILED)
+	{
+		dprintf("cannot map %s\n", path);
+		return false;
+	}
+	view_ = static_cast<const UCHAR *>(view);
+#endif
+	return true;
+}
+
+bool DumpReader::Open(const char *path)
+{
+	if (!Map(path))
+	{
+		return false;
+	}
+
+	DumpHeader header;
+	if (!ReadFile(0, &header, sizeof(header)) || header.Signature != DUMP_SIGNATURE)
+	{
+		dprintf("%s is not a minidump\n", path);
+		return false;
+	}
+
+	std::vector<DumpDirectory> directory(header.NumberOfStreams);
+	if (header.NumberOfStreams == 0 ||
+		!ReadFile(header.StreamDirectoryRva, &directory[0], directory.size() * sizeof(DumpDirectory)))
+	{
+		dprintf("read stream directory failed\n");
+		return false;
+	}
+
+	// current thread is the one which raised the exception, if any
+	ULONG32 currentThreadId = 0;
+	for (std::vector<DumpDirectory>::iterator itr = directory.begin(); itr != directory.end(); ++itr)
+	{
+		if (itr->StreamType == EXCEPTION_STREAM &&
+			!ReadFile(itr->Location.Rva, &currentThreadId, sizeof(currentThreadId)))
+		{
+			dprintf("read exception stream failed\n");
+			return false;
+		}
+	}
+
+	bool hasMemory = false;
+	for (std::vector<DumpDirectory>::iterator itr = directory.begin(); itr != directory.end(); ++itr)
+	{
+		bool result = true;
+		switch (itr->StreamType)
+		{
+		case MEMORY_LIST_STREAM:
+			result = ParseMemoryList(itr->Location.Rva);
+			hasMemory = true;
+			break;
+		case MEMORY64_LIST_STREAM:
+			result = ParseMemory64List(itr->Location.Rva);
+			hasMemory = true;
+			break;
+		case MODULE_LIST_STREAM:
+			result = ParseModuleList(itr->Location.Rva);
+			break;
+		case THREAD_LIST_STREAM:
+			result = ParseThreadList(itr->Location.Rva, currentThreadId);
+			break;
+		case SYSTEM_INFO_STREAM:
+			result = ParseSystemInfo(itr->Location.Rva);
+			break;
+		}
+		if (!result)
+		{
+			dprintf("parse stream %d failed\n", itr->StreamType);
+			return false;
+		}
+	}
+	if (!hasMemory)
+	{
+		dprintf("%s has no memory list\n", path);
+		return false;
+	}
+	if (teb_ == 0)
+	{
+		dprintf("%s has no thread list\n", path);
+		return false;
+	}
+	BuildIndex();
+	return true;
+}
+
+BOOL DumpReader::Read(ULONG64 address, PVOID buffer, ULONG size, PULONG cb)
+{
+	ULONG done = 0;
+	while (done < size)
+	{
+		ULONG64 current = address + done;
+		const Range *range = FindRange(current);
+		if (range == NULL)
+		{
+			break;
+		}
+		ULONG64 available = range->size - (current - range->address);
+		ULONG length = available < size - done ? (ULONG)available : size - done;
+		memcpy((UCHAR *)buffer + done, view_ + range->offset + (current - range->address), length);
+		done += length;
+	}
+	if (cb != NULL)
+	{
+		*cb = done;
+	}
+	return done == size;
+}
+
+const UCHAR *DumpReader::GetPointer(ULONG64 address, ULONG size) const
+{
+	const Range *range = FindRange(address);
+	if (range == NULL || range->size - (address - range->address) < size)
+	{
+		return NULL;
+	}
+	return view_ + range->offset + (address - range->address);
+}
+
+const DumpReader::Range *DumpReader::FindRange(ULONG64 address) const
+{
+	Range key;
+	key.address = address;
+	std::vector<Range>::const_iterator itr = std::upper_bound(ranges_.begin(), ranges_.end(), key);
+	if (itr == ranges_.begin())
+	{
+		return NULL;
+	}
+	--itr;
+	if (address - itr->address >= itr->size)
+	{
+		return NULL;
+	}
+	return &*itr;
+}
+
+void DumpReader::BuildIndex()
+{
+	std::sort(ranges_.begin(), ranges_.end());
+	std::vector<Range> merged;
+	for (std::vector<Range>::const_iterator itr = ranges_.begin(); itr != ranges_.end(); ++itr)
+	{
+		Range range = *itr;
+		if (range.offset >= fileSize_)
+		{
+			continue;
+		}
+		if (fileSize_ - range.offset < range.size)
+		{
+			// truncated dump
+			range.size = fileSize_ - range.offset;
+		}
+		if (range.size == 0)
+		{
+			continue;
+		}
+		if (!merged.empty())
+		{
+			Range &last = merged.back();
+			if (last.address + last.size == range.address && last.offset + last.size == range.offset)
+			{
+				last.size += range.size;
+				continue;
+			}
+		}
+		merged.push_back(range);
+	}
+	ranges_.swap(merged);
+}
+
+bool DumpReader::ReadFile(ULONG64 offset, void *buffer, size_t size)
+{
+	if (offset > fileSize_ || fileSize_ - offset < size)
+	{
+		return false;
+	}
+	memcpy(buffer, view_ + offset, size);
+	return true;
+}
+
+/**
+*	@brief upper bound of MINIDUMP_STRING::Length in bytes, names are UNICODE_STRING in the target
+*/
+static const ULONG32 MAX_STRING_LENGTH = 0xfffe;
+
+bool DumpReader::ReadString(ULONG64 offset, std::string &str)
+{
+	ULONG32 length; // in bytes
+	if (!ReadFile(offset, &length, sizeof(length)))
+	{
+		return false;
+	}
+	offset += sizeof(length);
+	if (length > MAX_STRING_LENGTH || length > fileSize_ - offset)
+	{
+		return false;
+	}
+	const size_t count = (size_t)length / sizeof(WCHAR);
+	std::vector<WCHAR> unicode(count + 1);
+	if (!ReadFile(offset, &unicode[0], count * sizeof(WCHAR)))
+	{
+		return false;
+	}
+	std::vector<CHAR> multiByte(count * 3 + 1);
+	int written = WideCharToMultiByte(CP_ACP, 0, &unicode[0], (int)count,
+		&multiByte[0], (int)multiByte.size(), NULL, NULL);
+	if (written < 0)
+	{
+		return false;
+	}
+	str.assign(&multiByte[0], written);
+	return true;
+}
+
+bool DumpReader::ParseMemoryList(ULONG64 offset)
+{
+	ULONG32 count;
+	if (!ReadFile(offset, &count, sizeof(count)))
+	{
+		return false;
+	}
+	offset += sizeof(count);
+	for (ULONG32 i = 0; i < count; i++)
+	{
+		DumpMemoryDescriptor descriptor;
+		if (!ReadFile(offset, &descriptor, sizeof(descriptor)))
+		{
+			return false;
+		}
+		Range range;
+		range.address = descriptor.StartOfMemoryRange;
+		range.size = descriptor.Memory.DataSize;
+		range.offset = descriptor.Memory.Rva;
+		ranges_.push_back(range);
+		offset += sizeof(descriptor);
+	}
+	return true;
+}
+
+bool DumpReader::ParseMemory64List(ULONG64 offset)
+{
+	ULONG64 header[2]; // NumberOfMemoryRanges, BaseRva
+	if (!ReadFile(offset, header, sizeof(header)))
+	{
+		return false;
+	}
+	offset += sizeof(header);
+	ULONG64 rva = header[1];
+	for (ULONG64 i = 0; i < header[0]; i++)
+	{
+		DumpMemoryDescriptor64 descriptor;
+		if (!ReadFile(offset, &descriptor, sizeof(descriptor)))
+		{
+			return false;
+		}
+		Range range;
+		range.address = descriptor.StartOfMemoryRange;
+		range.size = descriptor.DataSize;
+		range.offset = rva;
+		ranges_.push_back(range);
+		rva += descriptor.DataSize;
+		offset += sizeof(descriptor);
+	}
+	return true;
+}
+
+bool DumpReader::ParseModuleList(ULONG64 offset)
+{
+	ULONG32 count;
+	if (!ReadFile(offset, &count, sizeof(count)))
+	{
+		return false;
+	}
+	offset += sizeof(count);
+	for (ULONG32 i = 0; i < count; i++)
+	{
+		DumpModule dumpModule;
+		if (!ReadFile(offset, &dumpModule, sizeof(dumpModule)))
+		{
+			return false;
+		}
+		Module module;
+		module.base = dumpModule.BaseOfImage;
+		module.size = dumpModule.SizeOfImage;
+		if (!ReadString(dumpModule.ModuleNameRva, module.path))
+		{
+			return false;
+		}
+		modules_.push_back(module);
+		offset += sizeof(dumpModule);
+	}
+	return true;
+}
+
+bool DumpReader::ParseThreadList(ULONG64 offset, ULONG32 currentThreadId)
+{
+	ULONG32 count;
+	if (!ReadFile(offset, &count, sizeof(count)))
+	{
+		return false;
+	}
+	offset += sizeof(count);
+	for (ULONG32 i = 0; i < count; i++)
+	{
+		DumpThread thread;
+		if (!ReadFile(offset, &thread, sizeof(thread)))
+		{
+			return false;
+		}
+		if (i == 0 || thread.ThreadId == currentThreadId)
+		{
+			teb_ = thread.Teb;
+		}
+		offset += sizeof(thread);
+	}
+	return true;
+}
+
+bool DumpReader::ParseSystemInfo(ULONG64 offset)
+{
+	DumpSystemInfo info;
+	if (!ReadFile(offset, &info, sizeof(info)))
+	{
+		return false;
+	}
+	isPtr64_ = info.ProcessorArchitecture == ARCHITECTURE_AMD64 ||
+		info.ProcessorArchitecture == ARCHITECTURE_IA64 ||
+		info.ProcessorArchitecture == ARCHITECTURE_ARM64;
+	osVersion_ = ((ULONG64)info.MajorVersion << 32) | info.MinorVersion;
+	return true;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+*	@brief reader of a user mode minidump file (.dmp)
+*	@note parses memory list, module list, thread list and system info streams
+*	@note the file is mapped into memory and target memory is served from the mapping
+*/
+class DumpReader
+{
+public:
+	/**
+	*	@brief module in the module list stream
+	*/
+	struct Module
+	{
+		ULONG64 base;
+		ULONG64 size;
+		std::string path; // full path in UTF-8
+	};
+
+	DumpReader();
+
+	/**
+	*	@brief destructor
+	*	@note unmaps and closes the dump file
+	*/
+	~DumpReader();
+
+	/**
+	*	@brief open dump file and parse streams
+	*	@retval false not a minidump or broken, reason is printed by dprintf
+	*/
+	bool Open(const char *path);
+
+	/**
+	*	@brief read target memory
+	*	@note same semantics as ReadMemory, short read stops at the first missing byte
+	*/
+	BOOL Read(ULONG64 address, PVOID buffer, ULONG size, PULONG cb);
+
+	/**
+	*	@brief get pointer to target memory in the mapping without copy
+	*	@retval NULL [address, address + size) is not stored in a single range
+	*	@note valid until the reader is destroyed
+	*/
+	const UCHAR *GetPointer(ULONG64 address, ULONG size) const;
+
+	/**
+	*	@brief target pointer size is 64 bit or not
+	*/
+	bool IsPtr64() const { return isPtr64_; }
+
+	/**
+	*	@brief TEB address of the current (exception or first) thread
+	*/
+	ULONG64 GetTebAddress() const { return teb_; }
+
+	/**
+	*	@brief OS version
+	*	@return ((MajorVersion << 32) | MinorVersion)
+	*/
+	ULONG64 GetOSVersion() const { return osVersion_; }
+
+	/**
+	*	@brief loaded modules
+	*/
+	const std::vector<Module> &GetModules() const { return modules_; }
+
+private:
+	/**
+	*	@brief memory range stored in the dump file
+	*/
+	struct Range
+	{
+		ULONG64 address;
+		ULONG64 size;
+		ULONG64 offset; // file offset of the content
+
+		bool operator<(const Range &rhs) const { return address < rhs.address; }
+	};
+
+#ifdef _WIN32
+	HANDLE file_;
+	HANDLE mapping_;
+#else
+	int file_;
+#endif
+	const UCHAR *view_;
+	ULONG64 fileSize_;
+	bool isPtr64_;
+	ULONG64 teb_;
+	ULONG64 osVersion_;
+	std::vector<Range> ranges_; // sorted by address, adjacent ranges are merged
+	std::vector<Module> modules_;
+
+	/**
+	*	@brief map the whole file
+	*/
+	bool Map(const char *path);
+
+	/**
+	*	@brief read bytes at the file offset
+	*/
+	bool ReadFile(ULONG64 offset, void *buffer, size_t size);
+
+	/**
+	*	@brief sort ranges for FindRange and merge adjacent ones
+	*/
+	void BuildIndex();
+
+	/**
+	*	@brief find the range containing address by binary search
+	*	@retval NULL address is not stored in the dump
+	*/
+	const Range *FindRange(ULONG64 address) const;
+
+	/**
+	*	@brief read MINIDUMP_STRING at the file offset
+	*/
+	bool ReadString(ULONG64 offset, std::string &str);
+
+	bool ParseMemoryList(ULONG64 offset);
+	bool ParseMemory64List(ULONG64 offset);
+	bool ParseModuleList(ULONG64 offset);
+	bool ParseThreadList(ULONG64 offset, ULONG32 currentThreadId);
+	bool ParseSystemInfo(ULONG64 offset);
+
+	/**
+	*	@brief copy constructor (disabled)
+	*/
+	DumpReader(const DumpReader&);
+
+	/**
+	*	@brief operator (disabled)
+	*/
+	DumpReader& operator=(const DumpReader&);
+};
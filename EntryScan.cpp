@@ -0,0 +1,177 @@
+#include "common.h"
+#include "EntryScan.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define ENTRY_SCAN_X86
+#include <emmintrin.h>
+#if defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1800)
+#define ENTRY_SCAN_AVX2
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef __GNUC__
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+static ScanKernel DetectScanKernel()
+{
+#if defined(ENTRY_SCAN_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return SCAN_AVX2;
+	}
+	if (__builtin_cpu_supports("sse2"))
+	{
+		return SCAN_SSE2;
+	}
+#elif defined(ENTRY_SCAN_X86)
+	int info[4];
+	__cpuid(info, 1);
+#ifdef ENTRY_SCAN_AVX2
+	// AVX2 also needs the OS saving YMM registers
+	if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6)
+	{
+		int extended[4];
+		__cpuidex(extended, 7, 0);
+		if (extended[1] & (1 << 5))
+		{
+			return SCAN_AVX2;
+		}
+	}
+#endif
+	if (info[3] & (1 << 26))
+	{
+		return SCAN_SSE2;
+	}
+#endif
+	return SCAN_SCALAR;
+}
+
+// detected before threads walking heaps start
+static const ScanKernel supportedKernel = DetectScanKernel();
+
+ScanKernel GetScanKernel()
+{
+	return supportedKernel;
+}
+
+const char *GetScanKernelName(ScanKernel kernel)
+{
+	switch (kernel)
+	{
+	case SCAN_SSE2:
+		return "sse2";
+	case SCAN_AVX2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
+
+/**
+*	@brief scan blocks from first to count one by one
+*/
+static void ScanScalar(const UCHAR *signatures, ULONG stride, ULONG first, ULONG count, bool ust, ULONG *mask)
+{
+	const UCHAR *signature = signatures + (size_t)first * stride;
+	for (ULONG i = first; i < count; i++, signature += stride)
+	{
+		if (ust ? *signature == 0xc2 : *signature > 0x80)
+		{
+			mask[i / 32] |= 1UL << (i % 32);
+		}
+	}
+}
+
+#ifdef ENTRY_SCAN_X86
+/**
+*	@brief scan 16 blocks at a time from first
+*	@return index of the first block not scanned
+*/
+TARGET_SSE2 static ULONG ScanSse2(const UCHAR *signatures, ULONG stride, ULONG first, ULONG count, bool ust, ULONG *mask)
+{
+	const __m128i busySignature = _mm_set1_epi8((char)0xc2);
+	const __m128i sign = _mm_set1_epi8((char)0x80);
+	const __m128i zero = _mm_setzero_si128();
+	ULONG i = first;
+	for (; i + 16 <= count; i += 16)
+	{
+		// SSE2 has no gather, the compiler inserts the bytes into the vector
+		const UCHAR *p = signatures + (size_t)i * stride;
+#define SIG(k) (char)p[(size_t)(k) * stride]
+		__m128i value = _mm_setr_epi8(SIG(0), SIG(1), SIG(2), SIG(3), SIG(4), SIG(5), SIG(6), SIG(7),
+			SIG(8), SIG(9), SIG(10), SIG(11), SIG(12), SIG(13), SIG(14), SIG(15));
+#undef SIG
+		// unsigned value > 0x80 is signed (value ^ 0x80) > 0
+		__m128i busy = ust ?
+			_mm_cmpeq_epi8(value, busySignature) :
+			_mm_cmpgt_epi8(_mm_xor_si128(value, sign), zero);
+		mask[i / 32] |= (ULONG)_mm_movemask_epi8(busy) << (i % 32);
+	}
+	return i;
+}
+#endif
+
+#ifdef ENTRY_SCAN_AVX2
+/**
+*	@brief scan 32 blocks at a time from first by gathering the dword ending at each signature
+*	@return index of the first block not scanned
+*	@note first is a multiple of 32, and offsets of the blocks fit in int
+*/
+TARGET_AVX2 static ULONG ScanAvx2(const UCHAR *signatures, ULONG stride, ULONG first, ULONG count, bool ust, ULONG *mask)
+{
+	const int *base = (const int *)(signatures - 3);
+	const __m256i lanes = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)stride));
+	const __m256i step = _mm256_set1_epi32((int)(8 * stride));
+	const __m256i busySignature = _mm256_set1_epi32(0xc2);
+	const __m256i flag = _mm256_set1_epi32(0x80);
+	ULONG i = first;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i offsets = _mm256_add_epi32(lanes, _mm256_set1_epi32((int)(i * stride)));
+		ULONG bits = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			// the signature is the top byte of the gathered dword
+			__m256i value = _mm256_srli_epi32(_mm256_i32gather_epi32(base, offsets, 1), 24);
+			__m256i busy = ust ? _mm256_cmpeq_epi32(value, busySignature) : _mm256_cmpgt_epi32(value, flag);
+			bits |= (ULONG)_mm256_movemask_ps(_mm256_castsi256_ps(busy)) << (k * 8);
+			offsets = _mm256_add_epi32(offsets, step);
+		}
+		mask[i / 32] = bits;
+	}
+	return i;
+}
+#endif
+
+void ScanBusyBlocks(const UCHAR *signatures, ULONG stride, ULONG count, bool ust, ULONG *mask, ScanKernel kernel)
+{
+	memset(mask, 0, (count + 31) / 32 * sizeof(ULONG));
+	if (kernel > supportedKernel)
+	{
+		kernel = supportedKernel;
+	}
+	ULONG first = 0;
+#ifdef ENTRY_SCAN_AVX2
+	if (kernel == SCAN_AVX2 && (ULONG64)count * stride <= 0x7fffffff)
+	{
+		first = ScanAvx2(signatures, stride, first, count, ust, mask);
+	}
+#endif
+#ifdef ENTRY_SCAN_X86
+	if (kernel >= SCAN_SSE2)
+	{
+		first = ScanSse2(signatures, stride, first, count, ust, mask);
+	}
+#endif
+	ScanScalar(signatures, stride, first, count, ust, mask);
+}
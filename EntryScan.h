@@ -0,0 +1,59 @@
+#pragma once
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+*	@brief implementation of ScanBusyBlocks
+*/
+enum ScanKernel
+{
+	SCAN_SCALAR, // one block at a time
+	SCAN_SSE2, // 16 blocks at a time
+	SCAN_AVX2 // 32 blocks at a time by gather
+};
+
+/**
+*	@brief fastest kernel supported by the processor
+*/
+ScanKernel GetScanKernel();
+
+/**
+*	@brief name of the kernel
+*/
+const char *GetScanKernelName(ScanKernel kernel);
+
+/**
+*	@brief find busy LFH blocks from ExtendedBlockSignature of headers at a fixed stride
+*	@param signatures [in] ExtendedBlockSignature of the first block, after the other bytes of its header
+*	@param stride [in] bytes between blocks
+*	@param count [in] number of blocks
+*	@param ust [in] true if busy blocks are signed 0xc2 (ust enabled), false if signed above 0x80
+*	@param mask [out] (count + 31) / 32 words, bit (i % 32) of mask[i / 32] is set if block i is busy
+*	@param kernel [in] kernel to use, a kernel not supported by the processor falls back to a supported one
+*/
+void ScanBusyBlocks(const UCHAR *signatures, ULONG stride, ULONG count, bool ust, ULONG *mask, ScanKernel kernel);
+
+/**
+*	@brief ScanBusyBlocks by the fastest kernel
+*/
+inline void ScanBusyBlocks(const UCHAR *signatures, ULONG stride, ULONG count, bool ust, ULONG *mask)
+{
+	ScanBusyBlocks(signatures, stride, count, ust, mask, GetScanKernel());
+}
+
+/**
+*	@brief index of the lowest set bit
+*	@note bits must not be 0
+*/
+inline ULONG CountTrailingZeros(ULONG bits)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return index;
+#else
+	return __builtin_ctz(bits);
+#endif
+}
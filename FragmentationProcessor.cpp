@@ -0,0 +1,138 @@
+#include "common.h"
+#include "FragmentationProcessor.h"
+
+FreeBlockStats::FreeBlockStats()
+: totalSize(0)
+, freeSize(0)
+, freeCount(0)
+, largestFree(0)
+{
+	memset(histogram, 0, sizeof(histogram));
+}
+
+void FreeBlockStats::Add(ULONG64 size, bool busy)
+{
+	totalSize += size;
+	if (busy)
+	{
+		return;
+	}
+	freeSize += size;
+	freeCount++;
+	if (largestFree < size)
+	{
+		largestFree = size;
+	}
+	int bucket = BUCKET_COUNT - 1;
+	while (bucket > 0 && size < GetBucketSize(bucket))
+	{
+		bucket--;
+	}
+	histogram[bucket]++;
+}
+
+void FreeBlockStats::Merge(const FreeBlockStats &stats)
+{
+	totalSize += stats.totalSize;
+	freeSize += stats.freeSize;
+	freeCount += stats.freeCount;
+	if (largestFree < stats.largestFree)
+	{
+		largestFree = stats.largestFree;
+	}
+	for (int i = 0; i < BUCKET_COUNT; i++)
+	{
+		histogram[i] += stats.histogram[i];
+	}
+}
+
+ULONG FreeBlockStats::GetFragmentation() const
+{
+	if (freeSize == 0)
+	{
+		return 0;
+	}
+	return (ULONG)((freeSize - largestFree) * 100 / freeSize);
+}
+
+ULONG64 FreeBlockStats::GetBucketSize(int bucket)
+{
+	// 0x20, 0x40, ... as entries are at least 0x10 bytes
+	return bucket == 0 ? 0 : (ULONG64)0x10 << bucket;
+}
+
+FragmentationProcessor::FragmentationProcessor()
+{
+}
+
+void FragmentationProcessor::StartHeap(ULONG64 heapAddress)
+{
+	HeapStats heap;
+	heap.address = heapAddress;
+	heaps_.push_back(heap);
+}
+
+void FragmentationProcessor::RegisterSegment(ULONG64 segmentAddress, const FreeBlockStats &stats)
+{
+	if (heaps_.empty())
+	{
+		return;
+	}
+	SegmentStats segment;
+	segment.address = segmentAddress;
+	segment.stats = stats;
+	heaps_.back().segments.push_back(segment);
+}
+
+void FragmentationProcessor::PrintStats(const char *label, ULONG64 address, const FreeBlockStats &stats)
+{
+	dprintf("%s %p, %p, %p, %p, %p, %3u%%\n",
+		label, address,
+		stats.totalSize,
+		stats.freeSize,
+		stats.freeCount,
+		stats.largestFree,
+		stats.GetFragmentation());
+	if (stats.freeCount == 0)
+	{
+		return;
+	}
+	dprintf("        free entries by size:");
+	for (int i = 0; i < FreeBlockStats::BUCKET_COUNT; i++)
+	{
+		if (stats.histogram[i] != 0)
+		{
+			dprintf(" %I64x+:%I64d", FreeBlockStats::GetBucketSize(i), stats.histogram[i]);
+		}
+	}
+	dprintf("\n");
+}
+
+void FragmentationProcessor::Print()
+{
+	if (IsPtr64())
+	{
+		dprintf("---------------------------------------------------------------------------------------------------------------\n");
+		dprintf("                 address,            total,             free,      free blocks,     largest free, fragmentation\n");
+		dprintf("---------------------------------------------------------------------------------------------------------------\n");
+	}
+	else
+	{
+		dprintf("--------------------------------------------------------------\n");
+		dprintf("         address,    total,     free,   blocks,  largest, frag\n");
+		dprintf("--------------------------------------------------------------\n");
+	}
+	for (std::vector<HeapStats>::const_iterator heap = heaps_.begin(); heap != heaps_.end(); ++heap)
+	{
+		FreeBlockStats total;
+		for (std::vector<SegmentStats>::const_iterator segment = heap->segments.begin();
+			segment != heap->segments.end();
+			++segment)
+		{
+			PrintStats("segment", segment->address, segment->stats);
+			total.Merge(segment->stats);
+		}
+		PrintStats("heap   ", heap->address, total);
+	}
+	dprintf("\n");
+}
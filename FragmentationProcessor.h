@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+
+/**
+*	@brief backend entries of a heap segment, accumulated while walking it
+*/
+struct FreeBlockStats
+{
+	enum { BUCKET_COUNT = 16 };
+
+	/**
+	*	@brief bytes of all entries walked, busy or free
+	*/
+	ULONG64 totalSize;
+
+	ULONG64 freeSize;
+	ULONG64 freeCount;
+	ULONG64 largestFree;
+
+	/**
+	*	@brief number of free entries by size, bucket i counts sizes from GetBucketSize(i) up to GetBucketSize(i + 1)
+	*/
+	ULONG64 histogram[BUCKET_COUNT];
+
+	FreeBlockStats();
+
+	/**
+	*	@brief count an entry
+	*	@param size [in] size of the entry including its header
+	*	@param busy [in] true if the entry is allocated
+	*/
+	void Add(ULONG64 size, bool busy);
+
+	/**
+	*	@brief add counts of another segment
+	*/
+	void Merge(const FreeBlockStats &stats);
+
+	/**
+	*	@brief external fragmentation in percent, share of free bytes out of the largest free entry
+	*/
+	ULONG GetFragmentation() const;
+
+	/**
+	*	@brief smallest size counted in the bucket, 0 for the first one
+	*/
+	static ULONG64 GetBucketSize(int bucket);
+};
+
+/**
+*	@brief report free bytes and fragmentation of heap segments
+*	@note fed by the heap walk on the thread delivering records, not by IProcessor
+*/
+class FragmentationProcessor
+{
+private:
+	struct SegmentStats {
+		ULONG64 address;
+		FreeBlockStats stats;
+	};
+
+	struct HeapStats {
+		ULONG64 address;
+		std::vector<SegmentStats> segments;
+	};
+
+	/**
+	*	@brief heaps in the order walked
+	*/
+	std::vector<HeapStats> heaps_;
+
+	/**
+	*	@brief print a line of counts and the histogram
+	*/
+	static void PrintStats(const char *label, ULONG64 address, const FreeBlockStats &stats);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	FragmentationProcessor& operator=(const FragmentationProcessor&);
+
+public:
+	/**
+	*	@brief constructor
+	*/
+	FragmentationProcessor();
+
+	/**
+	*	@brief start a heap, following segments belong to it
+	*	@param heapAddress [in] heap address
+	*/
+	void StartHeap(ULONG64 heapAddress);
+
+	/**
+	*	@brief register entries of a segment of the current heap
+	*	@param segmentAddress [in] segment address
+	*	@param stats [in] entries counted while walking the segment
+	*/
+	void RegisterSegment(ULONG64 segmentAddress, const FreeBlockStats &stats);
+
+	/**
+	*	@brief print free bytes, largest free entry, fragmentation and histogram per segment and per heap
+	*/
+	void Print();
+};
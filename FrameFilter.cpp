@@ -0,0 +1,114 @@
+#include "common.h"
+#include "FrameFilter.h"
+#include "ModuleIndex.h"
+#include <algorithm>
+
+static bool LessStart(const AddressRange &lhs, const AddressRange &rhs)
+{
+	return lhs.start < rhs.start;
+}
+
+FrameFilter::FrameFilter(SymbolTable &symbols, const std::vector<ModuleInfo> *modules)
+: symbols_(symbols)
+, modules_(modules)
+{
+}
+
+void FrameFilter::Include(const char *key)
+{
+	includes_.push_back(Resolve(key));
+}
+
+void FrameFilter::Exclude(const char *key)
+{
+	excludes_.push_back(Resolve(key));
+}
+
+FrameFilter::Key FrameFilter::Resolve(const char *key)
+{
+	Key resolved;
+	resolved.text = key;
+	std::vector<AddressRange> ranges;
+	if (modules_ != NULL)
+	{
+		GetModuleRanges(key, ranges);
+		resolved.resolved = true;
+	}
+	else
+	{
+		resolved.resolved = GetSymbolRanges(key, ranges) != FALSE;
+	}
+	if (!resolved.resolved)
+	{
+		dprintf("%s is matched by symbol names\n", key);
+		return resolved;
+	}
+
+	// merge overlapping ranges to search by start address
+	std::sort(ranges.begin(), ranges.end(), LessStart);
+	for (std::vector<AddressRange>::iterator itr = ranges.begin(); itr != ranges.end(); ++itr)
+	{
+		if (!resolved.ranges.empty() && itr->start <= resolved.ranges.back().end)
+		{
+			if (resolved.ranges.back().end < itr->end)
+			{
+				resolved.ranges.back().end = itr->end;
+			}
+		}
+		else
+		{
+			resolved.ranges.push_back(*itr);
+		}
+	}
+	return resolved;
+}
+
+void FrameFilter::GetModuleRanges(const char *key, std::vector<AddressRange> &ranges)
+{
+	const size_t keyLength = strlen(key);
+	for (std::vector<ModuleInfo>::const_iterator itr = modules_->begin(); itr != modules_->end(); ++itr)
+	{
+		const std::string name = ModuleIndex::GetModuleName(itr->FullDllName);
+		if (keyLength <= name.size() && _strnicmp(name.c_str(), key, keyLength) == 0)
+		{
+			AddressRange range = { itr->DllBase, itr->DllBase + itr->SizeOfImage };
+			ranges.push_back(range);
+		}
+	}
+}
+
+bool FrameFilter::Matches(const ULONG64 *frames, ULONG depth)
+{
+	if (!includes_.empty() && !MatchesAny(includes_, frames, depth))
+	{
+		return false;
+	}
+	return !MatchesAny(excludes_, frames, depth);
+}
+
+bool FrameFilter::MatchesAny(const std::vector<Key> &keys, const ULONG64 *frames, ULONG depth)
+{
+	for (std::vector<Key>::const_iterator key = keys.begin(); key != keys.end(); ++key)
+	{
+		for (const ULONG64 *itr = frames; itr != frames + depth; itr++)
+		{
+			if (!key->resolved)
+			{
+				if (strncmp(symbols_.GetName(*itr), key->text.c_str(), key->text.size()) == 0)
+				{
+					return true;
+				}
+				continue;
+			}
+			AddressRange value = { *itr, *itr };
+			// last range starting at or before the frame
+			std::vector<AddressRange>::const_iterator range =
+				std::upper_bound(key->ranges.begin(), key->ranges.end(), value, LessStart);
+			if (range != key->ranges.begin() && *itr < (range - 1)->end)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
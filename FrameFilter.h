@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Utility.h"
+#include "SymbolTable.h"
+
+/**
+*	@brief select stack traces by include and exclude keys ("module!symbol" prefixes)
+*	@note each key is resolved once to address ranges, frames are tested by binary search
+*	      on the raw addresses. keys which cannot be resolved fall back to symbol names.
+*/
+class FrameFilter
+{
+public:
+	/**
+	*	@brief constructor
+	*	@param symbols [in] symbols used for keys not resolved to ranges
+	*	@param modules [in] modules of a saved snapshot to resolve module keys without the target,
+	*	                   NULL to resolve keys by the debugger
+	*	@note with modules, "module!symbol" keys are not resolved and must be rejected by the caller
+	*/
+	FrameFilter(SymbolTable &symbols, const std::vector<ModuleInfo> *modules = NULL);
+
+	/**
+	*	@brief select traces having a frame matched with the key
+	*	@note a trace is selected if it matches any of include keys
+	*/
+	void Include(const char *key);
+
+	/**
+	*	@brief drop traces having a frame matched with the key
+	*/
+	void Exclude(const char *key);
+
+	/**
+	*	@brief no key is given
+	*/
+	bool IsEmpty() const { return includes_.empty() && excludes_.empty(); }
+
+	/**
+	*	@brief test the trace
+	*	@param frames [in] frames of the trace
+	*	@param depth [in] number of frames
+	*/
+	bool Matches(const ULONG64 *frames, ULONG depth);
+
+private:
+	struct Key
+	{
+		std::string text;
+		bool resolved;
+
+		/**
+		*	@brief sorted and merged ranges if resolved
+		*/
+		std::vector<AddressRange> ranges;
+	};
+
+	SymbolTable &symbols_;
+	const std::vector<ModuleInfo> *modules_;
+	std::vector<Key> includes_;
+	std::vector<Key> excludes_;
+
+	/**
+	*	@brief resolve the key to ranges
+	*/
+	Key Resolve(const char *key);
+
+	/**
+	*	@brief get extents of modules in modules_ which name starts with the key
+	*/
+	void GetModuleRanges(const char *key, std::vector<AddressRange> &ranges);
+
+	/**
+	*	@brief any frame matches any key
+	*/
+	bool MatchesAny(const std::vector<Key> &keys, const ULONG64 *frames, ULONG depth);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	FrameFilter& operator=(const FrameFilter&);
+};
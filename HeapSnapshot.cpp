@@ -0,0 +1,408 @@
+#include "common.h"
+#include "Utility.h"
+#include "HeapSnapshot.h"
+#include <algorithm>
+
+#define SNAPSHOT_MAGIC "HSNP"
+#define SNAPSHOT_VERSION 1
+
+static void PutVarint(std::vector<UCHAR> &out, ULONG64 value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((UCHAR)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((UCHAR)value);
+}
+
+static void PutSigned(std::vector<UCHAR> &out, ULONG64 current, ULONG64 previous)
+{
+	// zigzag encoding of (current - previous)
+	LONG64 delta = (LONG64)(current - previous);
+	PutVarint(out, ((ULONG64)delta << 1) ^ (ULONG64)(delta >> 63));
+}
+
+/**
+*	@brief decoder of the loaded file
+*	@note any read beyond the end marks the input as broken and returns 0
+*/
+class SnapshotInput
+{
+public:
+	SnapshotInput(const std::vector<UCHAR> &data)
+	: current_(data.empty() ? NULL : &data[0])
+	, end_(data.empty() ? NULL : &data[0] + data.size())
+	, broken_(false)
+	{
+	}
+
+	bool IsBroken() const { return broken_; }
+
+	ULONG64 GetVarint()
+	{
+		ULONG64 value = 0;
+		for (ULONG shift = 0; shift < 64; shift += 7)
+		{
+			if (current_ == end_)
+			{
+				broken_ = true;
+				return 0;
+			}
+			UCHAR byte = *current_++;
+			value |= (ULONG64)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				return value;
+			}
+		}
+		broken_ = true;
+		return 0;
+	}
+
+	/**
+	*	@brief number of following elements, each one takes a byte at least
+	*/
+	size_t GetCount()
+	{
+		ULONG64 value = GetVarint();
+		if (value > (ULONG64)(end_ - current_))
+		{
+			broken_ = true;
+			return 0;
+		}
+		return (size_t)value;
+	}
+
+	ULONG64 GetSigned(ULONG64 previous)
+	{
+		ULONG64 value = GetVarint();
+		return previous + (ULONG64)((LONG64)(value >> 1) ^ -(LONG64)(value & 1));
+	}
+
+	bool GetBytes(void *buffer, size_t size)
+	{
+		if ((size_t)(end_ - current_) < size)
+		{
+			broken_ = true;
+			return false;
+		}
+		memcpy(buffer, current_, size);
+		current_ += size;
+		return true;
+	}
+
+private:
+	const UCHAR *current_;
+	const UCHAR *end_;
+	bool broken_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	SnapshotInput& operator=(const SnapshotInput&);
+};
+
+/**
+*	@brief print the reason why the file is not opened
+*/
+static void PrintOpenError(PCSTR filename)
+{
+	DWORD lastError = GetLastError();
+	switch (lastError)
+	{
+	case ERROR_FILE_EXISTS:
+		dprintf("%s already exists\n", filename);
+		break;
+	case ERROR_FILE_NOT_FOUND:
+	case ERROR_PATH_NOT_FOUND:
+		dprintf("%s not found\n", filename);
+		break;
+	default:
+		dprintf("cannot open %s (%d)\n", filename, lastError);
+		break;
+	}
+}
+
+HeapSnapshotWriter::HeapSnapshotWriter()
+{
+}
+
+void HeapSnapshotWriter::StartHeap(ULONG64 heapAddress)
+{
+	SnapshotHeap heap;
+	heap.address = heapAddress;
+	heaps_.push_back(heap);
+}
+
+void HeapSnapshotWriter::RegisterBatch(const HeapRecord *records, size_t count)
+{
+	if (heaps_.empty())
+	{
+		StartHeap(0);
+	}
+	std::vector<HeapRecord> &target = heaps_.back().records;
+	target.insert(target.end(), records, records + count);
+}
+
+BOOL HeapSnapshotWriter::Save(PCSTR filename, TargetContext &context)
+{
+	std::vector<UCHAR> out;
+	out.insert(out.end(), SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4);
+	PutVarint(out, SNAPSHOT_VERSION);
+	PutVarint(out, context.IsTarget64() ? 1 : 0);
+	PutVarint(out, context.GetNtGlobalFlag());
+	PutVarint(out, context.GetOSVersion());
+
+	const std::vector<ModuleInfo> &modules = context.GetLoadedModules();
+	PutVarint(out, modules.size());
+	for (std::vector<ModuleInfo>::const_iterator itr = modules.begin(); itr != modules.end(); ++itr)
+	{
+		size_t length = strlen(itr->FullDllName);
+		PutVarint(out, itr->DllBase);
+		PutVarint(out, itr->SizeOfImage);
+		PutVarint(out, length);
+		out.insert(out.end(), itr->FullDllName, itr->FullDllName + length);
+	}
+
+	// interned traces sorted by ust address
+	std::vector<ULONG64> traces;
+	for (std::vector<SnapshotHeap>::iterator heap = heaps_.begin(); heap != heaps_.end(); ++heap)
+	{
+		for (std::vector<HeapRecord>::iterator itr = heap->records.begin(); itr != heap->records.end(); ++itr)
+		{
+			if (itr->ustAddress != 0)
+			{
+				traces.push_back(itr->ustAddress);
+			}
+		}
+	}
+	std::sort(traces.begin(), traces.end());
+	traces.erase(std::unique(traces.begin(), traces.end()), traces.end());
+	PutVarint(out, traces.size());
+	TraceStore &store = context.GetTraceStore();
+	ULONG64 previous = 0;
+	for (std::vector<ULONG64>::iterator itr = traces.begin(); itr != traces.end(); ++itr)
+	{
+		PutVarint(out, *itr - previous);
+		previous = *itr;
+		const ULONG64 *frames;
+		ULONG depth = store.Get(*itr, frames);
+		PutVarint(out, depth);
+		ULONG64 previousFrame = 0;
+		for (ULONG i = 0; i < depth; i++)
+		{
+			PutSigned(out, frames[i], previousFrame);
+			previousFrame = frames[i];
+		}
+	}
+
+	// records by columns
+	PutVarint(out, heaps_.size());
+	for (std::vector<SnapshotHeap>::iterator heap = heaps_.begin(); heap != heaps_.end(); ++heap)
+	{
+		const std::vector<HeapRecord> &records = heap->records;
+		PutVarint(out, heap->address);
+		PutVarint(out, records.size());
+		ULONG64 previousAddress = heap->address;
+		for (std::vector<HeapRecord>::const_iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			PutSigned(out, itr->address, previousAddress);
+			previousAddress = itr->address;
+		}
+		for (std::vector<HeapRecord>::const_iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			PutVarint(out, itr->size);
+		}
+		for (std::vector<HeapRecord>::const_iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			PutSigned(out, itr->size, itr->userSize);
+		}
+		for (std::vector<HeapRecord>::const_iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			PutSigned(out, itr->userAddress, itr->address);
+		}
+		for (std::vector<HeapRecord>::const_iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			ULONG64 number = 0;
+			if (itr->ustAddress != 0)
+			{
+				number = std::lower_bound(traces.begin(), traces.end(), itr->ustAddress) - traces.begin() + 1;
+			}
+			PutVarint(out, number);
+		}
+	}
+
+	HANDLE file = CreateFile(filename, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		PrintOpenError(filename);
+		return FALSE;
+	}
+	DWORD written;
+	BOOL result = WriteFile(file, &out[0], (DWORD)out.size(), &written, NULL) && written == (DWORD)out.size();
+	if (!result)
+	{
+		dprintf("%s: WriteFile failed %d (written %d)\n", __FUNCTION__, GetLastError(), written);
+	}
+	CloseHandle(file);
+	if (!result)
+	{
+		// a truncated snapshot is rejected by Load
+		DeleteFile(filename);
+		return FALSE;
+	}
+	dprintf("saved %d traces and %d heaps to %s (%d bytes)\n",
+		(ULONG)traces.size(), (ULONG)heaps_.size(), filename, (ULONG)out.size());
+	return TRUE;
+}
+
+HeapSnapshotReader::HeapSnapshotReader()
+: context_(NULL)
+{
+}
+
+HeapSnapshotReader::~HeapSnapshotReader()
+{
+	delete context_;
+}
+
+BOOL HeapSnapshotReader::Load(PCSTR filename)
+{
+	HANDLE file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		PrintOpenError(filename);
+		return FALSE;
+	}
+	std::vector<UCHAR> data;
+	const DWORD chunkSize = 0x100000;
+	for (;;)
+	{
+		size_t size = data.size();
+		data.resize(size + chunkSize);
+		DWORD read = 0;
+		if (!ReadFile(file, &data[size], chunkSize, &read, NULL))
+		{
+			dprintf("%s: ReadFile failed %d\n", __FUNCTION__, GetLastError());
+			CloseHandle(file);
+			return FALSE;
+		}
+		data.resize(size + read);
+		if (read == 0)
+		{
+			break;
+		}
+	}
+	CloseHandle(file);
+
+	SnapshotInput input(data);
+	CHAR magic[4];
+	if (!input.GetBytes(magic, sizeof(magic)) || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+	{
+		dprintf("%s is not a heap snapshot\n", filename);
+		return FALSE;
+	}
+	ULONG64 version = input.GetVarint();
+	if (version != SNAPSHOT_VERSION)
+	{
+		dprintf("unsupported snapshot version %d\n", (ULONG)version);
+		return FALSE;
+	}
+	bool isTarget64 = input.GetVarint() != 0;
+	ULONG32 ntGlobalFlag = (ULONG32)input.GetVarint();
+	ULONG64 osVersion = input.GetVarint();
+
+	std::vector<ModuleInfo> modules(input.GetCount());
+	for (std::vector<ModuleInfo>::iterator itr = modules.begin(); itr != modules.end() && !input.IsBroken(); ++itr)
+	{
+		itr->DllBase = input.GetVarint();
+		itr->SizeOfImage = input.GetVarint();
+		size_t length = (size_t)input.GetVarint();
+		if (length >= sizeof(itr->FullDllName) || !input.GetBytes(itr->FullDllName, length))
+		{
+			dprintf("broken module list in %s\n", filename);
+			return FALSE;
+		}
+		itr->FullDllName[length] = '\0';
+	}
+
+	std::vector<ULONG64> traces(input.GetCount());
+	std::vector<std::vector<ULONG64> > frames(traces.size());
+	ULONG64 previous = 0;
+	for (size_t i = 0; i < traces.size() && !input.IsBroken(); i++)
+	{
+		traces[i] = previous + input.GetVarint();
+		previous = traces[i];
+		frames[i].resize(input.GetCount());
+		ULONG64 previousFrame = 0;
+		for (std::vector<ULONG64>::iterator itr = frames[i].begin(); itr != frames[i].end(); ++itr)
+		{
+			*itr = input.GetSigned(previousFrame);
+			previousFrame = *itr;
+		}
+	}
+
+	heaps_.resize(input.GetCount());
+	std::vector<ULONG64> heapAddresses;
+	for (std::vector<SnapshotHeap>::iterator heap = heaps_.begin(); heap != heaps_.end() && !input.IsBroken(); ++heap)
+	{
+		heap->address = input.GetVarint();
+		heapAddresses.push_back(heap->address);
+		std::vector<HeapRecord> &records = heap->records;
+		records.resize(input.GetCount());
+		ULONG64 previousAddress = heap->address;
+		for (std::vector<HeapRecord>::iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			itr->address = input.GetSigned(previousAddress);
+			previousAddress = itr->address;
+		}
+		for (std::vector<HeapRecord>::iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			itr->size = input.GetVarint();
+		}
+		for (std::vector<HeapRecord>::iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			itr->userSize = itr->size - input.GetSigned(0);
+		}
+		for (std::vector<HeapRecord>::iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			itr->userAddress = input.GetSigned(itr->address);
+		}
+		for (std::vector<HeapRecord>::iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			ULONG64 number = input.GetVarint();
+			itr->ustAddress = 0 < number && number <= traces.size() ? traces[(size_t)number - 1] : 0;
+		}
+	}
+	if (input.IsBroken())
+	{
+		dprintf("%s is truncated\n", filename);
+		heaps_.clear();
+		return FALSE;
+	}
+
+	delete context_;
+	context_ = TargetContext::Restore(isTarget64, ntGlobalFlag, osVersion, modules, heapAddresses);
+	TraceStore &store = context_->GetTraceStore();
+	for (size_t i = 0; i < traces.size(); i++)
+	{
+		store.Insert(traces[i], frames[i].empty() ? NULL : &frames[i][0], (ULONG)frames[i].size());
+	}
+	dprintf("loaded %d traces and %d heaps from %s\n", (ULONG)traces.size(), (ULONG)heaps_.size(), filename);
+	return TRUE;
+}
+
+void HeapSnapshotReader::Replay(IProcessor *processor)
+{
+	for (std::vector<SnapshotHeap>::iterator heap = heaps_.begin(); heap != heaps_.end(); ++heap)
+	{
+		processor->StartHeap(heap->address);
+		if (!heap->records.empty())
+		{
+			processor->RegisterBatch(&heap->records[0], heap->records.size());
+		}
+		processor->FinishHeap(heap->address);
+	}
+}
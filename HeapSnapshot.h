@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vector>
+#include "IProcessor.h"
+#include "TargetContext.h"
+
+/**
+*	@brief heap records of one heap in a snapshot
+*/
+struct SnapshotHeap
+{
+	ULONG64 address;
+	std::vector<HeapRecord> records;
+};
+
+/**
+*	@brief collect heap records and save them with modules and stack traces
+*	@note file layout (numbers are varint, signed ones zigzag encoded):
+*	      header: "HSNP", version, isTarget64, ntGlobalFlag, osVersion
+*	      modules: count, then base, size, name length and name of each module
+*	      traces: count, then delta of sorted ust address, depth and frame deltas of each trace
+*	      heaps: count, then address and record count of each heap followed by columns of
+*	             address deltas, sizes, unused bytes (size - userSize), user data offsets
+*	             and trace numbers (0 for no trace, n for the n-th trace)
+*/
+class HeapSnapshotWriter : public IProcessor
+{
+private:
+	std::vector<SnapshotHeap> heaps_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	HeapSnapshotWriter& operator=(const HeapSnapshotWriter&);
+
+public:
+	/**
+	*	@brief constructor
+	*/
+	HeapSnapshotWriter();
+
+	/**
+	*	@copydoc IProcessor::StartHeap()
+	*/
+	void StartHeap(ULONG64 heapAddress);
+
+	/**
+	*	@copydoc IProcessor::RegisterBatch()
+	*/
+	void RegisterBatch(const HeapRecord *records, size_t count);
+
+	/**
+	*	@copydoc IProcessor::FinishHeap()
+	*/
+	void FinishHeap(ULONG64 /*heapAddress*/) {}
+
+	/**
+	*	@brief save collected records
+	*	@param filename [in] output file path, must not exist
+	*	@param context [in] target information, modules and stack traces are read from it
+	*	@retval FALSE the file is not created or not written, a partially written file is deleted
+	*/
+	BOOL Save(PCSTR filename, TargetContext &context);
+};
+
+/**
+*	@brief load a snapshot saved by HeapSnapshotWriter and replay it to processors
+*/
+class HeapSnapshotReader
+{
+private:
+	std::vector<SnapshotHeap> heaps_;
+
+	/**
+	*	@brief context restored from the snapshot
+	*/
+	TargetContext *context_;
+
+	/**
+	*	@brief copy constructor (disabled)
+	*/
+	HeapSnapshotReader(const HeapSnapshotReader&);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	HeapSnapshotReader& operator=(const HeapSnapshotReader&);
+
+public:
+	/**
+	*	@brief constructor
+	*/
+	HeapSnapshotReader();
+
+	/**
+	*	@brief destructor
+	*/
+	~HeapSnapshotReader();
+
+	/**
+	*	@brief load the snapshot
+	*	@param filename [in] file saved by HeapSnapshotWriter::Save
+	*/
+	BOOL Load(PCSTR filename);
+
+	/**
+	*	@brief target information restored from the snapshot
+	*	@note valid after Load succeeded, the target is not read through it
+	*/
+	TargetContext &GetContext() { return *context_; }
+
+	/**
+	*	@brief heaps in the snapshot
+	*/
+	const std::vector<SnapshotHeap> &GetHeaps() const { return heaps_; }
+
+	/**
+	*	@brief pass all heap records to the processor like AnalyzeHeap does
+	*/
+	void Replay(IProcessor *processor);
+};
@@ -1,14 +1,42 @@
 #pragma once
 
+#include <stddef.h>
+
+// representation of heap entry
+typedef struct _HeapRecord {
+	ULONG64 ustAddress;
+	ULONG64 size;
+	ULONG64 address;
+	ULONG64 userSize;
+	ULONG64 userAddress;
+	bool operator< (const struct _HeapRecord& rhs) const
+	{
+		return address < rhs.address;
+	}
+} HeapRecord;
+
 class IProcessor
 {
 public:
+	/**
+	*	@brief destructor
+	*	@note processors are deleted through this interface
+	*/
+	virtual ~IProcessor() {}
+
 	/**
 	*	@brief start processing the heap
 	*	@param heapAddress [in] heap address
 	*/
 	virtual void StartHeap(ULONG64 heapAddress) = 0;
 
+	/**
+	*	@brief register heap entries
+	*	@param records [in] heap entries in address order
+	*	@param count [in] number of records
+	*/
+	virtual void RegisterBatch(const HeapRecord *records, size_t count) = 0;
+
 	/**
 	*	@brief register heap entry
 	*	@param ustAddress [in] ust entry address
@@ -16,12 +44,16 @@ public:
 	*	@param address [in] address of heap entry
 	*	@param userSize [in] user requested size for HeapAlloc
 	*	@param userAddress [in] address of user data
+	*	@note adapter to RegisterBatch
 	*/
-	virtual void Register(
+	void Register(
 		ULONG64 ustAddress,
 		ULONG64 size, ULONG64 address,
-		ULONG64 userSize, ULONG64 userAddress
-		) = 0;
+		ULONG64 userSize, ULONG64 userAddress)
+	{
+		HeapRecord record = { ustAddress, size, address, userSize, userAddress };
+		RegisterBatch(&record, 1);
+	}
 
 	/**
 	*	@brief finish processing the heap
@@ -0,0 +1,260 @@
+#include "common.h"
+#include "Utility.h"
+#include "MemoryCache.h"
+
+/**
+*	@brief cache used by ReadTargetMemory, NULL if no command is running
+*/
+static MemoryCache *activeCache = NULL;
+
+/**
+*	@brief statistics of the last finished command
+*/
+static MemoryCache::Statistics lastStatistics;
+
+MemoryCache::MemoryCache(ULONG pageSize, ULONG maxPages)
+: pageSize_(pageSize)
+, maxPages_(maxPages != 0 ? maxPages : 1)
+{
+	ZeroMemory(&statistics_, sizeof(statistics_));
+}
+
+void MemoryCache::Clear()
+{
+	pages_.clear();
+	index_.clear();
+	unreadable_.clear();
+}
+
+BOOL MemoryCache::Read(ULONG64 address, PVOID buffer, ULONG size, PULONG cb)
+{
+	ULONG dummy;
+	if (cb == NULL)
+	{
+		cb = &dummy;
+	}
+	*cb = 0;
+	statistics_.requests++;
+	if (size == 0)
+	{
+		return TRUE;
+	}
+	if (IsUnreadable(address, size))
+	{
+		statistics_.negativeHits++;
+		return FALSE;
+	}
+
+	const ULONG64 misses = statistics_.misses;
+	UCHAR *dest = static_cast<UCHAR *>(buffer);
+	ULONG done = 0;
+	while (done < size)
+	{
+		ULONG64 current = address + done;
+		ULONG64 base = current & ~(ULONG64)(pageSize_ - 1);
+		const Page &page = GetPage(base);
+		ULONG offset = (ULONG)(current - base);
+		ULONG length = pageSize_ - offset < size - done ? pageSize_ - offset : size - done;
+		if (offset + length > page.valid)
+		{
+			// the page is partially readable, let the target decide
+			ULONG read = 0;
+			BOOL result = ReadDirect(current, dest + done, size - done, &read);
+			*cb = done + read;
+			return result && read == size - done;
+		}
+		memcpy(dest + done, &page.data[offset], length);
+		done += length;
+	}
+	if (statistics_.misses == misses)
+	{
+		statistics_.hits++;
+	}
+	*cb = size;
+	return TRUE;
+}
+
+const MemoryCache::Page &MemoryCache::GetPage(ULONG64 base)
+{
+	std::map<ULONG64, std::list<Page>::iterator>::iterator itr = index_.find(base);
+	if (itr != index_.end())
+	{
+		pages_.splice(pages_.begin(), pages_, itr->second);
+		return *itr->second;
+	}
+
+	statistics_.misses++;
+	if (index_.size() >= maxPages_)
+	{
+		// reuse the least recently used page
+		index_.erase(pages_.back().base);
+		pages_.splice(pages_.begin(), pages_, --pages_.end());
+		statistics_.evictions++;
+	}
+	else
+	{
+		pages_.push_front(Page());
+	}
+	Page &page = pages_.front();
+	page.base = base;
+	page.data.resize(pageSize_);
+	ULONG read = 0;
+	ReadMemory(base, &page.data[0], pageSize_, &read); // short read keeps readable part
+	page.valid = read <= pageSize_ ? read : 0;
+	if (page.valid == 0 && pageSize_ <= PAGE_SIZE)
+	{
+		unreadable_.insert(base & ~(ULONG64)(PAGE_SIZE - 1));
+	}
+	index_[base] = pages_.begin();
+	return page;
+}
+
+bool MemoryCache::IsUnreadable(ULONG64 address, ULONG size) const
+{
+	if (unreadable_.empty())
+	{
+		return false;
+	}
+	for (ULONG64 page = address & ~(ULONG64)(PAGE_SIZE - 1); page < address + size; page += PAGE_SIZE)
+	{
+		if (unreadable_.find(page) != unreadable_.end())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+BOOL MemoryCache::ReadDirect(ULONG64 address, PVOID buffer, ULONG size, PULONG cb)
+{
+	statistics_.bypasses++;
+	*cb = 0;
+	BOOL result = ReadMemory(address, buffer, size, cb);
+	if (*cb == 0 &&
+		(address & ~(ULONG64)(PAGE_SIZE - 1)) == ((address + size - 1) & ~(ULONG64)(PAGE_SIZE - 1)))
+	{
+		unreadable_.insert(address & ~(ULONG64)(PAGE_SIZE - 1));
+	}
+	return result;
+}
+
+void MemoryCache::PrintStatistics(const Statistics &statistics)
+{
+	dprintf("memory cache: %I64d requests, %I64d hits, %I64d misses, %I64d negative hits, %I64d bypasses, %I64d evictions\n",
+		statistics.requests, statistics.hits, statistics.misses,
+		statistics.negativeHits, statistics.bypasses, statistics.evictions);
+	ULONG64 roundTrips = statistics.misses + statistics.bypasses;
+	dprintf("memory cache: %I64d target reads for %I64d requests\n",
+		roundTrips, statistics.requests);
+}
+
+MemoryCacheScope::MemoryCacheScope(BOOL verbose)
+: cache_(NULL)
+, previous_(activeCache)
+, verbose_(verbose)
+{
+	const Settings &settings = GetSettings();
+	if (previous_ == NULL && settings.cacheEnabled)
+	{
+		cache_ = new MemoryCache(settings.cachePageSize, settings.cacheMaxPages);
+		activeCache = cache_;
+	}
+}
+
+MemoryCacheScope::~MemoryCacheScope()
+{
+	if (cache_ == NULL)
+	{
+		return;
+	}
+	lastStatistics = cache_->GetStatistics();
+	if (verbose_)
+	{
+		MemoryCache::PrintStatistics(lastStatistics);
+	}
+	activeCache = previous_;
+	delete cache_;
+}
+
+const MemoryCache::Statistics &MemoryCacheScope::GetLastStatistics()
+{
+	return lastStatistics;
+}
+
+RegionReader::RegionReader(ULONG64 start, ULONG64 end, ULONG chunkSize)
+: start_(start)
+, end_(end)
+, chunkSize_(chunkSize)
+, base_(0)
+, size_(0)
+, valid_(0)
+, data_(NULL)
+{
+}
+
+BOOL RegionReader::Read(ULONG64 address, PVOID buffer, ULONG size, PULONG cb)
+{
+	const UCHAR *data = GetPointer(address, size);
+	if (data == NULL)
+	{
+		return ReadTargetMemory(address, buffer, size, cb);
+	}
+	memcpy(buffer, data, size);
+	if (cb != NULL)
+	{
+		*cb = size;
+	}
+	return TRUE;
+}
+
+const UCHAR *RegionReader::GetPointer(ULONG64 address, ULONG size)
+{
+	if (chunkSize_ == 0 || address < start_ || end_ <= address || end_ - address < size)
+	{
+		return NULL;
+	}
+	if (address < base_ || base_ + size_ < address + size)
+	{
+		Fill(address);
+	}
+	else if (base_ + valid_ < address + size && valid_ != 0)
+	{
+		// past a short read, the rest of the chunk may be readable from the address
+		Fill(address);
+	}
+	if (base_ + valid_ < address + size)
+	{
+		// unreadable bytes, the chunk is not filled again until a request leaves it
+		return NULL;
+	}
+	return data_ + (size_t)(address - base_);
+}
+
+void RegionReader::Fill(ULONG64 address)
+{
+	ULONG length = end_ - address < chunkSize_ ? (ULONG)(end_ - address) : chunkSize_;
+	base_ = address;
+	size_ = length;
+#ifdef HEAPSTAT_OFFLINE
+	data_ = GetTargetPointer(address, length);
+	if (data_ != NULL)
+	{
+		valid_ = length;
+		return;
+	}
+#endif
+	buffer_.resize(length);
+	ULONG read = 0;
+	ReadMemory(address, &buffer_[0], length, &read); // short read keeps readable part
+	data_ = &buffer_[0];
+	valid_ = read <= length ? read : 0;
+}
+
+BOOL ReadTargetMemory(ULONG64 address, PVOID buffer, ULONG size, PULONG cb)
+{
+	if (activeCache != NULL)
+	{
+		return activeCache->Read(address, buffer, size, cb);
+	}
+	return ReadMemory(address, buffer, size, cb);
+}
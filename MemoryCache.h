@@ -0,0 +1,221 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+/**
+*	@brief page granular cache of target memory
+*	@note pages are evicted in LRU order, unreadable pages are remembered
+*/
+class MemoryCache
+{
+public:
+	/**
+	*	@brief counters to see how many debugger round trips are saved
+	*/
+	struct Statistics
+	{
+		ULONG64 requests; // ReadTargetMemory calls
+		ULONG64 hits; // requests served from cached pages
+		ULONG64 misses; // pages read from the target
+		ULONG64 negativeHits; // requests failed by unreadable page cache
+		ULONG64 bypasses; // requests read directly from the target
+		ULONG64 evictions; // pages discarded by LRU
+	};
+
+	/**
+	*	@brief constructor
+	*	@param pageSize [in] bytes read from the target at once (power of 2)
+	*	@param maxPages [in] maximum number of cached pages
+	*/
+	MemoryCache(ULONG pageSize, ULONG maxPages);
+
+	/**
+	*	@brief read target memory through the cache
+	*	@note same semantics as ReadMemory
+	*/
+	BOOL Read(ULONG64 address, PVOID buffer, ULONG size, PULONG cb);
+
+	/**
+	*	@brief discard all cached pages
+	*/
+	void Clear();
+
+	/**
+	*	@brief get counters
+	*/
+	const Statistics &GetStatistics() const { return statistics_; }
+
+	/**
+	*	@brief print counters by dprintf
+	*/
+	static void PrintStatistics(const Statistics &statistics);
+
+private:
+	struct Page
+	{
+		ULONG64 base;
+		ULONG valid; // number of readable bytes from base
+		std::vector<UCHAR> data;
+	};
+
+	/**
+	*	@brief bytes of a page
+	*/
+	const ULONG pageSize_;
+
+	/**
+	*	@brief maximum number of pages
+	*/
+	const ULONG maxPages_;
+
+	/**
+	*	@brief cached pages, most recently used first
+	*/
+	std::list<Page> pages_;
+
+	/**
+	*	@brief page base address to cached page map
+	*/
+	std::map<ULONG64, std::list<Page>::iterator> index_;
+
+	/**
+	*	@brief base addresses of unreadable target pages (PAGE_SIZE granular)
+	*/
+	std::set<ULONG64> unreadable_;
+
+	Statistics statistics_;
+
+	/**
+	*	@brief find page or read it from the target
+	*/
+	const Page &GetPage(ULONG64 base);
+
+	/**
+	*	@brief test whether [address, address + size) hits the unreadable page cache
+	*/
+	bool IsUnreadable(ULONG64 address, ULONG size) const;
+
+	/**
+	*	@brief read directly from the target, and remember the failure
+	*/
+	BOOL ReadDirect(ULONG64 address, PVOID buffer, ULONG size, PULONG cb);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	MemoryCache& operator=(const MemoryCache&);
+};
+
+/**
+*	@brief activate a memory cache while an extension command is running
+*	@note memory may change when the target runs, so the cache lives only for a command
+*/
+class MemoryCacheScope
+{
+public:
+	/**
+	*	@brief constructor
+	*	@param verbose [in] print statistics on destruction
+	*/
+	MemoryCacheScope(BOOL verbose);
+
+	/**
+	*	@brief destructor
+	*	@note saves statistics for !config
+	*/
+	~MemoryCacheScope();
+
+	/**
+	*	@brief get statistics of the last finished command
+	*/
+	static const MemoryCache::Statistics &GetLastStatistics();
+
+private:
+	MemoryCache *cache_;
+	MemoryCache *previous_;
+	const BOOL verbose_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	MemoryCacheScope& operator=(const MemoryCacheScope&);
+};
+
+/**
+*	@brief read a region of target memory in large chunks and serve small reads locally
+*	@note reads outside the region or beyond readable bytes go to ReadTargetMemory
+*	@note the offline build refers to the mapped dump instead of copying a chunk
+*/
+class RegionReader
+{
+public:
+	/**
+	*	@brief constructor
+	*	@param start [in] start address of the region
+	*	@param end [in] end address of the region (exclusive)
+	*	@param chunkSize [in] bytes read from the target at once, 0 to disable bulk read
+	*/
+	RegionReader(ULONG64 start, ULONG64 end, ULONG chunkSize);
+
+	/**
+	*	@brief read target memory
+	*	@note same semantics as ReadMemory
+	*/
+	BOOL Read(ULONG64 address, PVOID buffer, ULONG size, PULONG cb);
+
+	/**
+	*	@brief pointer to size bytes at address in the bulk read chunk
+	*	@return NULL if bulk read is disabled or the bytes are not readable at once
+	*	@note valid until the next call of Read or GetPointer
+	*/
+	const UCHAR *GetPointer(ULONG64 address, ULONG size);
+
+private:
+	const ULONG64 start_;
+	const ULONG64 end_;
+	const ULONG chunkSize_;
+
+	/**
+	*	@brief target address of data_[0]
+	*/
+	ULONG64 base_;
+
+	/**
+	*	@brief bytes of the current chunk
+	*/
+	ULONG size_;
+
+	/**
+	*	@brief number of readable bytes in data_
+	*/
+	ULONG valid_;
+
+	/**
+	*	@brief current chunk, points buffer_ or the mapped dump
+	*/
+	const UCHAR *data_;
+
+	std::vector<UCHAR> buffer_;
+
+	/**
+	*	@brief read a chunk starting at address
+	*/
+	void Fill(ULONG64 address);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	RegionReader& operator=(const RegionReader&);
+};
+
+/**
+*	@brief read target memory through the active memory cache if any
+*	@note same semantics as ReadMemory
+*/
+BOOL ReadTargetMemory(ULONG64 address, PVOID buffer, ULONG size, PULONG cb);
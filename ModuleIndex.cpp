@@ -0,0 +1,88 @@
+#include "common.h"
+#include "ModuleIndex.h"
+#include <algorithm>
+
+/**
+*	@brief test the file name of the module starts with one of the prefixes
+*/
+static bool MatchesPrefix(const CHAR *fullDllName, const std::string &prefixes)
+{
+	const CHAR *name = strrchr(fullDllName, '\\');
+	name = name != NULL ? name + 1 : fullDllName;
+	size_t begin = 0;
+	while (begin < prefixes.size())
+	{
+		size_t end = prefixes.find(',', begin);
+		if (end == std::string::npos)
+		{
+			end = prefixes.size();
+		}
+		if (end > begin && _strnicmp(name, prefixes.c_str() + begin, end - begin) == 0)
+		{
+			return true;
+		}
+		begin = end + 1;
+	}
+	return false;
+}
+
+ModuleIndex::ModuleIndex(const std::vector<ModuleInfo> &modules, const std::string &skipModules)
+: skipMask_((modules.size() + 31) / 32, 0)
+, skipModules_(skipModules)
+{
+	intervals_.reserve(modules.size());
+	names_.reserve(modules.size());
+	for (size_t i = 0; i < modules.size(); i++)
+	{
+		Interval interval;
+		interval.start = modules[i].DllBase;
+		interval.end = modules[i].DllBase + modules[i].SizeOfImage;
+		interval.id = (int)i;
+		intervals_.push_back(interval);
+		names_.push_back(GetModuleName(modules[i].FullDllName));
+		if (MatchesPrefix(modules[i].FullDllName, skipModules))
+		{
+			skipMask_[i / 32] |= 1U << (i % 32);
+		}
+	}
+	std::sort(intervals_.begin(), intervals_.end());
+}
+
+int ModuleIndex::Find(ULONG64 address) const
+{
+	Interval key;
+	key.start = address;
+	key.end = 0;
+	key.id = -1;
+	// first interval starting after the address, the previous one may contain it
+	std::vector<Interval>::const_iterator itr = std::upper_bound(intervals_.begin(), intervals_.end(), key);
+	if (itr == intervals_.begin())
+	{
+		return -1;
+	}
+	--itr;
+	return address < itr->end ? itr->id : -1;
+}
+
+bool ModuleIndex::FormatFrame(ULONG64 address, std::string &text) const
+{
+	Interval key;
+	key.start = address;
+	key.end = 0;
+	key.id = -1;
+	std::vector<Interval>::const_iterator itr = std::upper_bound(intervals_.begin(), intervals_.end(), key);
+	if (itr == intervals_.begin() || address >= (--itr)->end)
+	{
+		return false;
+	}
+	text = FormatString("%s+0x%I64x", names_[itr->id].c_str(), address - itr->start);
+	return true;
+}
+
+std::string ModuleIndex::GetModuleName(const CHAR *fullDllName)
+{
+	const CHAR *name = strrchr(fullDllName, '\\');
+	name = name != NULL ? name + 1 : fullDllName;
+	const CHAR *extension = strrchr(name, '.');
+	return extension != NULL ? std::string(name, extension) : std::string(name);
+}
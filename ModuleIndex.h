@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Utility.h"
+
+/**
+*	@brief loaded modules sorted by address for attribution of raw frame addresses
+*	@note modules matched with the skip list (allocators and runtimes) are marked
+*	      in a bitmask indexed by module id once when the index is built
+*/
+class ModuleIndex
+{
+public:
+	/**
+	*	@brief constructor
+	*	@param modules [in] loaded modules given by GetLoadedModules
+	*	@param skipModules [in] comma separated prefixes of module file names to skip
+	*/
+	ModuleIndex(const std::vector<ModuleInfo> &modules, const std::string &skipModules);
+
+	/**
+	*	@brief find the module containing the address
+	*	@return module id (index of modules given to the constructor), -1 if not found
+	*/
+	int Find(ULONG64 address) const;
+
+	/**
+	*	@brief the module is in the skip list
+	*/
+	bool IsSkipped(int id) const { return 0 <= id && (skipMask_[id / 32] & (1U << (id % 32))) != 0; }
+
+	/**
+	*	@brief skip list the index was built with
+	*/
+	const std::string &GetSkipModules() const { return skipModules_; }
+
+	/**
+	*	@brief format the address as "module+offset" without the debugger
+	*	@param address [in] frame address
+	*	@param text [out] formatted address
+	*	@retval false no module contains the address
+	*/
+	bool FormatFrame(ULONG64 address, std::string &text) const;
+
+	/**
+	*	@brief module name as the debugger gives, the file name without extension
+	*/
+	static std::string GetModuleName(const CHAR *fullDllName);
+
+private:
+	struct Interval
+	{
+		ULONG64 start;
+		ULONG64 end;
+		int id;
+		bool operator<(const Interval &rhs) const
+		{
+			return start < rhs.start;
+		}
+	};
+
+	/**
+	*	@brief intervals sorted by start address
+	*/
+	std::vector<Interval> intervals_;
+
+	/**
+	*	@brief bit per module id, set if skipped
+	*/
+	std::vector<ULONG32> skipMask_;
+
+	/**
+	*	@brief module names indexed by module id
+	*/
+	std::vector<std::string> names_;
+
+	const std::string skipModules_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	ModuleIndex& operator=(const ModuleIndex&);
+};
@@ -0,0 +1,1183 @@
+#include "common.h"
+#include "Utility.h"
+#include "DumpReader.h"
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <string>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <set>
+#endif
+
+/**
+*	@brief dump used as the target
+*/
+static DumpReader *target = NULL;
+
+//
+// type layouts
+//
+
+struct FieldLayout
+{
+	ULONG64 minVersion; // OS version this layout applies from
+	ULONG64 maxVersion; // OS version this layout applies until
+	const char *type;
+	const char *field; // NULL for size of the type
+	ULONG offset;
+	ULONG size;
+};
+
+#define ANY_VERSION 0, ~0ULL
+#define WIN7 OS_VERSION_WIN7, OS_VERSION_WIN7
+#define WIN8_OR_LATER OS_VERSION_WIN8, ~0ULL
+#define WIN8 OS_VERSION_WIN8, OS_VERSION_WIN8
+#define WIN81_OR_LATER OS_VERSION_WIN81, ~0ULL
+
+/**
+*	@brief layouts of x64 ntdll types used by heapstat
+*	@note 32 bit targets are analyzed with fixed offsets and need no layout
+*/
+static const FieldLayout layouts64[] = {
+	{ ANY_VERSION, "_LIST_ENTRY", "Flink", 0x0, 8 },
+	{ ANY_VERSION, "_LIST_ENTRY", "Blink", 0x8, 8 },
+	{ ANY_VERSION, "_PEB", "Ldr", 0x18, 8 },
+	{ ANY_VERSION, "_PEB", "NtGlobalFlag", 0xbc, 4 },
+	{ ANY_VERSION, "_PEB", "NumberOfHeaps", 0xe8, 4 },
+	{ ANY_VERSION, "_PEB", "ProcessHeaps", 0xf0, 8 },
+	{ ANY_VERSION, "_PEB", "OSMajorVersion", 0x118, 4 },
+	{ ANY_VERSION, "_PEB", "OSMinorVersion", 0x11c, 4 },
+	{ ANY_VERSION, "_PEB_LDR_DATA", "InMemoryOrderModuleList", 0x20, 0x10 },
+	{ ANY_VERSION, "_LDR_DATA_TABLE_ENTRY", NULL, 0, 0x58 }, // fields used by heapstat
+	{ ANY_VERSION, "_LDR_DATA_TABLE_ENTRY", "DllBase", 0x30, 8 },
+	{ ANY_VERSION, "_LDR_DATA_TABLE_ENTRY", "SizeOfImage", 0x40, 4 },
+	{ ANY_VERSION, "_LDR_DATA_TABLE_ENTRY", "FullDllName", 0x48, 0x10 },
+	{ ANY_VERSION, "_HEAP", "Encoding", 0x80, 0x10 },
+	{ WIN7, "_HEAP", "VirtualAllocdBlocks", 0x118, 0x10 },
+	{ WIN7, "_HEAP", "FrontEndHeap", 0x178, 8 },
+	{ WIN7, "_HEAP", "FrontEndHeapType", 0x182, 1 },
+	{ WIN8_OR_LATER, "_HEAP", "VirtualAllocdBlocks", 0x110, 0x10 },
+	{ WIN8_OR_LATER, "_HEAP", "FrontEndHeap", 0x170, 8 },
+	{ WIN8_OR_LATER, "_HEAP", "FrontEndHeapType", 0x17a, 1 },
+	{ WIN7, "_LFH_HEAP", "SubSegmentZones", 0x28, 0x10 },
+	{ WIN8_OR_LATER, "_LFH_HEAP", "SubSegmentZones", 0x8, 0x10 },
+	{ ANY_VERSION, "_LFH_BLOCK_ZONE", NULL, 0, 0x20 },
+	{ ANY_VERSION, "_LFH_BLOCK_ZONE", "ListEntry", 0x0, 0x10 },
+	{ WIN7, "_LFH_BLOCK_ZONE", "FreePointer", 0x10, 8 },
+	{ WIN8, "_LFH_BLOCK_ZONE", "FreePointer", 0x10, 8 },
+	{ WIN81_OR_LATER, "_LFH_BLOCK_ZONE", "NextIndex", 0x10, 4 },
+	{ WIN7, "_HEAP_SUBSEGMENT", NULL, 0, 0x30 },
+	{ WIN7, "_HEAP_SUBSEGMENT", "UserBlocks", 0x8, 8 },
+	{ WIN7, "_HEAP_SUBSEGMENT", "BlockSize", 0x18, 2 },
+	{ WIN7, "_HEAP_SUBSEGMENT", "BlockCount", 0x1c, 2 },
+	{ WIN8_OR_LATER, "_HEAP_SUBSEGMENT", NULL, 0, 0x40 },
+	{ WIN8_OR_LATER, "_HEAP_SUBSEGMENT", "UserBlocks", 0x8, 8 },
+	{ WIN8_OR_LATER, "_HEAP_SUBSEGMENT", "BlockSize", 0x24, 2 },
+	{ WIN8_OR_LATER, "_HEAP_SUBSEGMENT", "BlockCount", 0x28, 2 },
+	{ WIN8, "_HEAP_USERDATA_HEADER", "FirstAllocationOffset", 0x18, 2 },
+	{ WIN8, "_HEAP_USERDATA_HEADER", "BlockStride", 0x1a, 2 },
+	{ WIN81_OR_LATER, "_HEAP_USERDATA_HEADER", "EncodedOffsets", 0x18, 4 },
+	{ WIN8_OR_LATER, "_HEAP_USERDATA_HEADER", "BusyBitmap", 0x20, 0x10 },
+	{ ANY_VERSION, "_DPH_HEAP_BLOCK", NULL, 0, 0x68 }, // fields used by heapstat
+	{ ANY_VERSION, "_DPH_HEAP_BLOCK", "pUserAllocation", 0x20, 8 },
+	{ ANY_VERSION, "_DPH_HEAP_BLOCK", "pVirtualBlock", 0x28, 8 },
+	{ ANY_VERSION, "_DPH_HEAP_BLOCK", "nVirtualBlockSize", 0x30, 8 },
+	{ ANY_VERSION, "_DPH_HEAP_BLOCK", "nUserRequestedSize", 0x40, 8 },
+	{ ANY_VERSION, "_DPH_HEAP_BLOCK", "StackTrace", 0x60, 8 },
+	{ ANY_VERSION, "_DPH_HEAP_ROOT", "BusyNodesTable", 0x38, 0x68 },
+	{ ANY_VERSION, "_DPH_HEAP_ROOT", "NextHeap", 0x138, 0x10 },
+	{ ANY_VERSION, "_DPH_HEAP_ROOT", "NormalHeap", 0x150, 8 },
+	{ ANY_VERSION, "_STACK_TRACE_DATABASE", "NextFreeLowerMemory", 0xa0, 8 },
+	{ ANY_VERSION, "_STACK_TRACE_DATABASE", "NumberOfEntriesAdded", 0xb4, 4 },
+	{ ANY_VERSION, "_STACK_TRACE_DATABASE", "NumberOfBuckets", 0xc0, 4 },
+	{ ANY_VERSION, "_STACK_TRACE_DATABASE", "Buckets", 0xc8, 8 },
+};
+
+/**
+*	@brief layouts loaded by LoadTypeLayouts, "type!field" or "type" to (offset, size)
+*/
+static std::map<std::string, std::pair<ULONG, ULONG> > userLayouts;
+
+/**
+*	@brief false while SetLayoutMessages suppresses "no layout" messages
+*/
+static bool layoutMessages = true;
+
+/**
+*	@brief strip module name from "module!type"
+*/
+static const char *StripModule(PCSTR name)
+{
+	const char *ptr = strchr(name, '!');
+	return ptr != NULL ? ptr + 1 : name;
+}
+
+static bool FindLayout(PCSTR type, PCSTR field, ULONG &offset, ULONG &size)
+{
+	type = StripModule(type);
+	std::string key = field != NULL ? std::string(type) + "!" + field : std::string(type);
+	std::map<std::string, std::pair<ULONG, ULONG> >::iterator itr = userLayouts.find(key);
+	if (itr != userLayouts.end())
+	{
+		offset = itr->second.first;
+		size = itr->second.second;
+		return true;
+	}
+	if (target == NULL || !target->IsPtr64())
+	{
+		return false;
+	}
+	ULONG64 version = target->GetOSVersion();
+	for (size_t i = 0; i < _countof(layouts64); i++)
+	{
+		const FieldLayout &layout = layouts64[i];
+		if (layout.minVersion <= version && version <= layout.maxVersion &&
+			strcmp(layout.type, type) == 0 &&
+			(field == NULL ? layout.field == NULL : (layout.field != NULL && strcmp(layout.field, field) == 0)))
+		{
+			offset = layout.offset;
+			size = layout.size;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool LoadTypeLayouts(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		dprintf("cannot open %s\n", path);
+		return false;
+	}
+	char line[256];
+	int lineNumber = 0;
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		lineNumber++;
+		if (line[0] == '#')
+		{
+			continue;
+		}
+		char type[128], field[128];
+		ULONG offset, size;
+		if (sscanf(line, "%127s %127s %x %x", type, field, &offset, &size) == 4)
+		{
+			userLayouts[std::string(StripModule(type)) + "!" + field] = std::make_pair(offset, size);
+		}
+		else if (sscanf(line, "%127s %x", type, &size) == 2)
+		{
+			userLayouts[StripModule(type)] = std::make_pair(0U, size);
+		}
+		else if (sscanf(line, "%127s", type) == 1)
+		{
+			dprintf("%s(%d): invalid layout\n", path, lineNumber);
+			fclose(file);
+			return false;
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+void SetLayoutMessages(bool enabled)
+{
+	layoutMessages = enabled;
+}
+
+ULONG GetFieldData(ULONG64 address, PCSTR type, PCSTR field, ULONG size, PVOID value)
+{
+	ULONG offset, fieldSize;
+	if (!FindLayout(type, field, offset, fieldSize))
+	{
+		if (layoutMessages)
+		{
+			dprintf("no layout for %s::%s\n", type, field);
+		}
+		return 1;
+	}
+	ULONG length = fieldSize < size ? fieldSize : size;
+	ZeroMemory(value, size);
+	ULONG cb;
+	if (!ReadTargetMemory(address + offset, value, length, &cb) || cb != length)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+ULONG GetFieldOffset(PCSTR type, PCSTR field, PULONG offset)
+{
+	ULONG size;
+	if (!FindLayout(type, field, *offset, size))
+	{
+		if (layoutMessages)
+		{
+			dprintf("no layout for %s::%s\n", type, field);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+ULONG GetFieldOffsetAndSize(PCSTR type, PCSTR field, PULONG offset, PULONG size)
+{
+	if (!FindLayout(type, field, *offset, *size))
+	{
+		if (layoutMessages)
+		{
+			dprintf("no layout for %s::%s\n", type, field);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+ULONG GetTypeSize(PCSTR type)
+{
+	ULONG offset, size;
+	if (!FindLayout(type, NULL, offset, size))
+	{
+		if (layoutMessages)
+		{
+			dprintf("no layout for %s\n", type);
+		}
+		return 0;
+	}
+	return size;
+}
+
+//
+// target
+//
+
+void AttachDump(DumpReader *dump)
+{
+	target = dump;
+}
+
+BOOL ReadMemory(ULONG64 address, PVOID buffer, ULONG size, PULONG cb)
+{
+	if (target == NULL)
+	{
+		if (cb != NULL)
+		{
+			*cb = 0;
+		}
+		return FALSE;
+	}
+	return target->Read(address, buffer, size, cb);
+}
+
+const UCHAR *GetTargetPointer(ULONG64 address, ULONG size)
+{
+	return target != NULL ? target->GetPointer(address, size) : NULL;
+}
+
+BOOL IsPtr64()
+{
+	// without a dump, print as a 64 bit debugger does not to truncate addresses in snapshots
+	return target == NULL || target->IsPtr64();
+}
+
+void GetTebAddress(PULONG64 address)
+{
+	*address = target != NULL ? target->GetTebAddress() : 0;
+}
+
+void GetPebAddress(ULONG64 thread, PULONG64 address)
+{
+	UNREFERENCED_PARAMETER(thread);
+
+	// _TEB::ProcessEnvironmentBlock
+	ULONG cb;
+	ULONG64 teb;
+	GetTebAddress(&teb);
+	if (IsPtr64())
+	{
+		ULONG64 peb;
+		*address = READMEMORY(teb + 0x60, peb) ? peb : 0;
+	}
+	else
+	{
+		ULONG32 peb;
+		*address = READMEMORY(teb + 0x30, peb) ? peb : 0;
+	}
+}
+
+//
+// symbols
+//
+
+/**
+*	@brief symbols given by DefineSymbol
+*/
+static std::map<std::string, ULONG64> definedSymbols;
+
+/**
+*	@brief exported functions of a module, sorted by address
+*/
+typedef std::vector<std::pair<ULONG64, std::string> > Exports;
+
+/**
+*	@brief module base address to exports
+*/
+static std::map<ULONG64, Exports> exportsCache;
+
+void DefineSymbol(const char *name, ULONG64 address)
+{
+	definedSymbols[name] = address;
+}
+
+/**
+*	@brief module name used in symbols, like the debugger does
+*	@note "ntdll" for the first ntdll.dll and "ntdll_<base>" for the other (WOW64)
+*/
+static std::string GetModuleName(const DumpReader::Module &module)
+{
+	std::string name = module.path;
+	size_t pos = name.find_last_of("\\/");
+	if (pos != std::string::npos)
+	{
+		name = name.substr(pos + 1);
+	}
+	pos = name.find_last_of('.');
+	if (pos != std::string::npos)
+	{
+		name = name.substr(0, pos);
+	}
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+	const std::vector<DumpReader::Module> &modules = target->GetModules();
+	for (std::vector<DumpReader::Module>::const_iterator itr = modules.begin(); itr != modules.end(); ++itr)
+	{
+		if (itr->base == module.base)
+		{
+			break;
+		}
+		std::string other = itr->path.substr(itr->path.find_last_of("\\/") + 1);
+		std::transform(other.begin(), other.end(), other.begin(), ::tolower);
+		if (other.compare(0, name.size() + 1, name + ".") == 0)
+		{
+			CHAR suffix[] = "_01234567";
+			_snprintf_s(suffix, _TRUNCATE, "_%08x", (ULONG32)module.base);
+			return name + suffix;
+		}
+	}
+	return name;
+}
+
+/**
+*	@brief upper bound of NumberOfFunctions and NumberOfNames, ordinals are 16 bit
+*/
+static const ULONG32 MAX_EXPORTS = 0x10000;
+
+/**
+*	@brief read count elements of an array in the image
+*	@retval FALSE the array is too large or not readable at once
+*/
+template <typename T>
+static BOOL ReadImageArray(ULONG64 address, ULONG32 count, std::vector<T> &values)
+{
+	values.clear();
+	if (count == 0)
+	{
+		return TRUE;
+	}
+	const ULONG64 size = (ULONG64)count * sizeof(T);
+	if (size > 0xffffffff)
+	{
+		return FALSE;
+	}
+	values.resize(count);
+	ULONG cb;
+	return ReadTargetMemory(address, &values[0], (ULONG)size, &cb) && cb == size;
+}
+
+/**
+*	@brief read export directory of the module image in the dump
+*/
+static const Exports &GetExports(const DumpReader::Module &module)
+{
+	std::map<ULONG64, Exports>::iterator found = exportsCache.find(module.base);
+	if (found != exportsCache.end())
+	{
+		return found->second;
+	}
+	Exports &exports = exportsCache[module.base];
+
+	ULONG cb;
+	ULONG32 peOffset; // IMAGE_DOS_HEADER::e_lfanew
+	if (!READMEMORY(module.base + 0x3c, peOffset))
+	{
+		return exports;
+	}
+	USHORT magic; // IMAGE_OPTIONAL_HEADER::Magic
+	if (!READMEMORY(module.base + peOffset + 0x18, magic))
+	{
+		return exports;
+	}
+	// IMAGE_DIRECTORY_ENTRY_EXPORT
+	ULONG32 directory[2];
+	ULONG offset = magic == 0x20b ? 0x88 : 0x78;
+	if (!READMEMORY(module.base + peOffset + offset, directory) || directory[0] == 0)
+	{
+		return exports;
+	}
+	// IMAGE_EXPORT_DIRECTORY
+	ULONG32 exportDirectory[10];
+	if (!READMEMORY(module.base + directory[0], exportDirectory))
+	{
+		return exports;
+	}
+	// counts come from the dump, the arrays must fit in the export directory
+	ULONG32 numberOfFunctions = exportDirectory[5];
+	ULONG32 numberOfNames = exportDirectory[6];
+	if (numberOfFunctions > MAX_EXPORTS || numberOfNames > MAX_EXPORTS ||
+		(ULONG64)numberOfFunctions * sizeof(ULONG32) > directory[1] ||
+		(ULONG64)numberOfNames * (sizeof(ULONG32) + sizeof(USHORT)) > directory[1])
+	{
+		return exports;
+	}
+	std::vector<ULONG32> functions;
+	std::vector<ULONG32> names;
+	std::vector<USHORT> ordinals;
+	if (!ReadImageArray(module.base + exportDirectory[7], numberOfFunctions, functions) ||
+		!ReadImageArray(module.base + exportDirectory[8], numberOfNames, names) ||
+		!ReadImageArray(module.base + exportDirectory[9], numberOfNames, ordinals))
+	{
+		return exports;
+	}
+	for (ULONG32 i = 0; i < numberOfNames; i++)
+	{
+		if (ordinals[i] >= numberOfFunctions)
+		{
+			continue;
+		}
+		ULONG32 rva = functions[ordinals[i]];
+		if (directory[0] <= rva && rva < directory[0] + directory[1])
+		{
+			// forwarder
+			continue;
+		}
+		CHAR name[256];
+		if (!ReadTargetMemory(module.base + names[i], name, sizeof(name) - 1, &cb) && cb == 0)
+		{
+			continue;
+		}
+		name[cb] = '\0';
+		exports.push_back(std::make_pair(module.base + rva, std::string(name)));
+	}
+	std::sort(exports.begin(), exports.end());
+	return exports;
+}
+
+static const DumpReader::Module *FindModule(ULONG64 address)
+{
+	const std::vector<DumpReader::Module> &modules = target->GetModules();
+	for (std::vector<DumpReader::Module>::const_iterator itr = modules.begin(); itr != modules.end(); ++itr)
+	{
+		if (itr->base <= address && address < itr->base + itr->size)
+		{
+			return &*itr;
+		}
+	}
+	return NULL;
+}
+
+void GetSymbol(ULONG64 offset, PCHAR buffer, PULONG64 displacement)
+{
+	buffer[0] = '\0';
+	*displacement = offset;
+	if (target == NULL)
+	{
+		return;
+	}
+	const DumpReader::Module *module = FindModule(offset);
+	if (module == NULL)
+	{
+		return;
+	}
+	std::string symbol = GetModuleName(*module);
+	*displacement = offset - module->base;
+	const Exports &exports = GetExports(*module);
+	Exports::const_iterator itr = std::upper_bound(exports.begin(), exports.end(),
+		std::make_pair(offset, std::string("\xff")));
+	if (itr != exports.begin())
+	{
+		--itr;
+		symbol += "!" + itr->second;
+		*displacement = offset - itr->first;
+	}
+	// the debugger fills a buffer of 256 bytes or more
+	size_t length = symbol.size() < 255 ? symbol.size() : 255;
+	memcpy(buffer, symbol.c_str(), length);
+	buffer[length] = '\0';
+}
+
+BOOL GetSymbolRanges(PCSTR key, std::vector<AddressRange> &ranges)
+{
+	if (target == NULL)
+	{
+		return TRUE;
+	}
+	const CHAR *bang = strchr(key, '!');
+	const std::vector<DumpReader::Module> &modules = target->GetModules();
+	for (std::vector<DumpReader::Module>::const_iterator itr = modules.begin(); itr != modules.end(); ++itr)
+	{
+		std::string moduleName = GetModuleName(*itr);
+		if (bang == NULL)
+		{
+			if (moduleName.compare(0, strlen(key), key) == 0)
+			{
+				AddressRange range = { itr->base, itr->base + itr->size };
+				ranges.push_back(range);
+			}
+			continue;
+		}
+		if (moduleName.compare(0, std::string::npos, key, bang - key) != 0)
+		{
+			continue;
+		}
+		// GetSymbol names an address by the nearest export below it
+		const char *prefix = bang + 1;
+		const size_t prefixLength = strlen(prefix);
+		const Exports &exports = GetExports(*itr);
+		for (Exports::const_iterator itr_ = exports.begin(); itr_ != exports.end(); ++itr_)
+		{
+			if (itr_->second.compare(0, prefixLength, prefix) != 0)
+			{
+				continue;
+			}
+			Exports::const_iterator next = itr_ + 1;
+			while (next != exports.end() && next->first == itr_->first)
+			{
+				++next;
+			}
+			AddressRange range = { itr_->first, next != exports.end() ? next->first : itr->base + itr->size };
+			ranges.push_back(range);
+		}
+	}
+	return TRUE;
+}
+
+BOOL GetExpressionEx(PCSTR expression, ULONG64 *value, PCSTR *remainder)
+{
+	if (remainder != NULL)
+	{
+		*remainder = expression + strlen(expression);
+	}
+	while (*expression == ' ')
+	{
+		expression++;
+	}
+
+	std::map<std::string, ULONG64>::iterator defined = definedSymbols.find(expression);
+	if (defined != definedSymbols.end())
+	{
+		*value = defined->second;
+		return TRUE;
+	}
+
+	if (target != NULL)
+	{
+		std::string name = expression;
+		std::string moduleName = name.substr(0, name.find('!'));
+		const std::vector<DumpReader::Module> &modules = target->GetModules();
+		for (std::vector<DumpReader::Module>::const_iterator itr = modules.begin(); itr != modules.end(); ++itr)
+		{
+			if (GetModuleName(*itr) != moduleName)
+			{
+				continue;
+			}
+			if (moduleName == name)
+			{
+				*value = itr->base;
+				return TRUE;
+			}
+			const Exports &exports = GetExports(*itr);
+			for (Exports::const_iterator itr_ = exports.begin(); itr_ != exports.end(); ++itr_)
+			{
+				if (name.compare(moduleName.size() + 1, std::string::npos, itr_->second) == 0)
+				{
+					*value = itr_->first;
+					return TRUE;
+				}
+			}
+		}
+	}
+
+	// number in hex like the debugger, "0x" prefix and "`" separator are allowed
+	std::string digits;
+	const char *ptr = expression;
+	if (ptr[0] == '0' && (ptr[1] == 'x' || ptr[1] == 'X'))
+	{
+		ptr += 2;
+	}
+	for (; *ptr != '\0' && *ptr != ' '; ptr++)
+	{
+		if (*ptr != '`')
+		{
+			digits += *ptr;
+		}
+	}
+	char *end = NULL;
+	*value = _strtoui64(digits.c_str(), &end, 16);
+	return !digits.empty() && *end == '\0';
+}
+
+ULONG64 GetExpression(PCSTR expression)
+{
+	ULONG64 value;
+	if (!GetExpressionEx(expression, &value, NULL))
+	{
+		dprintf("cannot evaluate %s\n", expression);
+		return 0;
+	}
+	return value;
+}
+
+//
+// output
+//
+
+/**
+*	@brief format like the debugger
+*	@param debugger [in] true: %p takes ULONG64 printed in target pointer width, %ly prints symbol
+*/
+static std::string FormatV(const char *format, va_list args, bool debugger)
+{
+	std::string str;
+	const char *ptr = format;
+	while (*ptr != '\0')
+	{
+		if (*ptr != '%')
+		{
+			str += *ptr++;
+			continue;
+		}
+		if (ptr[1] == '%')
+		{
+			str += '%';
+			ptr += 2;
+			continue;
+		}
+
+		// %[flags][width][.precision][length]conversion
+		std::string spec = "%";
+		ptr++;
+		while (strchr("-+ #0", *ptr) != NULL && *ptr != '\0')
+		{
+			spec += *ptr++;
+		}
+		while (('0' <= *ptr && *ptr <= '9') || *ptr == '.' || *ptr == '*')
+		{
+			if (*ptr == '*')
+			{
+				char width[16];
+				snprintf(width, sizeof(width), "%d", va_arg(args, int));
+				spec += width;
+				ptr++;
+			}
+			else
+			{
+				spec += *ptr++;
+			}
+		}
+		enum { DEFAULT, SHORT, LONG, LONGLONG, SIZE } length = DEFAULT;
+		if (strncmp(ptr, "I64", 3) == 0 || strncmp(ptr, "ll", 2) == 0)
+		{
+			length = LONGLONG;
+			ptr += *ptr == 'I' ? 3 : 2;
+		}
+		else if (*ptr == 'I' || *ptr == 'z')
+		{
+			length = SIZE;
+			ptr++;
+		}
+		else if (*ptr == 'l')
+		{
+			length = LONG;
+			ptr++;
+		}
+		else if (*ptr == 'h')
+		{
+			length = SHORT;
+			ptr++;
+		}
+
+		char conversion = *ptr;
+		if (conversion == '\0')
+		{
+			break;
+		}
+		ptr++;
+
+		char buffer[512];
+		buffer[0] = '\0';
+		switch (conversion)
+		{
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+		case 'c':
+			if (length == LONGLONG)
+			{
+				spec += "ll";
+				spec += conversion;
+				snprintf(buffer, sizeof(buffer), spec.c_str(), va_arg(args, long long));
+			}
+			else if (length == SIZE)
+			{
+				spec += "z";
+				spec += conversion;
+				snprintf(buffer, sizeof(buffer), spec.c_str(), va_arg(args, size_t));
+			}
+			else
+			{
+				// long is 32 bit on Windows
+				spec += conversion;
+				snprintf(buffer, sizeof(buffer), spec.c_str(), va_arg(args, int));
+			}
+			break;
+		case 's':
+			spec += conversion;
+			snprintf(buffer, sizeof(buffer), spec.c_str(), va_arg(args, const char *));
+			break;
+		case 'p':
+			if (debugger)
+			{
+				snprintf(buffer, sizeof(buffer), IsPtr64() ? "%016llx" : "%08llx", va_arg(args, ULONG64));
+			}
+			else
+			{
+				spec += conversion;
+				snprintf(buffer, sizeof(buffer), spec.c_str(), va_arg(args, void *));
+			}
+			break;
+		case 'y':
+			if (debugger && length == LONG)
+			{
+				ULONG64 address = va_arg(args, ULONG64);
+				CHAR symbol[256];
+				ULONG64 displacement;
+				GetSymbol(address, symbol, &displacement);
+				if (symbol[0] == '\0')
+				{
+					snprintf(buffer, sizeof(buffer), IsPtr64() ? "%016llx" : "%08llx", address);
+				}
+				else if (displacement == 0)
+				{
+					snprintf(buffer, sizeof(buffer), "%s", symbol);
+				}
+				else
+				{
+					snprintf(buffer, sizeof(buffer), "%s+0x%llx", symbol, displacement);
+				}
+				break;
+			}
+			// fall through
+		default:
+			spec += conversion;
+			str += spec;
+			continue;
+		}
+		str += buffer;
+	}
+	return str;
+}
+
+void dprintf(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	std::string str = FormatV(format, args, true);
+	va_end(args);
+	fputs(str.c_str(), stdout);
+}
+
+#ifndef _WIN32
+
+//
+// C runtime
+//
+
+int _vscprintf(const char *format, va_list args)
+{
+	return (int)FormatV(format, args, false).size();
+}
+
+int _vsnprintf_s(char *buffer, size_t size, size_t count, const char *format, va_list args)
+{
+	std::string str = FormatV(format, args, false);
+	size_t length = count < str.size() ? count : str.size();
+	if (size == 0)
+	{
+		return -1;
+	}
+	if (length >= size)
+	{
+		length = size - 1;
+	}
+	memcpy(buffer, str.c_str(), length);
+	buffer[length] = '\0';
+	return length == str.size() ? (int)length : -1;
+}
+
+int WideCharToMultiByte(ULONG codePage, ULONG flags, const WCHAR *wide, int wideLength,
+	LPSTR multiByte, int multiByteLength, LPCSTR defaultChar, BOOL *usedDefaultChar)
+{
+	UNREFERENCED_PARAMETER(codePage);
+	UNREFERENCED_PARAMETER(flags);
+	UNREFERENCED_PARAMETER(defaultChar);
+	UNREFERENCED_PARAMETER(usedDefaultChar);
+
+	// UTF-16 to UTF-8
+	std::string str;
+	for (int i = 0; i < wideLength; i++)
+	{
+		ULONG ch = wide[i];
+		if (0xd800 <= ch && ch < 0xdc00 && i + 1 < wideLength && 0xdc00 <= wide[i + 1] && wide[i + 1] < 0xe000)
+		{
+			ch = 0x10000 + ((ch - 0xd800) << 10) + (wide[++i] - 0xdc00);
+		}
+		if (ch < 0x80)
+		{
+			str += (char)ch;
+		}
+		else if (ch < 0x800)
+		{
+			str += (char)(0xc0 | (ch >> 6));
+			str += (char)(0x80 | (ch & 0x3f));
+		}
+		else if (ch < 0x10000)
+		{
+			str += (char)(0xe0 | (ch >> 12));
+			str += (char)(0x80 | ((ch >> 6) & 0x3f));
+			str += (char)(0x80 | (ch & 0x3f));
+		}
+		else
+		{
+			str += (char)(0xf0 | (ch >> 18));
+			str += (char)(0x80 | ((ch >> 12) & 0x3f));
+			str += (char)(0x80 | ((ch >> 6) & 0x3f));
+			str += (char)(0x80 | (ch & 0x3f));
+		}
+	}
+	if (multiByteLength == 0)
+	{
+		return (int)str.size();
+	}
+	if ((int)str.size() > multiByteLength)
+	{
+		return 0;
+	}
+	memcpy(multiByte, str.data(), str.size());
+	return (int)str.size();
+}
+
+//
+// file
+//
+
+static DWORD lastError = 0;
+
+HANDLE CreateFile(LPCSTR fileName, DWORD desiredAccess, DWORD shareMode, void *securityAttributes,
+	DWORD creationDisposition, DWORD flagsAndAttributes, HANDLE templateFile)
+{
+	UNREFERENCED_PARAMETER(shareMode);
+	UNREFERENCED_PARAMETER(securityAttributes);
+	UNREFERENCED_PARAMETER(flagsAndAttributes);
+	UNREFERENCED_PARAMETER(templateFile);
+
+	int flags = (desiredAccess & GENERIC_WRITE) ? O_WRONLY : O_RDONLY;
+	if (creationDisposition != OPEN_EXISTING)
+	{
+		flags |= O_CREAT | (creationDisposition == CREATE_NEW ? O_EXCL : O_TRUNC);
+	}
+	int fd = open(fileName, flags, 0644);
+	if (fd < 0)
+	{
+		lastError = errno == EEXIST ? ERROR_FILE_EXISTS :
+			errno == ENOENT ? (creationDisposition == OPEN_EXISTING ? ERROR_FILE_NOT_FOUND : ERROR_PATH_NOT_FOUND) : errno;
+		return INVALID_HANDLE_VALUE;
+	}
+	return (HANDLE)(intptr_t)fd;
+}
+
+BOOL WriteFile(HANDLE file, const void *buffer, DWORD size, DWORD *written, void *overlapped)
+{
+	UNREFERENCED_PARAMETER(overlapped);
+
+	*written = 0;
+	while (*written < size)
+	{
+		ssize_t result = write((int)(intptr_t)file, (const char *)buffer + *written, size - *written);
+		if (result < 0)
+		{
+			lastError = errno;
+			return FALSE;
+		}
+		*written += (DWORD)result;
+	}
+	return TRUE;
+}
+
+BOOL ReadFile(HANDLE file, void *buffer, DWORD size, DWORD *read, void *overlapped)
+{
+	UNREFERENCED_PARAMETER(overlapped);
+
+	ssize_t result = ::read((int)(intptr_t)file, buffer, size);
+	if (result < 0)
+	{
+		*read = 0;
+		lastError = errno;
+		return FALSE;
+	}
+	*read = (DWORD)result;
+	return TRUE;
+}
+
+BOOL DeleteFile(LPCSTR fileName)
+{
+	if (unlink(fileName) != 0)
+	{
+		lastError = errno;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+*	@brief thread or event, waited by WaitForSingleObject
+*/
+struct KernelObject
+{
+	enum Type { THREAD, EVENT } type;
+
+	// thread
+	pthread_t thread;
+	bool joined;
+
+	// event
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool manualReset;
+	bool signaled;
+};
+
+/**
+*	@brief handles of live threads and events, other handles are file descriptors
+*/
+static std::set<HANDLE> kernelObjects;
+static pthread_mutex_t kernelObjectsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static KernelObject *FindKernelObject(HANDLE handle)
+{
+	pthread_mutex_lock(&kernelObjectsMutex);
+	bool found = kernelObjects.find(handle) != kernelObjects.end();
+	pthread_mutex_unlock(&kernelObjectsMutex);
+	return found ? (KernelObject *)handle : NULL;
+}
+
+static HANDLE AddKernelObject(KernelObject *object)
+{
+	pthread_mutex_lock(&kernelObjectsMutex);
+	kernelObjects.insert((HANDLE)object);
+	pthread_mutex_unlock(&kernelObjectsMutex);
+	return (HANDLE)object;
+}
+
+static void *StartThread(void *parameter)
+{
+	// the start routine is passed by copy, the thread may be closed before it ends
+	std::pair<LPTHREAD_START_ROUTINE, LPVOID> *start = (std::pair<LPTHREAD_START_ROUTINE, LPVOID> *)parameter;
+	LPTHREAD_START_ROUTINE startAddress = start->first;
+	LPVOID startParameter = start->second;
+	delete start;
+	startAddress(startParameter);
+	return NULL;
+}
+
+HANDLE CreateThread(void *threadAttributes, SIZE_T stackSize, LPTHREAD_START_ROUTINE startAddress,
+	LPVOID parameter, DWORD creationFlags, DWORD *threadId)
+{
+	UNREFERENCED_PARAMETER(threadAttributes);
+	UNREFERENCED_PARAMETER(stackSize);
+	UNREFERENCED_PARAMETER(creationFlags);
+
+	KernelObject *object = new KernelObject();
+	object->type = KernelObject::THREAD;
+	object->joined = false;
+	std::pair<LPTHREAD_START_ROUTINE, LPVOID> *start = new std::pair<LPTHREAD_START_ROUTINE, LPVOID>(startAddress, parameter);
+	int result = pthread_create(&object->thread, NULL, StartThread, start);
+	if (result != 0)
+	{
+		lastError = result;
+		delete start;
+		delete object;
+		return NULL;
+	}
+	if (threadId != NULL)
+	{
+		*threadId = 0;
+	}
+	return AddKernelObject(object);
+}
+
+HANDLE CreateEvent(void *eventAttributes, BOOL manualReset, BOOL initialState, LPCSTR name)
+{
+	UNREFERENCED_PARAMETER(eventAttributes);
+	UNREFERENCED_PARAMETER(name);
+
+	KernelObject *object = new KernelObject();
+	object->type = KernelObject::EVENT;
+	pthread_mutex_init(&object->mutex, NULL);
+	pthread_cond_init(&object->cond, NULL);
+	object->manualReset = manualReset != FALSE;
+	object->signaled = initialState != FALSE;
+	return AddKernelObject(object);
+}
+
+BOOL SetEvent(HANDLE event)
+{
+	KernelObject *object = FindKernelObject(event);
+	if (object == NULL || object->type != KernelObject::EVENT)
+	{
+		return FALSE;
+	}
+	pthread_mutex_lock(&object->mutex);
+	object->signaled = true;
+	pthread_cond_broadcast(&object->cond);
+	pthread_mutex_unlock(&object->mutex);
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE event)
+{
+	KernelObject *object = FindKernelObject(event);
+	if (object == NULL || object->type != KernelObject::EVENT)
+	{
+		return FALSE;
+	}
+	pthread_mutex_lock(&object->mutex);
+	object->signaled = false;
+	pthread_mutex_unlock(&object->mutex);
+	return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+	// only INFINITE is used
+	UNREFERENCED_PARAMETER(milliseconds);
+
+	KernelObject *object = FindKernelObject(handle);
+	if (object == NULL)
+	{
+		return WAIT_FAILED;
+	}
+	if (object->type == KernelObject::THREAD)
+	{
+		if (!object->joined)
+		{
+			pthread_join(object->thread, NULL);
+			object->joined = true;
+		}
+		return WAIT_OBJECT_0;
+	}
+	pthread_mutex_lock(&object->mutex);
+	while (!object->signaled)
+	{
+		pthread_cond_wait(&object->cond, &object->mutex);
+	}
+	if (!object->manualReset)
+	{
+		object->signaled = false;
+	}
+	pthread_mutex_unlock(&object->mutex);
+	return WAIT_OBJECT_0;
+}
+
+void InitializeCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_init(&section->mutex, NULL);
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_destroy(&section->mutex);
+}
+
+void EnterCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_lock(&section->mutex);
+}
+
+void LeaveCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_unlock(&section->mutex);
+}
+
+BOOL SwitchToThread()
+{
+	return sched_yield() == 0;
+}
+
+void GetSystemInfo(SYSTEM_INFO *systemInfo)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	systemInfo->dwNumberOfProcessors = count > 0 ? (DWORD)count : 1;
+}
+
+BOOL CloseHandle(HANDLE handle)
+{
+	KernelObject *object = FindKernelObject(handle);
+	if (object == NULL)
+	{
+		return close((int)(intptr_t)handle) == 0;
+	}
+	pthread_mutex_lock(&kernelObjectsMutex);
+	kernelObjects.erase(handle);
+	pthread_mutex_unlock(&kernelObjectsMutex);
+	if (object->type == KernelObject::THREAD)
+	{
+		if (!object->joined)
+		{
+			pthread_detach(object->thread);
+		}
+	}
+	else
+	{
+		pthread_cond_destroy(&object->cond);
+		pthread_mutex_destroy(&object->mutex);
+	}
+	delete object;
+	return TRUE;
+}
+
+DWORD GetLastError()
+{
+	return lastError;
+}
+
+DWORD GetCurrentDirectory(DWORD size, LPSTR buffer)
+{
+	if (getcwd(buffer, size) == NULL)
+	{
+		lastError = errno;
+		return 0;
+	}
+	return (DWORD)strlen(buffer);
+}
+
+#endif
@@ -0,0 +1,178 @@
+#pragma once
+
+/*
+	replacement of the debugger extension API for the offline build (HEAPSTAT_OFFLINE)
+
+	heapstat.cpp, Utility.cpp and processors are compiled as they are,
+	and read the target through a minidump file opened by DumpReader.
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <pthread.h>
+
+typedef int BOOL;
+typedef unsigned char UCHAR, BYTE, *PUCHAR;
+typedef char CHAR, *PCHAR, *LPSTR;
+typedef const char *PCSTR, *LPCSTR;
+typedef unsigned short USHORT, WORD, WCHAR;
+typedef int LONG, LONG32;
+typedef unsigned int ULONG, ULONG32, DWORD, *PULONG;
+typedef unsigned long long ULONG64, ULONGLONG, *PULONG64;
+typedef long long LONG64;
+typedef void VOID, *PVOID, *LPVOID, *HANDLE;
+typedef size_t SIZE_T;
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define CP_ACP 0
+
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+#define ZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+#define _countof(array) (sizeof(array) / sizeof((array)[0]))
+#define _TRUNCATE ((size_t)-1)
+#define _snprintf_s(buffer, count, ...) snprintf((buffer), sizeof(buffer), __VA_ARGS__)
+#define strtok_s strtok_r
+#define _strtoui64 strtoull
+#define _strnicmp strncasecmp
+
+typedef struct LIST_ENTRY32 {
+	ULONG32 Flink;
+	ULONG32 Blink;
+} LIST_ENTRY32;
+
+typedef struct LIST_ENTRY64 {
+	ULONGLONG Flink;
+	ULONGLONG Blink;
+} LIST_ENTRY64;
+
+int WideCharToMultiByte(ULONG codePage, ULONG flags, const WCHAR *wide, int wideLength,
+	LPSTR multiByte, int multiByteLength, LPCSTR defaultChar, BOOL *usedDefaultChar);
+
+int _vscprintf(const char *format, va_list args);
+int _vsnprintf_s(char *buffer, size_t size, size_t count, const char *format, va_list args);
+
+// file API used by UmdhProcessor and heap snapshots
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define FILE_SHARE_READ 1
+#define CREATE_NEW 1
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_PATH_NOT_FOUND 3
+#define ERROR_FILE_EXISTS 80
+
+HANDLE CreateFile(LPCSTR fileName, DWORD desiredAccess, DWORD shareMode, void *securityAttributes,
+	DWORD creationDisposition, DWORD flagsAndAttributes, HANDLE templateFile);
+BOOL WriteFile(HANDLE file, const void *buffer, DWORD size, DWORD *written, void *overlapped);
+BOOL ReadFile(HANDLE file, void *buffer, DWORD size, DWORD *read, void *overlapped);
+BOOL CloseHandle(HANDLE handle);
+BOOL DeleteFile(LPCSTR fileName);
+DWORD GetLastError();
+DWORD GetCurrentDirectory(DWORD size, LPSTR buffer);
+
+// thread API used by AsyncFileWriter and TaskPool, CloseHandle closes threads and events too
+#define WINAPI
+#define INFINITE 0xffffffff
+#define WAIT_OBJECT_0 0
+#define WAIT_FAILED 0xffffffff
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID parameter);
+
+HANDLE CreateThread(void *threadAttributes, SIZE_T stackSize, LPTHREAD_START_ROUTINE startAddress,
+	LPVOID parameter, DWORD creationFlags, DWORD *threadId);
+HANDLE CreateEvent(void *eventAttributes, BOOL manualReset, BOOL initialState, LPCSTR name);
+BOOL SetEvent(HANDLE event);
+BOOL ResetEvent(HANDLE event);
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+
+// synchronization and system information used by TaskPool
+typedef struct {
+	pthread_mutex_t mutex;
+} CRITICAL_SECTION;
+
+typedef struct {
+	DWORD dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+void InitializeCriticalSection(CRITICAL_SECTION *section);
+void DeleteCriticalSection(CRITICAL_SECTION *section);
+void EnterCriticalSection(CRITICAL_SECTION *section);
+void LeaveCriticalSection(CRITICAL_SECTION *section);
+BOOL SwitchToThread();
+void GetSystemInfo(SYSTEM_INFO *systemInfo);
+
+// interlocked operations used by PipelineProcessor, full barriers like Windows
+#define InterlockedExchange(target, value) __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(target, exchange, comparand) __sync_val_compare_and_swap(target, comparand, exchange)
+#endif
+
+//
+// debugger extension API
+//
+
+#define DECLARE_API(s) \
+	void s(HANDLE hCurrentProcess, HANDLE hCurrentThread, ULONG64 dwCurrentPc, ULONG dwProcessor, PCSTR args)
+
+/**
+*	@brief print to stdout
+*	@note %p takes ULONG64 and %ly prints symbol like the debugger
+*/
+void dprintf(const char *format, ...);
+
+BOOL ReadMemory(ULONG64 address, PVOID buffer, ULONG size, PULONG cb);
+ULONG64 GetExpression(PCSTR expression);
+BOOL GetExpressionEx(PCSTR expression, ULONG64 *value, PCSTR *remainder);
+void GetSymbol(ULONG64 offset, PCHAR buffer, PULONG64 displacement);
+ULONG GetFieldData(ULONG64 address, PCSTR type, PCSTR field, ULONG size, PVOID value);
+ULONG GetFieldOffset(PCSTR type, PCSTR field, PULONG offset);
+ULONG GetTypeSize(PCSTR type);
+BOOL IsPtr64();
+void GetTebAddress(PULONG64 address);
+void GetPebAddress(ULONG64 thread, PULONG64 address);
+
+#define GetFieldValue(Addr, Type, Field, OutValue) \
+	GetFieldData(Addr, Type, Field, sizeof(OutValue), (PVOID)&(OutValue))
+
+//
+// offline session
+//
+
+class DumpReader;
+
+/**
+*	@brief use the dump as the target of debugger extension API
+*/
+void AttachDump(DumpReader *dump);
+
+/**
+*	@brief get pointer to target memory in the mapped dump without copy
+*	@retval NULL [address, address + size) is not stored contiguously in the dump
+*/
+const UCHAR *GetTargetPointer(ULONG64 address, ULONG size);
+
+/**
+*	@brief define address of a symbol which is not exported (e.g. ntdll!RtlpLFHKey)
+*/
+void DefineSymbol(const char *name, ULONG64 address);
+
+/**
+*	@brief load type layouts overriding built-in ones
+*	@note each line is "type field offset size" or "type size", numbers in hex
+*/
+bool LoadTypeLayouts(const char *path);
+
+/**
+*	@brief report type layouts not found, as a hint for LoadTypeLayouts
+*	@param enabled [in] false while looking up layouts which may not be used
+*/
+void SetLayoutMessages(bool enabled);
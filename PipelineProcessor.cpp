@@ -0,0 +1,169 @@
+#include "common.h"
+#include "PipelineProcessor.h"
+
+PipelineProcessor::PipelineProcessor(IProcessor *processor)
+: processor_(processor)
+, head_(0)
+, tail_(0)
+, open_(NULL)
+, thread_(NULL)
+, published_(NULL)
+, consumed_(NULL)
+{
+}
+
+PipelineProcessor::~PipelineProcessor()
+{
+	Stop();
+}
+
+BOOL PipelineProcessor::Start()
+{
+	slots_.resize(SLOT_COUNT);
+	published_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+	consumed_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (published_ != NULL && consumed_ != NULL)
+	{
+		thread_ = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	}
+	if (thread_ == NULL)
+	{
+		dprintf("%s: CreateThread failed %d, process entries on this thread\n", __FUNCTION__, GetLastError());
+		Stop();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void PipelineProcessor::Stop()
+{
+	if (thread_ != NULL)
+	{
+		Post(SLOT_STOP, 0);
+		WaitForSingleObject(thread_, INFINITE);
+		CloseHandle(thread_);
+		thread_ = NULL;
+	}
+	if (published_ != NULL)
+	{
+		CloseHandle(published_);
+		published_ = NULL;
+	}
+	if (consumed_ != NULL)
+	{
+		CloseHandle(consumed_);
+		consumed_ = NULL;
+	}
+}
+
+void PipelineProcessor::StartHeap(ULONG64 heapAddress)
+{
+	Post(SLOT_START_HEAP, heapAddress);
+}
+
+void PipelineProcessor::RegisterBatch(const HeapRecord *records, size_t count)
+{
+	while (count != 0)
+	{
+		if (open_ == NULL)
+		{
+			open_ = &Acquire();
+			open_->kind = SLOT_RECORDS_BATCH;
+			open_->count = 0;
+		}
+		size_t length = SLOT_RECORDS - open_->count;
+		if (length > count)
+		{
+			length = count;
+		}
+		memcpy(&open_->records[open_->count], records, length * sizeof(HeapRecord));
+		open_->count += length;
+		records += length;
+		count -= length;
+		if (open_->count == SLOT_RECORDS)
+		{
+			Flush();
+		}
+	}
+}
+
+void PipelineProcessor::FinishHeap(ULONG64 heapAddress)
+{
+	Post(SLOT_FINISH_HEAP, heapAddress);
+}
+
+PipelineProcessor::Slot &PipelineProcessor::Acquire()
+{
+	// the consumer finished reading the slot before moving head_
+	while (Load(tail_) - Load(head_) == SLOT_COUNT)
+	{
+		WaitForSingleObject(consumed_, INFINITE);
+	}
+	return slots_[Load(tail_) % SLOT_COUNT];
+}
+
+void PipelineProcessor::Publish()
+{
+	// the slot is written before moving tail_
+	InterlockedExchange(&tail_, (LONG)(Load(tail_) + 1));
+	SetEvent(published_);
+}
+
+void PipelineProcessor::Flush()
+{
+	if (open_ != NULL)
+	{
+		open_ = NULL;
+		Publish();
+	}
+}
+
+void PipelineProcessor::Post(SlotKind kind, ULONG64 heapAddress)
+{
+	Flush();
+	Slot &slot = Acquire();
+	slot.kind = kind;
+	slot.heapAddress = heapAddress;
+	slot.count = 0;
+	Publish();
+}
+
+void PipelineProcessor::Consume()
+{
+	for (;;)
+	{
+		// the event is set after each Publish, so a slot published after this check is not missed
+		while (Load(head_) == Load(tail_))
+		{
+			WaitForSingleObject(published_, INFINITE);
+		}
+		const Slot &slot = slots_[Load(head_) % SLOT_COUNT];
+		if (slot.kind == SLOT_STOP)
+		{
+			break;
+		}
+		switch (slot.kind)
+		{
+		case SLOT_START_HEAP:
+			processor_->StartHeap(slot.heapAddress);
+			break;
+		case SLOT_RECORDS_BATCH:
+			processor_->RegisterBatch(slot.records, slot.count);
+			break;
+		case SLOT_FINISH_HEAP:
+			processor_->FinishHeap(slot.heapAddress);
+			break;
+		default:
+			break;
+		}
+		InterlockedExchange(&head_, (LONG)(Load(head_) + 1));
+		SetEvent(consumed_);
+	}
+}
+
+DWORD WINAPI PipelineProcessor::ThreadProc(LPVOID parameter)
+{
+	PipelineProcessor *pipeline = (PipelineProcessor *)parameter;
+	pipeline->Consume();
+	return 0;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vector>
+#include "IProcessor.h"
+
+/**
+*	@brief pass heap entries to a processor running on another thread, so reading the target overlaps processing
+*	@note slots of a single producer single consumer ring are handed over without locks,
+*	      events only wake up the side waiting for an empty or a full ring
+*/
+class PipelineProcessor : public IProcessor
+{
+public:
+	/**
+	*	@brief constructor
+	*	@param processor [in] processor called on the consumer thread, not owned
+	*/
+	PipelineProcessor(IProcessor *processor);
+
+	/**
+	*	@brief destructor
+	*	@note waits until the consumer processed all entries
+	*/
+	virtual ~PipelineProcessor();
+
+	/**
+	*	@brief start the consumer thread
+	*	@retval FALSE the thread cannot be created, pass entries to the processor directly
+	*/
+	BOOL Start();
+
+	/**
+	*	@brief wait until the consumer processed all entries, and stop it
+	*/
+	void Stop();
+
+	virtual void StartHeap(ULONG64 heapAddress);
+	virtual void RegisterBatch(const HeapRecord *records, size_t count);
+	virtual void FinishHeap(ULONG64 heapAddress);
+
+private:
+	enum { SLOT_COUNT = 32, SLOT_RECORDS = 256 };
+
+	enum SlotKind
+	{
+		SLOT_START_HEAP,
+		SLOT_RECORDS_BATCH,
+		SLOT_FINISH_HEAP,
+		SLOT_STOP
+	};
+
+	struct Slot
+	{
+		SlotKind kind;
+		ULONG64 heapAddress;
+		size_t count;
+		HeapRecord records[SLOT_RECORDS];
+	};
+
+	IProcessor *processor_;
+
+	std::vector<Slot> slots_;
+
+	/**
+	*	@brief number of slots consumed, written by the consumer only
+	*/
+	volatile LONG head_;
+
+	/**
+	*	@brief number of slots published, written by the producer only
+	*/
+	volatile LONG tail_;
+
+	/**
+	*	@brief slot filled by RegisterBatch and not published yet, NULL if none
+	*/
+	Slot *open_;
+
+	HANDLE thread_;
+
+	/**
+	*	@brief signaled when a slot is published
+	*/
+	HANDLE published_;
+
+	/**
+	*	@brief signaled when a slot is consumed
+	*/
+	HANDLE consumed_;
+
+	/**
+	*	@brief wait for a free slot
+	*/
+	Slot &Acquire();
+
+	/**
+	*	@brief hand over the acquired slot to the consumer
+	*/
+	void Publish();
+
+	/**
+	*	@brief publish the slot filled by RegisterBatch if any
+	*/
+	void Flush();
+
+	/**
+	*	@brief publish a slot without records
+	*/
+	void Post(SlotKind kind, ULONG64 heapAddress);
+
+	/**
+	*	@brief read a counter shared with the other thread
+	*/
+	static ULONG Load(volatile LONG &counter)
+	{
+		return (ULONG)InterlockedCompareExchange(&counter, 0, 0);
+	}
+
+	/**
+	*	@brief pass published slots to the processor until SLOT_STOP
+	*/
+	void Consume();
+
+	static DWORD WINAPI ThreadProc(LPVOID parameter);
+
+	/**
+	*	@brief copy constructor (disabled)
+	*/
+	PipelineProcessor(const PipelineProcessor&);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	PipelineProcessor& operator=(const PipelineProcessor&);
+};
@@ -0,0 +1,92 @@
+#include "common.h"
+#include "RecordSort.h"
+#include <algorithm>
+
+/**
+*	@brief records sorted by std::stable_sort, fewer than a radix pass costs
+*/
+static const size_t SMALL_COUNT = 64;
+
+void SortRecords(std::vector<HeapRecord> &records)
+{
+	const size_t count = records.size();
+	if (count < 2)
+	{
+		return;
+	}
+	if (count <= SMALL_COUNT)
+	{
+		std::stable_sort(records.begin(), records.end());
+	}
+	else
+	{
+		// only bytes in which some address differs from the first one need a pass
+		ULONG64 diff = 0;
+		for (size_t i = 1; i < count; i++)
+		{
+			diff |= records[i].address ^ records[0].address;
+		}
+
+		std::vector<HeapRecord> scratch(count);
+		HeapRecord *from = &records[0];
+		HeapRecord *to = &scratch[0];
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			if (((diff >> shift) & 0xff) == 0)
+			{
+				continue;
+			}
+			size_t offsets[256] = { 0 };
+			for (size_t i = 0; i < count; i++)
+			{
+				offsets[(from[i].address >> shift) & 0xff]++;
+			}
+			size_t offset = 0;
+			for (int digit = 0; digit < 256; digit++)
+			{
+				size_t digitCount = offsets[digit];
+				offsets[digit] = offset;
+				offset += digitCount;
+			}
+			for (size_t i = 0; i < count; i++)
+			{
+				to[offsets[(from[i].address >> shift) & 0xff]++] = from[i];
+			}
+			std::swap(from, to);
+		}
+		if (from != &records[0])
+		{
+			records.swap(scratch);
+		}
+	}
+
+	// the sort is stable, so the first record of an address is the one added first
+	size_t kept = 1;
+	for (size_t i = 1; i < count; i++)
+	{
+		if (records[i].address != records[kept - 1].address)
+		{
+			records[kept++] = records[i];
+		}
+	}
+	records.resize(kept);
+}
+
+size_t LowerBoundRecord(const std::vector<HeapRecord> &records, ULONG64 address)
+{
+	size_t first = 0;
+	size_t last = records.size();
+	while (first < last)
+	{
+		size_t middle = first + (last - first) / 2;
+		if (records[middle].address < address)
+		{
+			first = middle + 1;
+		}
+		else
+		{
+			last = middle;
+		}
+	}
+	return first;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vector>
+#include "IProcessor.h"
+
+/**
+*	@brief sort records by address, and keep only the first record of each address
+*	@note LSD radix sort over the bytes in which addresses differ, stable like inserting them to std::set in order
+*/
+void SortRecords(std::vector<HeapRecord> &records);
+
+/**
+*	@brief index of the first record whose address is not less than address
+*	@param records [in] records sorted by SortRecords
+*/
+size_t LowerBoundRecord(const std::vector<HeapRecord> &records, ULONG64 address);
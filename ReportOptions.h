@@ -0,0 +1,42 @@
+#pragma once
+
+/**
+*	@brief selection and order of records printed by processors
+*	@note given by -n, --min-total, --min-count and --sort
+*/
+struct ReportOptions
+{
+	enum SortKey
+	{
+		SORT_DEFAULT,	///< order of the processor (total for heapstat, count for bysize)
+		SORT_TOTAL,
+		SORT_COUNT,
+		SORT_MAX,
+		SORT_AVERAGE
+	};
+
+	/**
+	*	@brief maximum number of printed records, 0 for all
+	*/
+	ULONG64 top;
+
+	/**
+	*	@brief records with smaller total size are not printed
+	*/
+	ULONG64 minTotal;
+
+	/**
+	*	@brief records with smaller count are not printed
+	*/
+	ULONG64 minCount;
+
+	SortKey sortKey;
+
+	ReportOptions()
+	: top(0)
+	, minTotal(0)
+	, minCount(0)
+	, sortKey(SORT_DEFAULT)
+	{
+	}
+};
@@ -1,53 +1,53 @@
+#include <algorithm>
 #include <list>
 #include "common.h"
 #include "SummaryProcessor.h"
 
-SummaryProcessor::SummaryProcessor()
-: isTarget64_(IsTarget64())
-, ntGlobalFlag_(GetNtGlobalFlag())
+SummaryProcessor::SummaryProcessor(TargetContext &context)
+: context_(context)
+, isTarget64_(context.IsTarget64())
 {
 }
 
-void SummaryProcessor::Register(ULONG64 ustAddress,
-		ULONG64 size, ULONG64 address,
-		ULONG64 userSize, ULONG64 userAddress)
+void SummaryProcessor::RegisterBatch(const HeapRecord *records, size_t count)
 {
-	UNREFERENCED_PARAMETER(userAddress);
-	UNREFERENCED_PARAMETER(userSize);
-
-	std::map<ULONG64, UstRecord>::iterator itr = records_.find(ustAddress);
-	if (itr == records_.end())
+	for (const HeapRecord *itr = records; itr != records + count; ++itr)
 	{
-		UstRecord record;
-		record.ustAddress = ustAddress;
-		record.count = 1;
-		record.totalSize = record.maxSize = size;
-		record.largestEntry = address;
-		records_[ustAddress] = record;
-	}
-	else
-	{
-		UstRecord &record = itr->second;
-		record.count++;
-		record.totalSize += size;
-		if (record.maxSize < size)
+		std::map<ULONG64, UstRecord>::iterator found = records_.find(itr->ustAddress);
+		if (found == records_.end())
 		{
-			record.maxSize = size;
-			record.largestEntry = address;
+			UstRecord record;
+			record.ustAddress = itr->ustAddress;
+			record.count = 1;
+			record.totalSize = record.maxSize = itr->size;
+			record.largestEntry = itr->address;
+			records_.insert(found, std::make_pair(itr->ustAddress, record));
+		}
+		else
+		{
+			UstRecord &record = found->second;
+			record.count++;
+			record.totalSize += itr->size;
+			if (record.maxSize < itr->size)
+			{
+				record.maxSize = itr->size;
+				record.largestEntry = itr->address;
+			}
 		}
 	}
 }
 
-void SummaryProcessor::Print()
+void SummaryProcessor::Print(const ReportOptions &options)
 {
 	ULONG64 totalSize = 0;
-	std::vector<ModuleInfo> loadedModules = GetLoadedModules();
-	std::set<UstRecord> sorted;
-	std::map<ULONG64, ULONG64> byCaller;
+	const std::vector<ModuleInfo> &loadedModules = context_.GetLoadedModules();
+	const ModuleIndex &moduleIndex = context_.GetModuleIndex();
+	std::vector<UstRecord> records;
+	std::map<int, ULONG64> byCaller;
 	for (std::map<ULONG64, UstRecord>::iterator itr_ = records_.begin(); itr_ != records_.end(); ++itr_)
 	{
 		// allocation statistics by caller
-		ULONG64 module = GetCallerModule(itr_->first, loadedModules);
+		int module = GetCallerModule(itr_->first, moduleIndex);
 		if (byCaller.find(module) == byCaller.end())
 		{
 			byCaller[module] = itr_->second.totalSize;
@@ -57,15 +57,15 @@ void SummaryProcessor::Print()
 			byCaller[module] += itr_->second.totalSize;
 		}
 
-		sorted.insert(itr_->second);
+		records.push_back(itr_->second);
 		totalSize += itr_->second.totalSize;
 	}
 
 	dprintf("total size per caller:\n");
-	std::list<std::pair<ULONG64, ULONG64>> sortedCaller;
-	for (std::map<ULONG64, ULONG64>::iterator itr_ = byCaller.begin(); itr_ != byCaller.end(); itr_++)
+	std::list<std::pair<int, ULONG64>> sortedCaller;
+	for (std::map<int, ULONG64>::iterator itr_ = byCaller.begin(); itr_ != byCaller.end(); itr_++)
 	{
-		std::list<std::pair<ULONG64, ULONG64>>::iterator itr = sortedCaller.begin();
+		std::list<std::pair<int, ULONG64>>::iterator itr = sortedCaller.begin();
 		while (itr != sortedCaller.end())
 		{
 			if (itr->second <  itr_->second)
@@ -74,51 +74,115 @@ void SummaryProcessor::Print()
 			}
 			++itr;
 		}
-		sortedCaller.insert(itr, std::pair<ULONG64, ULONG64>(itr_->first, itr_->second));
+		sortedCaller.insert(itr, std::pair<int, ULONG64>(itr_->first, itr_->second));
 	}
-	for (std::list<std::pair<ULONG64, ULONG64>>::iterator itr = sortedCaller.begin();
+	for (std::list<std::pair<int, ULONG64>>::iterator itr = sortedCaller.begin();
 		itr != sortedCaller.end(); itr++)
 	{
-		if (itr->first == NULL)
+		if (itr->first < 0)
 		{
 			dprintf("%p <unknown>\n", itr->second);
 		}
 		else
 		{
-			for (std::vector<ModuleInfo>::iterator itr_ = loadedModules.begin(); itr_ != loadedModules.end(); itr_++)
-			{
-				if (itr->first == itr_->DllBase)
-				{
-					dprintf("%p %s\n", itr->second, itr_->FullDllName);
-				}
-			}
+			dprintf("%p %s\n", itr->second, loadedModules[itr->first].FullDllName);
 		}
 	}
 	dprintf("\n");
 
 	dprintf("total size: %p\n", totalSize);
-	PrintUstRecords(sorted);
+	PrintUstRecords(records, options);
 }
 
-void SummaryProcessor::Print(const char *key)
+void SummaryProcessor::Print(FrameFilter &filter, const ReportOptions &options)
 {
 	ULONG64 totalSize = 0;
-	std::set<UstRecord> sorted;
+	std::vector<UstRecord> records;
+	TraceStore &traces = context_.GetTraceStore();
 	for (std::map<ULONG64, UstRecord>::iterator itr_ = records_.begin(); itr_ != records_.end(); ++itr_)
 	{
-		if (itr_->second.ustAddress == NULL || !HasMatchedFrame(itr_->second.ustAddress, key))
+		if (itr_->second.ustAddress == 0)
+		{
+			continue;
+		}
+		const ULONG64 *frames;
+		ULONG depth = traces.Get(itr_->second.ustAddress, frames);
+		if (!filter.Matches(frames, depth))
 		{
 			continue;
 		}
-		sorted.insert(itr_->second);
+		records.push_back(itr_->second);
 		totalSize += itr_->second.totalSize;
 	}
 	dprintf("total size: %p\n", totalSize);
-	PrintUstRecords(sorted);
+	PrintUstRecords(records, options);
 }
 
-void SummaryProcessor::PrintUstRecords(std::set<UstRecord>& records)
+/**
+*	@brief order of UstRecords, larger first
+*/
+class UstRecordOrder
 {
+public:
+	UstRecordOrder(ReportOptions::SortKey sortKey) : sortKey_(sortKey) {}
+
+	template <typename T>
+	bool operator()(const T &lhs, const T &rhs) const
+	{
+		ULONG64 left = GetKey(lhs);
+		ULONG64 right = GetKey(rhs);
+		if (left != right)
+		{
+			return left > right;
+		}
+		return lhs.ustAddress < rhs.ustAddress;
+	}
+
+private:
+	const ReportOptions::SortKey sortKey_;
+
+	template <typename T>
+	ULONG64 GetKey(const T &record) const
+	{
+		switch (sortKey_)
+		{
+		case ReportOptions::SORT_COUNT:
+			return record.count;
+		case ReportOptions::SORT_MAX:
+			return record.maxSize;
+		case ReportOptions::SORT_AVERAGE:
+			return record.count != 0 ? record.totalSize / record.count : 0;
+		default:
+			return record.totalSize;
+		}
+	}
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	UstRecordOrder& operator=(const UstRecordOrder&);
+};
+
+void SummaryProcessor::PrintUstRecords(std::vector<UstRecord> &records, const ReportOptions &options)
+{
+	// drop records under thresholds, then sort only the printed ones
+	std::vector<UstRecord>::iterator last = records.begin();
+	for (std::vector<UstRecord>::iterator itr = records.begin(); itr != records.end(); ++itr)
+	{
+		if (itr->totalSize >= options.minTotal && itr->count >= options.minCount)
+		{
+			*last++ = *itr;
+		}
+	}
+	records.erase(last, records.end());
+	std::vector<UstRecord>::iterator end = records.end();
+	if (options.top != 0 && options.top < records.size())
+	{
+		end = records.begin() + (size_t)options.top;
+	}
+	std::partial_sort(records.begin(), end, records.end(), UstRecordOrder(options.sortKey));
+
 	if (IsPtr64())
 	{
 		dprintf("----------------------------------------------------------------------------------------\n");
@@ -131,7 +195,7 @@ void SummaryProcessor::PrintUstRecords(std::set<UstRecord>& records)
 		dprintf("     ust,    count,    total,      max,    entry\n");
 		dprintf("------------------------------------------------\n");
 	}
-	for (std::set<UstRecord>::reverse_iterator itr = records.rbegin(); itr != records.rend(); ++itr)
+	for (std::vector<UstRecord>::iterator itr = records.begin(); itr != end; ++itr)
 	{
 		dprintf("%p, %p, %p, %p, %p\n",
 			itr->ustAddress,
@@ -141,69 +205,30 @@ void SummaryProcessor::PrintUstRecords(std::set<UstRecord>& records)
 			itr->largestEntry);
 		PrintStackTrace(itr->ustAddress);
 	}
+	if (end != records.end())
+	{
+		dprintf("%d more records\n", (ULONG)(records.end() - end));
+	}
 	dprintf("\n");
 }
 
-ULONG64 SummaryProcessor::GetCallerModule(ULONG64 ustAddress, std::vector<ModuleInfo> &loadedModules)
+int SummaryProcessor::GetCallerModule(ULONG64 ustAddress, const ModuleIndex &moduleIndex)
 {
-	if (ustAddress == NULL)
-	{
-		return NULL;
-	}
-	std::vector<ULONG64> stackTrace = GetStackTrace(ustAddress, isTarget64_, ntGlobalFlag_);
-	for (std::vector<ULONG64>::iterator itr = stackTrace.begin(); itr != stackTrace.end(); itr++)
+	if (ustAddress == 0)
 	{
-		static CHAR buffer[256];
-		ULONG64 displacement;
-		GetSymbol(*itr, buffer, &displacement);
-		CHAR *ch = strchr(buffer, '!');
-		if (ch != NULL)
-		{
-			*ch = '\0';
-		}
-		const CHAR *ntdll = "ntdll";
-		const CHAR *ntdll_ = "ntdll_";
-		if (strcmp(buffer, ntdll) == 0 ||
-			strncmp(buffer, ntdll_, strlen(ntdll_)) == 0)
-		{
-			continue;
-		}
-		const CHAR *msvcrPrefix = "msvcr";
-		if (strncmp(buffer, msvcrPrefix, strlen(msvcrPrefix)) == 0)
-		{
-			continue;
-		}
-		const CHAR *verifier = "verifier";
-		if (strcmp(buffer, verifier) == 0)
-		{
-			continue;
-		}
-		for (std::vector<ModuleInfo>::iterator itr_ = loadedModules.begin(); itr_ != loadedModules.end(); itr_++)
-		{
-			if (itr_->DllBase <= *itr && *itr < itr_->DllBase + itr_->SizeOfImage)
-			{
-				return itr_->DllBase;
-			}
-		}
-		return NULL;
+		return -1;
 	}
-	return NULL;
-}
-
-BOOL SummaryProcessor::HasMatchedFrame(ULONG64 ustAddress, const char *key)
-{
-	std::vector<ULONG64> stackTrace = GetStackTrace(ustAddress, isTarget64_, ntGlobalFlag_);
-	for (std::vector<ULONG64>::iterator itr = stackTrace.begin(); itr != stackTrace.end(); itr++)
+	const ULONG64 *frames;
+	ULONG depth = context_.GetTraceStore().Get(ustAddress, frames);
+	for (const ULONG64 *itr = frames; itr != frames + depth; itr++)
 	{
-		static CHAR buffer[256];
-		ULONG64 displacement;
-		GetSymbol(*itr, buffer, &displacement);
-		if (strncmp(buffer, key, strlen(key)) == 0)
+		int module = moduleIndex.Find(*itr);
+		if (!moduleIndex.IsSkipped(module))
 		{
-			return TRUE;
+			return module;
 		}
 	}
-	return FALSE;
+	return -1;
 }
 
 void SummaryProcessor::PrintStackTrace(ULONG64 ustAddress)
@@ -213,10 +238,25 @@ void SummaryProcessor::PrintStackTrace(ULONG64 ustAddress)
 		return;
 	}
 	PCSTR indent = "\t";
-	std::vector<ULONG64> trace = GetStackTrace(ustAddress, isTarget64_, ntGlobalFlag_);
-	dprintf("%sust at %p depth: %d\n", indent, ustAddress, trace.size());
-	for (std::vector<ULONG64>::iterator itr = trace.begin(); itr != trace.end(); itr++)
+	const ULONG64 *frames;
+	ULONG depth = context_.GetTraceStore().Get(ustAddress, frames);
+	dprintf("%sust at %p depth: %d\n", indent, ustAddress, depth);
+	const ModuleIndex &moduleIndex = context_.GetModuleIndex();
+	std::string text;
+	for (const ULONG64 *itr = frames; itr != frames + depth; itr++)
 	{
-		dprintf("%s%ly\n", indent, *itr);
+		// symbols of the debugger target may not be of the process saved in the snapshot
+		if (!context_.IsRestored())
+		{
+			dprintf("%s%ly\n", indent, *itr);
+		}
+		else if (moduleIndex.FormatFrame(*itr, text))
+		{
+			dprintf("%s%s\n", indent, text.c_str());
+		}
+		else
+		{
+			dprintf("%s%p\n", indent, *itr);
+		}
 	}
 }
@@ -1,36 +1,35 @@
 #pragma once
 
 #include <map>
-#include <set>
 #include <vector>
 #include "IProcessor.h"
 #include "Utility.h"
+#include "TargetContext.h"
+#include "FrameFilter.h"
+#include "ReportOptions.h"
 
 class SummaryProcessor : public IProcessor
 {
-private:
-	/**
-	*	@brief target is x64 or not
-	*/
-	const bool isTarget64_;
-
-	/**
-	*	@brief gflag
-	*/
-	const ULONG32 ntGlobalFlag_;
-
+public:
 	struct UstRecord {
 		ULONG64 ustAddress;
 		ULONG64 count;
 		ULONG64 totalSize;
 		ULONG64 maxSize;
 		ULONG64 largestEntry;
-		bool operator< (const SummaryProcessor::UstRecord& rhs) const
-		{
-			return totalSize < rhs.totalSize;
-		}
 	};
 
+private:
+	/**
+	*	@brief target information
+	*/
+	TargetContext &context_;
+
+	/**
+	*	@brief target is x64 or not
+	*/
+	const bool isTarget64_;
+
 	/**
 	*	@brief ustAddress to UstRecord map
 	*/
@@ -43,20 +42,16 @@ private:
 	SummaryProcessor& operator=(const SummaryProcessor&);
 
 	/**
-	*	@brief print set of UstRecord
+	*	@brief print UstRecords selected by options
+	*	@note records are reordered, stack traces are decoded only for printed records
 	*/
-	void PrintUstRecords(std::set<UstRecord>& records);
+	void PrintUstRecords(std::vector<UstRecord> &records, const ReportOptions &options);
 
 	/**
-	*	@brief get caller module base address
+	*	@brief get caller module, the first frame not in skipped modules
+	*	@return module id in moduleIndex, -1 if unknown
 	*/
-	ULONG64 GetCallerModule(ULONG64 ustAddress, std::vector<ModuleInfo> &loadedModules);
-
-	/**
-	*	@brief test ust has matched frame
-	*	@param key [in] prefix search key
-	*/
-	BOOL HasMatchedFrame(ULONG64 ustAddress, const char *key);
+	int GetCallerModule(ULONG64 ustAddress, const ModuleIndex &moduleIndex);
 
 	/**
 	*	@brief print stack trace
@@ -67,8 +62,9 @@ private:
 public:
 	/**
 	*	@brief constructor
+	*	@param context [in] target information
 	*/
-	SummaryProcessor();
+	SummaryProcessor(TargetContext &context);
 
 	/**
 	*	@copydoc IProcessor::StartHeap()
@@ -76,11 +72,9 @@ public:
 	void StartHeap(ULONG64 /*heapAddress*/) {}
 
 	/**
-	*	@copydoc IProcessor::Register()
+	*	@copydoc IProcessor::RegisterBatch()
 	*/
-	void Register(ULONG64 ustAddress,
-		ULONG64 size, ULONG64 address,
-		ULONG64 userSize, ULONG64 userAddress);
+	void RegisterBatch(const HeapRecord *records, size_t count);
 
 	/**
 	*	@copydoc IProcessor::FinishHeap()
@@ -89,12 +83,19 @@ public:
 
 	/**
 	*	@brief print summary of heap usage
+	*	@param options [in] selection and order of printed records
 	*/
-	void Print();
+	void Print(const ReportOptions &options);
 
 	/**
 	*	@brief print summary of matched heap usage
-	*	@param key [in] prefix search key
+	*	@param filter [in] include and exclude keys
+	*	@param options [in] selection and order of printed records
+	*/
+	void Print(FrameFilter &filter, const ReportOptions &options);
+
+	/**
+	*	@brief aggregated records, ustAddress to UstRecord
 	*/
-	void Print(const char *key);
+	const std::map<ULONG64, UstRecord> &GetRecords() const { return records_; }
 };
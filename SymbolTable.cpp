@@ -0,0 +1,34 @@
+#include "common.h"
+#include "SymbolTable.h"
+
+SymbolTable::SymbolTable()
+{
+}
+
+const char *SymbolTable::GetName(ULONG64 address)
+{
+	return Resolve(address);
+}
+
+const char *SymbolTable::Resolve(ULONG64 address)
+{
+	std::map<ULONG64, const char *>::iterator itr = symbols_.find(address);
+	if (itr != symbols_.end())
+	{
+		return itr->second;
+	}
+
+	CHAR buffer[256];
+	ULONG64 displacement;
+	buffer[0] = '\0';
+	GetSymbol(address, buffer, &displacement);
+	buffer[sizeof(buffer) - 1] = '\0';
+	const char *name = Intern(buffer);
+	symbols_[address] = name;
+	return name;
+}
+
+const char *SymbolTable::Intern(const std::string &value)
+{
+	return pool_.insert(value).first->c_str();
+}
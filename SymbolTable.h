@@ -0,0 +1,51 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+
+/**
+*	@brief symbols of return addresses resolved once and interned
+*	@note the same return addresses appear in many stack traces
+*/
+class SymbolTable
+{
+public:
+	/**
+	*	@brief constructor
+	*/
+	SymbolTable();
+
+	/**
+	*	@brief symbol of the address, "module!function"
+	*	@return interned string, valid as long as the table
+	*/
+	const char *GetName(ULONG64 address);
+
+private:
+	/**
+	*	@brief address to interned symbol
+	*/
+	std::map<ULONG64, const char *> symbols_;
+
+	/**
+	*	@brief interned symbols
+	*/
+	std::set<std::string> pool_;
+
+	/**
+	*	@brief resolve the address on first use
+	*/
+	const char *Resolve(ULONG64 address);
+
+	/**
+	*	@brief get the pooled copy of the string
+	*/
+	const char *Intern(const std::string &value);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	SymbolTable& operator=(const SymbolTable&);
+};
@@ -0,0 +1,298 @@
+#include "common.h"
+#include "TargetContext.h"
+
+#ifndef HEAPSTAT_OFFLINE
+#include <dbgeng.h>
+#endif
+
+/**
+*	@brief snapshot returned by TargetContext::Get, NULL if not resolved yet
+*/
+static TargetContext *current = NULL;
+
+/**
+*	@brief upper bound of PEB::NumberOfHeaps read from the target
+*/
+static const ULONG32 MAX_HEAPS = 0x1000;
+
+#ifndef HEAPSTAT_OFFLINE
+/**
+*	@brief debugger state current was resolved in
+*	@note polled by Get, as event callbacks could not be unregistered before the extension is unloaded
+*/
+struct TargetState
+{
+	ULONG processId;
+	ULONG executionStatus;
+
+	/**
+	*	@brief instruction pointer of the current thread, changed when the target ran
+	*/
+	ULONG64 instructionOffset;
+
+	/**
+	*	@brief symbol type of ntdll, changed by .reload
+	*/
+	ULONG symbolType;
+
+	bool operator==(const TargetState &rhs) const
+	{
+		return processId == rhs.processId &&
+			executionStatus == rhs.executionStatus &&
+			instructionOffset == rhs.instructionOffset &&
+			symbolType == rhs.symbolType;
+	}
+};
+
+static TargetState currentState;
+
+/**
+*	@brief get the current debugger state
+*	@retval FALSE the state is not available, the snapshot is not reused
+*/
+static BOOL GetTargetState(TargetState &state)
+{
+	IDebugClient *client = NULL;
+	if (FAILED(CreateDebugInterface(__uuidof(IDebugClient), (PVOID *)&client)))
+	{
+		return FALSE;
+	}
+	IDebugSystemObjects *system = NULL;
+	IDebugControl *control = NULL;
+	IDebugRegisters *registers = NULL;
+	IDebugSymbols *symbols = NULL;
+	BOOL result =
+		SUCCEEDED(client->QueryInterface(__uuidof(IDebugSystemObjects), (PVOID *)&system)) &&
+		SUCCEEDED(client->QueryInterface(__uuidof(IDebugControl), (PVOID *)&control)) &&
+		SUCCEEDED(client->QueryInterface(__uuidof(IDebugRegisters), (PVOID *)&registers)) &&
+		SUCCEEDED(client->QueryInterface(__uuidof(IDebugSymbols), (PVOID *)&symbols)) &&
+		SUCCEEDED(system->GetCurrentProcessSystemId(&state.processId)) &&
+		SUCCEEDED(control->GetExecutionStatus(&state.executionStatus)) &&
+		SUCCEEDED(registers->GetInstructionOffset(&state.instructionOffset));
+	if (result)
+	{
+		// ntdll may not be loaded yet at the initial breakpoint
+		ULONG64 base;
+		DEBUG_MODULE_PARAMETERS params;
+		state.symbolType = DEBUG_SYMTYPE_NONE;
+		if (SUCCEEDED(symbols->GetModuleByModuleName("ntdll", 0, NULL, &base)) &&
+			SUCCEEDED(symbols->GetModuleParameters(1, &base, 0, &params)))
+		{
+			state.symbolType = params.SymbolType;
+		}
+	}
+	if (symbols != NULL)
+	{
+		symbols->Release();
+	}
+	if (registers != NULL)
+	{
+		registers->Release();
+	}
+	if (control != NULL)
+	{
+		control->Release();
+	}
+	if (system != NULL)
+	{
+		system->Release();
+	}
+	client->Release();
+	return result;
+}
+#endif
+
+TargetContext &TargetContext::Get()
+{
+#ifndef HEAPSTAT_OFFLINE
+	// resolved again when the target ran, the current process changed or symbols were reloaded
+	TargetState state = { 0, 0, 0, 0 };
+	BOOL known = GetTargetState(state);
+	if (current != NULL && !(known && state == currentState))
+	{
+		delete current;
+		current = NULL;
+	}
+	currentState = state;
+#endif
+	if (current == NULL)
+	{
+		current = new TargetContext();
+	}
+	return *current;
+}
+
+TargetContext::TargetContext()
+: layout_("ntdll")
+, restored_(false)
+, isTarget64_(::IsTarget64())
+, pebAddress_(::GetPebAddress())
+, ntGlobalFlag_(::GetNtGlobalFlag(layout_))
+, osVersion_(::GetOSVersion(layout_))
+, traces_(isTarget64_, ntGlobalFlag_)
+, modulesResolved_(false)
+, moduleIndex_(NULL)
+, heapsResolved_(false)
+, lfhKeyResolved_(false)
+, lfhKey_(0)
+{
+}
+
+TargetContext *TargetContext::Restore(bool isTarget64, ULONG32 ntGlobalFlag, ULONG64 osVersion,
+	const std::vector<ModuleInfo> &modules, const std::vector<ULONG64> &heaps)
+{
+	return new TargetContext(isTarget64, ntGlobalFlag, osVersion, modules, heaps);
+}
+
+TargetContext::TargetContext(bool isTarget64, ULONG32 ntGlobalFlag, ULONG64 osVersion,
+	const std::vector<ModuleInfo> &modules, const std::vector<ULONG64> &heaps)
+: layout_("ntdll")
+, restored_(true)
+, isTarget64_(isTarget64)
+, pebAddress_(0)
+, ntGlobalFlag_(ntGlobalFlag)
+, osVersion_(osVersion)
+, traces_(isTarget64_, ntGlobalFlag_)
+, modulesResolved_(true)
+, modules_(modules)
+, ntdllName_("ntdll")
+, moduleIndex_(NULL)
+, heapsResolved_(true)
+, heaps_(heaps)
+, lfhKeyResolved_(false)
+, lfhKey_(0)
+{
+}
+
+TargetContext::~TargetContext()
+{
+	delete moduleIndex_;
+}
+
+const std::vector<ModuleInfo> &TargetContext::GetLoadedModules()
+{
+	if (!modulesResolved_)
+	{
+		modules_ = ::GetLoadedModules(layout_);
+		ntdllName_ = ::GetNtDllName(modules_);
+		modulesResolved_ = true;
+	}
+	return modules_;
+}
+
+const ModuleIndex &TargetContext::GetModuleIndex()
+{
+	const std::string &skipModules = GetSettings().skipModules;
+	if (moduleIndex_ == NULL || moduleIndex_->GetSkipModules() != skipModules)
+	{
+		delete moduleIndex_;
+		moduleIndex_ = new ModuleIndex(GetLoadedModules(), skipModules);
+	}
+	return *moduleIndex_;
+}
+
+const std::string &TargetContext::GetNtDllName()
+{
+	if (!modulesResolved_)
+	{
+		if (isTarget64_ || !IsPtr64())
+		{
+			// no need to walk modules
+			static const std::vector<ModuleInfo> none;
+			ntdllName_ = ::GetNtDllName(none);
+			return ntdllName_;
+		}
+		GetLoadedModules();
+	}
+	return ntdllName_;
+}
+
+const std::vector<ULONG64> &TargetContext::GetProcessHeaps()
+{
+	if (heapsResolved_)
+	{
+		return heaps_;
+	}
+	heapsResolved_ = true;
+
+	ULONG cb;
+	ULONG32 numberOfHeaps;
+	ULONG64 processHeaps;
+	if (isTarget64_)
+	{
+		if (!layout_.ReadField(pebAddress_, TypeLayout::PEB_NumberOfHeaps, numberOfHeaps))
+		{
+			dprintf("read NumberOfHeaps failed\n");
+			return heaps_;
+		}
+		if (!layout_.ReadField(pebAddress_, TypeLayout::PEB_ProcessHeaps, processHeaps))
+		{
+			dprintf("read ProcessHeaps failed\n");
+			return heaps_;
+		}
+	}
+	else
+	{
+		if (!READMEMORY(pebAddress_ + 0x88, numberOfHeaps))
+		{
+			dprintf("read NumberOfHeaps failed\n");
+			return heaps_;
+		}
+		ULONG32 value;
+		if (!READMEMORY(pebAddress_ + 0x90, value))
+		{
+			dprintf("read ProcessHeaps failed\n");
+			return heaps_;
+		}
+		processHeaps = value;
+	}
+	if (numberOfHeaps == 0)
+	{
+		return heaps_;
+	}
+	if (numberOfHeaps > MAX_HEAPS)
+	{
+		dprintf("invalid NumberOfHeaps: %d\n", numberOfHeaps);
+		return heaps_;
+	}
+
+	// read the array at once
+	const size_t pointerSize = isTarget64_ ? 8 : 4;
+	std::vector<UCHAR> buffer((size_t)numberOfHeaps * pointerSize);
+	if (!ReadTargetMemory(processHeaps, &buffer[0], (ULONG)buffer.size(), &cb) || cb != buffer.size())
+	{
+		dprintf("read heap address failed\n");
+		return heaps_;
+	}
+	for (ULONG32 i = 0; i < numberOfHeaps; i++)
+	{
+		ULONG64 heap = 0;
+		memcpy(&heap, &buffer[i * pointerSize], pointerSize);
+		heaps_.push_back(heap);
+	}
+	return heaps_;
+}
+
+BOOL TargetContext::GetLFHKey(ULONG32 &key)
+{
+	// failures are not kept, symbols may be fixed before the next command
+	if (!lfhKeyResolved_)
+	{
+		ULONG64 pLFHKey;
+		ULONG cb;
+		if (!GetExpressionEx((GetNtDllName() + "!RtlpLFHKey").c_str(), &pLFHKey, NULL))
+		{
+			dprintf("get %s!RtlpLFHKey failed\n", GetNtDllName().c_str());
+		}
+		else if (!READMEMORY(pLFHKey, lfhKey_))
+		{
+			dprintf("read LFHKey failed\n");
+		}
+		else
+		{
+			lfhKeyResolved_ = true;
+		}
+	}
+	key = lfhKey_;
+	return lfhKeyResolved_;
+}
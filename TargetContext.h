@@ -0,0 +1,146 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Utility.h"
+#include "TypeLayout.h"
+#include "TraceStore.h"
+#include "SymbolTable.h"
+#include "ModuleIndex.h"
+
+/**
+*	@brief snapshot of target information shared by commands and processors
+*	@note resolved once and discarded when the target runs, the current process changes or symbols are reloaded
+*/
+class TargetContext
+{
+public:
+	/**
+	*	@brief get the snapshot of the current target, resolve it if not yet
+	*	@note the previous snapshot is deleted here if the target changed, references to it must not be kept
+	*	      across commands
+	*/
+	static TargetContext &Get();
+
+	/**
+	*	@brief create a context restored from a saved heap snapshot
+	*	@note the target is not read, the caller owns the returned context
+	*	      and fills its TraceStore by TraceStore::Insert
+	*/
+	static TargetContext *Restore(bool isTarget64, ULONG32 ntGlobalFlag, ULONG64 osVersion,
+		const std::vector<ModuleInfo> &modules, const std::vector<ULONG64> &heaps);
+
+	/**
+	*	@brief destructor
+	*/
+	~TargetContext();
+
+	/**
+	*	@brief restored from a saved heap snapshot, the debugger target may be another process
+	*/
+	bool IsRestored() const { return restored_; }
+
+	/**
+	*	@brief target process is 64 bit or not
+	*/
+	bool IsTarget64() const { return isTarget64_; }
+
+	/**
+	*	@brief PEB address (PEB32 for WOW64)
+	*/
+	ULONG64 GetPebAddress() const { return pebAddress_; }
+
+	/**
+	*	@brief NtGlobalFlag in PEB
+	*/
+	ULONG32 GetNtGlobalFlag() const { return ntGlobalFlag_; }
+
+	/**
+	*	@brief ((OSMajorVersion << 32) | OSMinorVersion)
+	*/
+	ULONG64 GetOSVersion() const { return osVersion_; }
+
+	/**
+	*	@brief ntdll module name, "ntdll" or "ntdll_<base>" for WOW64
+	*/
+	const std::string &GetNtDllName();
+
+	/**
+	*	@brief modules in PEB::InMemoryOrderModuleList
+	*/
+	const std::vector<ModuleInfo> &GetLoadedModules();
+
+	/**
+	*	@brief loaded modules sorted by address
+	*	@note rebuilt when the skip list in Settings is changed
+	*/
+	const ModuleIndex &GetModuleIndex();
+
+	/**
+	*	@brief heap addresses in PEB::ProcessHeaps
+	*/
+	const std::vector<ULONG64> &GetProcessHeaps();
+
+	/**
+	*	@brief value of ntdll!RtlpLFHKey
+	*	@retval FALSE the symbol is not resolved or not readable, tried again on the next call
+	*	@note not thread safe until resolved
+	*/
+	BOOL GetLFHKey(ULONG32 &key);
+
+	/**
+	*	@brief layouts of ntdll types
+	*/
+	TypeLayout &GetLayout() { return layout_; }
+
+	/**
+	*	@brief stack traces in user mode stack trace database
+	*/
+	TraceStore &GetTraceStore() { return traces_; }
+
+	/**
+	*	@brief symbols of frames in stack traces
+	*/
+	SymbolTable &GetSymbolTable() { return symbols_; }
+
+private:
+	TargetContext();
+	TargetContext(bool isTarget64, ULONG32 ntGlobalFlag, ULONG64 osVersion,
+		const std::vector<ModuleInfo> &modules, const std::vector<ULONG64> &heaps);
+
+	/**
+	*	@brief layouts of the ntdll module, dropped with the context when symbols are reloaded
+	*	@note initialized first, members below are read through it
+	*/
+	TypeLayout layout_;
+
+	bool restored_;
+	bool isTarget64_;
+	ULONG64 pebAddress_;
+	ULONG32 ntGlobalFlag_;
+	ULONG64 osVersion_;
+	TraceStore traces_;
+	SymbolTable symbols_;
+
+	bool modulesResolved_;
+	std::vector<ModuleInfo> modules_;
+	std::string ntdllName_;
+	ModuleIndex *moduleIndex_;
+
+	bool heapsResolved_;
+	std::vector<ULONG64> heaps_;
+
+	bool lfhKeyResolved_;
+	ULONG32 lfhKey_;
+
+	/**
+	*	@brief copy constructor (disabled)
+	*/
+	TargetContext(const TargetContext&);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	TargetContext& operator=(const TargetContext&);
+};
@@ -0,0 +1,169 @@
+#include "common.h"
+#include "TaskPool.h"
+
+TaskPool::TaskPool(ULONG threads)
+: pending_(0)
+, next_(0)
+{
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+	InitializeCriticalSection(&lock_);
+	wake_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+	for (ULONG i = 0; i < threads; i++)
+	{
+		Worker *worker = new Worker();
+		worker->pool = this;
+		worker->index = i;
+		InitializeCriticalSection(&worker->lock);
+		workers_.push_back(worker);
+	}
+}
+
+TaskPool::~TaskPool()
+{
+	for (std::vector<Worker *>::iterator itr = workers_.begin(); itr != workers_.end(); ++itr)
+	{
+		// tasks left when Run was not called
+		for (std::deque<ITask *>::iterator task = (*itr)->tasks.begin(); task != (*itr)->tasks.end(); ++task)
+		{
+			delete *task;
+		}
+		DeleteCriticalSection(&(*itr)->lock);
+		delete *itr;
+	}
+	if (wake_ != NULL)
+	{
+		CloseHandle(wake_);
+	}
+	DeleteCriticalSection(&lock_);
+}
+
+void TaskPool::Spawn(ITask *task)
+{
+	Spawn(task, next_);
+	next_ = (next_ + 1) % workers_.size();
+}
+
+void TaskPool::Spawn(ITask *task, ULONG worker)
+{
+	EnterCriticalSection(&lock_);
+	pending_++;
+	LeaveCriticalSection(&lock_);
+
+	Worker *target = workers_[worker];
+	EnterCriticalSection(&target->lock);
+	target->tasks.push_back(task);
+	LeaveCriticalSection(&target->lock);
+
+	if (wake_ != NULL)
+	{
+		SetEvent(wake_);
+	}
+}
+
+void TaskPool::Run()
+{
+	std::vector<HANDLE> threads;
+	for (ULONG i = 1; i < workers_.size(); i++)
+	{
+		HANDLE thread = CreateThread(NULL, 0, ThreadProc, workers_[i], 0, NULL);
+		if (thread == NULL)
+		{
+			// tasks of the worker are stolen by others
+			dprintf("%s: CreateThread failed %d\n", __FUNCTION__, GetLastError());
+			continue;
+		}
+		threads.push_back(thread);
+	}
+	Work(0);
+	for (std::vector<HANDLE>::iterator itr = threads.begin(); itr != threads.end(); ++itr)
+	{
+		WaitForSingleObject(*itr, INFINITE);
+		CloseHandle(*itr);
+	}
+}
+
+ITask *TaskPool::Take(ULONG worker)
+{
+	ITask *task = NULL;
+	Worker *own = workers_[worker];
+	EnterCriticalSection(&own->lock);
+	if (!own->tasks.empty())
+	{
+		task = own->tasks.front();
+		own->tasks.pop_front();
+	}
+	LeaveCriticalSection(&own->lock);
+
+	for (ULONG i = 1; task == NULL && i < workers_.size(); i++)
+	{
+		Worker *victim = workers_[(worker + i) % workers_.size()];
+		EnterCriticalSection(&victim->lock);
+		if (!victim->tasks.empty())
+		{
+			task = victim->tasks.back();
+			victim->tasks.pop_back();
+		}
+		LeaveCriticalSection(&victim->lock);
+	}
+	return task;
+}
+
+void TaskPool::Work(ULONG worker)
+{
+	// true after resetting wake_, the next miss waits for it
+	bool armed = false;
+	for (;;)
+	{
+		ITask *task = Take(worker);
+		if (task != NULL)
+		{
+			task->Run(*this, worker);
+			delete task;
+			EnterCriticalSection(&lock_);
+			if (--pending_ == 0 && wake_ != NULL)
+			{
+				SetEvent(wake_);
+			}
+			LeaveCriticalSection(&lock_);
+			armed = false;
+			continue;
+		}
+
+		// running tasks may still spawn subtasks
+		EnterCriticalSection(&lock_);
+		bool finished = pending_ == 0;
+		if (!finished && !armed && wake_ != NULL)
+		{
+			ResetEvent(wake_);
+		}
+		LeaveCriticalSection(&lock_);
+		if (finished)
+		{
+			break;
+		}
+		if (wake_ == NULL)
+		{
+			SwitchToThread();
+		}
+		else if (!armed)
+		{
+			// take once more, a task spawned before the reset does not set the event again
+			armed = true;
+		}
+		else
+		{
+			WaitForSingleObject(wake_, INFINITE);
+			armed = false;
+		}
+	}
+}
+
+DWORD WINAPI TaskPool::ThreadProc(LPVOID parameter)
+{
+	Worker *worker = (Worker *)parameter;
+	worker->pool->Work(worker->index);
+	return 0;
+}
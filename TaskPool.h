@@ -0,0 +1,122 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+class TaskPool;
+
+/**
+*	@brief unit of work run by TaskPool
+*/
+class ITask
+{
+public:
+	virtual ~ITask() {}
+
+	/**
+	*	@brief run the task
+	*	@param pool [in] pool to spawn subtasks
+	*	@param worker [in] index of the worker running the task
+	*/
+	virtual void Run(TaskPool &pool, ULONG worker) = 0;
+};
+
+/**
+*	@brief run tasks on threads, each worker takes tasks from its own deque and steals from others when empty
+*	@note tasks must not call the debugger extension API other than reading target memory
+*/
+class TaskPool
+{
+public:
+	/**
+	*	@brief constructor
+	*	@param threads [in] number of workers including the thread calling Run
+	*/
+	TaskPool(ULONG threads);
+
+	/**
+	*	@brief destructor
+	*/
+	~TaskPool();
+
+	/**
+	*	@brief add a task before Run, tasks are dealt to workers in turn
+	*	@note the task is deleted by the pool after it runs
+	*/
+	void Spawn(ITask *task);
+
+	/**
+	*	@brief add a subtask to the deque of the worker running the current task
+	*/
+	void Spawn(ITask *task, ULONG worker);
+
+	/**
+	*	@brief run all tasks including subtasks spawned by them, and wait for them
+	*/
+	void Run();
+
+	/**
+	*	@brief number of workers
+	*/
+	ULONG GetThreads() const { return (ULONG)workers_.size(); }
+
+private:
+	struct Worker
+	{
+		TaskPool *pool;
+		ULONG index;
+		CRITICAL_SECTION lock;
+
+		/**
+		*	@brief the owner takes at front in spawned order, thieves steal at back
+		*/
+		std::deque<ITask *> tasks;
+	};
+
+	std::vector<Worker *> workers_;
+
+	/**
+	*	@brief guards pending_ and resetting wake_
+	*/
+	CRITICAL_SECTION lock_;
+
+	/**
+	*	@brief manual reset event set when a task is spawned or the last task finished
+	*	@note NULL if it could not be created, idle workers yield instead of waiting
+	*/
+	HANDLE wake_;
+
+	/**
+	*	@brief number of spawned tasks not finished yet
+	*/
+	ULONG pending_;
+
+	/**
+	*	@brief worker to deal the next task spawned before Run
+	*/
+	ULONG next_;
+
+	/**
+	*	@brief take a task of the worker, or steal one from others
+	*	@return NULL if no task is queued
+	*/
+	ITask *Take(ULONG worker);
+
+	/**
+	*	@brief run tasks until all tasks finished
+	*/
+	void Work(ULONG worker);
+
+	static DWORD WINAPI ThreadProc(LPVOID parameter);
+
+	/**
+	*	@brief copy constructor (disabled)
+	*/
+	TaskPool(const TaskPool&);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	TaskPool& operator=(const TaskPool&);
+};
@@ -0,0 +1,280 @@
+#include "common.h"
+#include "Utility.h"
+#include "TraceStore.h"
+
+/**
+*	@brief MAX_STACK_DEPTH of the database, frames read with the header at once
+*/
+#define TYPICAL_MAX_DEPTH 32
+
+/**
+*	@brief depth larger than this is treated as a broken entry while sweeping
+*/
+#define SWEEP_MAX_DEPTH 0x200
+
+TraceStore::TraceStore(bool isTarget64, ULONG32 ntGlobalFlag)
+: isTarget64_(isTarget64)
+, ntGlobalFlag_(ntGlobalFlag)
+, swept_(false)
+, databaseAddress_(0)
+, databaseSize_(0)
+, sweptCount_(0)
+{
+}
+
+ULONG TraceStore::Get(ULONG64 ustAddress, const ULONG64 *&frames)
+{
+	frames = NULL;
+	std::map<ULONG64, Span>::iterator itr = index_.find(ustAddress);
+	if (itr == index_.end())
+	{
+		Span span;
+		if (!Decode(ustAddress, span))
+		{
+			// remember the failure too
+			span.offset = 0;
+			span.depth = 0;
+			span.hash = 0;
+		}
+		itr = index_.insert(std::make_pair(ustAddress, span)).first;
+	}
+	if (itr->second.depth == 0)
+	{
+		return 0;
+	}
+	frames = &arena_[itr->second.offset];
+	return itr->second.depth;
+}
+
+ULONG TraceStore::GetHash(ULONG64 ustAddress)
+{
+	const ULONG64 *frames;
+	Get(ustAddress, frames);
+	return index_[ustAddress].hash;
+}
+
+ULONG TraceStore::GetDepthOffset()
+{
+	if (ntGlobalFlag_ & NT_GLOBAL_FLAG_HPA)
+	{
+		return isTarget64_ ? 0xe : 0xa;
+	}
+	else if (ntGlobalFlag_ & NT_GLOBAL_FLAG_UST)
+	{
+		return isTarget64_ ? 0xc : 0x8;
+	}
+	return 0;
+}
+
+/**
+*	@brief FNV-1a hash of frames
+*/
+static ULONG HashFrames(const ULONG64 *frames, ULONG depth)
+{
+	ULONG hash = 2166136261U;
+	for (ULONG i = 0; i < depth; i++)
+	{
+		for (ULONG j = 0; j < sizeof(frames[i]); j++)
+		{
+			hash = (hash ^ (ULONG)((frames[i] >> (j * 8)) & 0xff)) * 16777619U;
+		}
+	}
+	return hash;
+}
+
+void TraceStore::Append(const UCHAR *frames, USHORT depth, Span &span)
+{
+	const ULONG pointerSize = isTarget64_ ? 8 : 4;
+	span.offset = (ULONG)arena_.size();
+	span.depth = depth;
+	for (USHORT i = 0; i < depth; i++)
+	{
+		ULONG64 sp = 0;
+		memcpy(&sp, frames + i * pointerSize, pointerSize);
+		arena_.push_back(sp);
+	}
+	span.hash = HashFrames(depth != 0 ? &arena_[span.offset] : NULL, depth);
+}
+
+void TraceStore::Insert(ULONG64 ustAddress, const ULONG64 *frames, ULONG depth)
+{
+	Span span;
+	span.offset = (ULONG)arena_.size();
+	span.depth = depth;
+	span.hash = HashFrames(frames, depth);
+	arena_.insert(arena_.end(), frames, frames + depth);
+	index_[ustAddress] = span;
+}
+
+bool TraceStore::Decode(ULONG64 ustAddress, Span &span)
+{
+	const ULONG depthOffset = GetDepthOffset();
+	if (depthOffset == 0)
+	{
+		dprintf("please set ust or hpa by gflags.exe\n");
+		return false;
+	}
+	const ULONG arrayOffset = (ULONG)GetStackTraceArrayPtr(0, isTarget64_);
+	const ULONG pointerSize = isTarget64_ ? 8 : 4;
+
+	// header and frames of a typical depth by a single read
+	std::vector<UCHAR> buffer(arrayOffset + TYPICAL_MAX_DEPTH * pointerSize);
+	ULONG cb = 0;
+	ReadTargetMemory(ustAddress, &buffer[0], (ULONG)buffer.size(), &cb); // short read keeps readable part
+	if (cb > buffer.size())
+	{
+		cb = 0;
+	}
+	if (cb < arrayOffset &&
+		(!ReadTargetMemory(ustAddress, &buffer[0], arrayOffset, &cb) || cb != arrayOffset))
+	{
+		dprintf("read depth failed at %p + %p\n", ustAddress, (ULONG64)depthOffset);
+		return false;
+	}
+
+	USHORT depth;
+	memcpy(&depth, &buffer[depthOffset], sizeof(depth));
+	const ULONG size = arrayOffset + depth * pointerSize;
+	if (cb < size)
+	{
+		buffer.resize(size);
+		if (!ReadTargetMemory(ustAddress, &buffer[0], size, &cb) || cb != size)
+		{
+			dprintf("read sp failed\n");
+			return false;
+		}
+	}
+
+	Append(&buffer[arrayOffset], depth, span);
+	return true;
+}
+
+BOOL TraceStore::Sweep(const std::string &ntdllName, TypeLayout &layout)
+{
+	if (swept_)
+	{
+		return TRUE;
+	}
+	const ULONG depthOffset = GetDepthOffset();
+	if (depthOffset == 0)
+	{
+		dprintf("please set ust or hpa by gflags.exe\n");
+		return FALSE;
+	}
+
+	ULONG cb;
+	ULONG64 pDatabase;
+	if (!GetExpressionEx((ntdllName + "!RtlpStackTraceDataBase").c_str(), &pDatabase, NULL))
+	{
+		dprintf("get %s!RtlpStackTraceDataBase failed\n", ntdllName.c_str());
+		return FALSE;
+	}
+
+	ULONG64 database = 0;
+	ULONG64 nextFreeLowerMemory = 0;
+	ULONG32 numberOfEntriesAdded;
+	ULONG32 numberOfBuckets;
+	ULONG bucketsOffset;
+	if (isTarget64_)
+	{
+		if (!READMEMORY(pDatabase, database) || database == 0)
+		{
+			dprintf("read RtlpStackTraceDataBase failed\n");
+			return FALSE;
+		}
+		if (!layout.ReadField(database, TypeLayout::STACK_TRACE_DATABASE_NextFreeLowerMemory, nextFreeLowerMemory) ||
+			!layout.ReadField(database, TypeLayout::STACK_TRACE_DATABASE_NumberOfEntriesAdded, numberOfEntriesAdded) ||
+			!layout.ReadField(database, TypeLayout::STACK_TRACE_DATABASE_NumberOfBuckets, numberOfBuckets) ||
+			!layout.GetOffset(TypeLayout::STACK_TRACE_DATABASE_Buckets, bucketsOffset))
+		{
+			dprintf("read _STACK_TRACE_DATABASE failed\n");
+			return FALSE;
+		}
+	}
+	else
+	{
+		ULONG32 value;
+		if (!READMEMORY(pDatabase, value) || value == 0)
+		{
+			dprintf("read RtlpStackTraceDataBase failed\n");
+			return FALSE;
+		}
+		database = value;
+		if (!READMEMORY(database + 0x54, value) ||
+			!READMEMORY(database + 0x60, numberOfEntriesAdded) ||
+			!READMEMORY(database + 0x68, numberOfBuckets))
+		{
+			dprintf("read _STACK_TRACE_DATABASE failed\n");
+			return FALSE;
+		}
+		nextFreeLowerMemory = value;
+		bucketsOffset = 0x6c;
+	}
+
+	// entries are allocated upward just after the hash buckets
+	const ULONG pointerSize = isTarget64_ ? 8 : 4;
+	const ULONG arrayOffset = (ULONG)GetStackTraceArrayPtr(0, isTarget64_);
+	const ULONG64 first = database + bucketsOffset + (ULONG64)numberOfBuckets * pointerSize;
+	if (nextFreeLowerMemory < first)
+	{
+		dprintf("unexpected NextFreeLowerMemory %p\n", nextFreeLowerMemory);
+		return FALSE;
+	}
+
+	Settings &settings = GetSettings();
+	RegionReader reader(first, nextFreeLowerMemory, settings.bulkRead ? settings.bulkChunkSize : 0);
+	std::vector<UCHAR> buffer(arrayOffset + TYPICAL_MAX_DEPTH * pointerSize);
+	arena_.reserve(arena_.size() + (size_t)numberOfEntriesAdded * TYPICAL_MAX_DEPTH / 2);
+	ULONG count = 0;
+	ULONG64 address = first;
+	while (address + arrayOffset <= nextFreeLowerMemory)
+	{
+		if (!reader.Read(address, &buffer[0], arrayOffset, &cb) || cb != arrayOffset)
+		{
+			dprintf("read ust entry failed at %p\n", address);
+			break;
+		}
+		USHORT depth;
+		memcpy(&depth, &buffer[depthOffset], sizeof(depth));
+		const ULONG size = arrayOffset + depth * pointerSize;
+		if (depth > SWEEP_MAX_DEPTH || nextFreeLowerMemory - address < size)
+		{
+			dprintf("unexpected ust entry at %p, sweep stopped\n", address);
+			break;
+		}
+		if (buffer.size() < size)
+		{
+			buffer.resize(size);
+		}
+		if (depth != 0 &&
+			(!reader.Read(address + arrayOffset, &buffer[arrayOffset], size - arrayOffset, &cb) || cb != size - arrayOffset))
+		{
+			dprintf("read sp failed at %p\n", address);
+			break;
+		}
+		Span span;
+		Append(&buffer[arrayOffset], depth, span);
+		index_[address] = span;
+		count++;
+		address += size;
+	}
+
+	swept_ = true;
+	databaseAddress_ = database;
+	databaseSize_ = nextFreeLowerMemory - database + (ULONG64)numberOfEntriesAdded * pointerSize; // with index array
+	sweptCount_ = count;
+	if (count != numberOfEntriesAdded)
+	{
+		dprintf("%d of %d ust entries swept\n", count, numberOfEntriesAdded);
+	}
+	return TRUE;
+}
+
+void TraceStore::PrintDatabase()
+{
+	if (!swept_)
+	{
+		return;
+	}
+	dprintf("ust database at %p: %p bytes, %d traces\n", databaseAddress_, databaseSize_, sweptCount_);
+}
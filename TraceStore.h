@@ -0,0 +1,117 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "TypeLayout.h"
+
+/**
+*	@brief stack traces in the user mode stack trace database, decoded once per entry
+*	@note frames of all traces are kept in a flat arena
+*/
+class TraceStore
+{
+public:
+	/**
+	*	@brief constructor
+	*	@param isTarget64 [in] target is x64 or not
+	*	@param ntGlobalFlag [in] gflag to select the entry format (ust or hpa)
+	*/
+	TraceStore(bool isTarget64, ULONG32 ntGlobalFlag);
+
+	/**
+	*	@brief get frames of the trace, decode it on first use
+	*	@param ustAddress [in] address of entry in user mode stack trace database
+	*	@param frames [out] first frame, valid until the next call of Get
+	*	@return depth, 0 if the entry is not readable
+	*/
+	ULONG Get(ULONG64 ustAddress, const ULONG64 *&frames);
+
+	/**
+	*	@brief add a decoded trace (e.g. restored from a heap snapshot)
+	*/
+	void Insert(ULONG64 ustAddress, const ULONG64 *frames, ULONG depth);
+
+	/**
+	*	@brief hash of frames of the trace, 0 if the entry is not readable
+	*/
+	ULONG GetHash(ULONG64 ustAddress);
+
+	/**
+	*	@brief decode all entries of ntdll!RtlpStackTraceDataBase by sequential reads
+	*	@param ntdllName [in] module name of ntdll
+	*	@param layout [in] layouts of ntdll types (x64)
+	*	@note Get finds swept entries without reading the target
+	*/
+	BOOL Sweep(const std::string &ntdllName, TypeLayout &layout);
+
+	/**
+	*	@brief print address, size and number of traces of the database found by Sweep
+	*/
+	void PrintDatabase();
+
+private:
+	/**
+	*	@brief location of a trace in arena_
+	*/
+	struct Span
+	{
+		ULONG offset;
+		ULONG depth;
+		ULONG hash;
+	};
+
+	const bool isTarget64_;
+	const ULONG32 ntGlobalFlag_;
+
+	/**
+	*	@brief ustAddress to Span
+	*/
+	std::map<ULONG64, Span> index_;
+
+	/**
+	*	@brief frames of all decoded traces
+	*/
+	std::vector<ULONG64> arena_;
+
+	/**
+	*	@brief true if Sweep succeeded
+	*/
+	bool swept_;
+
+	/**
+	*	@brief address of the database, 0 if not swept
+	*/
+	ULONG64 databaseAddress_;
+
+	/**
+	*	@brief bytes used by the database (entries and index array)
+	*/
+	ULONG64 databaseSize_;
+
+	/**
+	*	@brief number of entries found by Sweep
+	*/
+	ULONG sweptCount_;
+
+	/**
+	*	@brief offset of depth in an entry, 0 if neither ust nor hpa is enabled
+	*/
+	ULONG GetDepthOffset();
+
+	/**
+	*	@brief append frames in raw entry to arena_
+	*/
+	void Append(const UCHAR *frames, USHORT depth, Span &span);
+
+	/**
+	*	@brief read the entry at once and append its frames to arena_
+	*/
+	bool Decode(ULONG64 ustAddress, Span &span);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	TraceStore& operator=(const TraceStore&);
+};
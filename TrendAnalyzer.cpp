@@ -0,0 +1,252 @@
+#include <algorithm>
+#include "common.h"
+#include "TrendAnalyzer.h"
+
+#define INITIAL_BUCKETS 256
+
+TrendAnalyzer::TrendAnalyzer()
+: buckets_(INITIAL_BUCKETS, -1)
+, points_(0)
+{
+}
+
+void TrendAnalyzer::AddPoint(TargetContext &context, const SummaryProcessor &summary)
+{
+	for (std::vector<Site>::iterator itr = sites_.begin(); itr != sites_.end(); ++itr)
+	{
+		itr->counts.push_back(0);
+		itr->totals.push_back(0);
+	}
+	points_++;
+	AddModules(context.GetLoadedModules());
+
+	TraceStore &traces = context.GetTraceStore();
+	const std::map<ULONG64, SummaryProcessor::UstRecord> &records = summary.GetRecords();
+	for (std::map<ULONG64, SummaryProcessor::UstRecord>::const_iterator itr = records.begin();
+		itr != records.end(); ++itr)
+	{
+		// records without trace are joined to the site of depth 0
+		const ULONG64 *frames = NULL;
+		ULONG depth = 0;
+		ULONG hash = 0;
+		if (itr->first != 0)
+		{
+			hash = traces.GetHash(itr->first);
+			depth = traces.Get(itr->first, frames);
+		}
+		Site &site = sites_[FindOrAdd(hash, frames, depth)];
+		site.ustAddress = itr->first;
+		site.counts.back() += itr->second.count;
+		site.totals.back() += itr->second.totalSize;
+	}
+}
+
+void TrendAnalyzer::AddModules(const std::vector<ModuleInfo> &modules)
+{
+	// snapshots of one process mostly share modules, a module loaded again at another base is kept twice
+	for (std::vector<ModuleInfo>::const_iterator itr = modules.begin(); itr != modules.end(); ++itr)
+	{
+		std::vector<ModuleInfo>::const_iterator found = modules_.begin();
+		for (; found != modules_.end(); ++found)
+		{
+			if (found->DllBase == itr->DllBase && found->SizeOfImage == itr->SizeOfImage &&
+				strcmp(found->FullDllName, itr->FullDllName) == 0)
+			{
+				break;
+			}
+		}
+		if (found == modules_.end())
+		{
+			modules_.push_back(*itr);
+		}
+	}
+}
+
+int TrendAnalyzer::FindOrAdd(ULONG hash, const ULONG64 *frames, ULONG depth)
+{
+	const size_t mask = buckets_.size() - 1;
+	size_t bucket = hash & mask;
+	while (buckets_[bucket] >= 0)
+	{
+		const Site &site = sites_[buckets_[bucket]];
+		if (site.hash == hash && site.depth == depth &&
+			(depth == 0 || std::equal(frames, frames + depth, &arena_[site.offset])))
+		{
+			return buckets_[bucket];
+		}
+		bucket = (bucket + 1) & mask;
+	}
+
+	Site site;
+	site.offset = (ULONG)arena_.size();
+	site.depth = depth;
+	site.hash = hash;
+	site.ustAddress = 0;
+	site.counts.resize(points_, 0);
+	site.totals.resize(points_, 0);
+	site.slope = 0;
+	site.monotonic = false;
+	arena_.insert(arena_.end(), frames, frames + depth);
+	int index = (int)sites_.size();
+	sites_.push_back(site);
+	buckets_[bucket] = index;
+	if (sites_.size() * 2 > buckets_.size())
+	{
+		Grow();
+	}
+	return index;
+}
+
+void TrendAnalyzer::Grow()
+{
+	buckets_.assign(buckets_.size() * 2, -1);
+	const size_t mask = buckets_.size() - 1;
+	for (size_t i = 0; i < sites_.size(); i++)
+	{
+		size_t bucket = sites_[i].hash & mask;
+		while (buckets_[bucket] >= 0)
+		{
+			bucket = (bucket + 1) & mask;
+		}
+		buckets_[bucket] = (int)i;
+	}
+}
+
+void TrendAnalyzer::Measure()
+{
+	// x is the snapshot number, slope = sum((x - mx) * y) / sum((x - mx)^2)
+	const double mx = (points_ - 1) / 2.0;
+	double sxx = 0;
+	for (ULONG x = 0; x < points_; x++)
+	{
+		sxx += (x - mx) * (x - mx);
+	}
+	for (std::vector<Site>::iterator itr = sites_.begin(); itr != sites_.end(); ++itr)
+	{
+		double sxy = 0;
+		bool monotonic = true;
+		for (ULONG x = 0; x < points_; x++)
+		{
+			sxy += (x - mx) * (double)itr->totals[x];
+			if (x != 0 && itr->totals[x] < itr->totals[x - 1])
+			{
+				monotonic = false;
+			}
+		}
+		itr->slope = sxx != 0 ? (LONG64)(sxy / sxx) : 0;
+		itr->monotonic = monotonic && itr->totals.back() > itr->totals.front();
+	}
+}
+
+/**
+*	@brief order of sites, larger growth first
+*/
+class SiteOrder
+{
+public:
+	SiteOrder(TrendAnalyzer::RankKey rank) : rank_(rank) {}
+
+	template <typename T>
+	bool operator()(const T *lhs, const T *rhs) const
+	{
+		if (rank_ == TrendAnalyzer::RANK_MONOTONIC)
+		{
+			if (lhs->monotonic != rhs->monotonic)
+			{
+				return lhs->monotonic;
+			}
+			LONG64 left = (LONG64)(lhs->totals.back() - lhs->totals.front());
+			LONG64 right = (LONG64)(rhs->totals.back() - rhs->totals.front());
+			if (left != right)
+			{
+				return left > right;
+			}
+		}
+		if (lhs->slope != rhs->slope)
+		{
+			return lhs->slope > rhs->slope;
+		}
+		return lhs->offset < rhs->offset;
+	}
+
+private:
+	const TrendAnalyzer::RankKey rank_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	SiteOrder& operator=(const SiteOrder&);
+};
+
+void TrendAnalyzer::Print(RankKey rank, const ReportOptions &options)
+{
+	Measure();
+
+	// thresholds apply to the last snapshot, then sort only the printed sites
+	std::vector<const Site*> sites;
+	for (std::vector<Site>::const_iterator itr = sites_.begin(); itr != sites_.end(); ++itr)
+	{
+		if (itr->totals.back() >= options.minTotal && itr->counts.back() >= options.minCount)
+		{
+			sites.push_back(&*itr);
+		}
+	}
+	std::vector<const Site*>::iterator end = sites.end();
+	if (options.top != 0 && options.top < sites.size())
+	{
+		end = sites.begin() + (size_t)options.top;
+	}
+	std::partial_sort(sites.begin(), end, sites.end(), SiteOrder(rank));
+
+	// frames are of the saved processes, not of the debugger target
+	ModuleIndex moduleIndex(modules_, std::string());
+	std::string text;
+
+	dprintf("%d sites in %d snapshots\n\n", (ULONG)sites_.size(), points_);
+	for (std::vector<const Site*>::iterator itr = sites.begin(); itr != end; ++itr)
+	{
+		const Site &site = **itr;
+		dprintf("slope %s%I64x bytes per snapshot%s\n",
+			site.slope < 0 ? "-" : "",
+			site.slope < 0 ? -site.slope : site.slope,
+			site.monotonic ? ", monotonic" : "");
+		PrintSeries("count", site.counts);
+		PrintSeries("total", site.totals);
+		if (site.depth == 0)
+		{
+			dprintf("\tno stack trace\n");
+		}
+		else
+		{
+			dprintf("\tust at %p depth: %d\n", site.ustAddress, site.depth);
+			const ULONG64 *frames = &arena_[site.offset];
+			for (const ULONG64 *frame = frames; frame != frames + site.depth; frame++)
+			{
+				if (moduleIndex.FormatFrame(*frame, text))
+				{
+					dprintf("\t%s\n", text.c_str());
+				}
+				else
+				{
+					dprintf("\t%p\n", *frame);
+				}
+			}
+		}
+	}
+	if (end != sites.end())
+	{
+		dprintf("%d more sites\n", (ULONG)(sites.end() - end));
+	}
+	dprintf("\n");
+}
+
+void TrendAnalyzer::PrintSeries(PCSTR name, const std::vector<ULONG64> &series)
+{
+	dprintf("\t%s:", name);
+	for (std::vector<ULONG64>::const_iterator itr = series.begin(); itr != series.end(); ++itr)
+	{
+		dprintf(" %I64x", *itr);
+	}
+	dprintf("\n");
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+#include "TargetContext.h"
+#include "SummaryProcessor.h"
+#include "ReportOptions.h"
+
+/**
+*	@brief series of count and total size per call site over heap snapshots of one process
+*	@note call sites of snapshots are joined by frames of their stack traces in a hash table,
+*	      so ust addresses need not be the same in all snapshots
+*/
+class TrendAnalyzer
+{
+public:
+	enum RankKey
+	{
+		RANK_SLOPE,		///< least squares slope of total size, larger first
+		RANK_MONOTONIC	///< sites never shrinking first, then growth from the first snapshot
+	};
+
+	/**
+	*	@brief constructor
+	*/
+	TrendAnalyzer();
+
+	/**
+	*	@brief add records of the next snapshot
+	*	@param context [in] target information of the snapshot, stack traces are read from it
+	*	@param summary [in] per ust aggregation of the snapshot
+	*/
+	void AddPoint(TargetContext &context, const SummaryProcessor &summary);
+
+	/**
+	*	@brief print sites ranked by rank
+	*	@param options [in] -n, --min-total and --min-count applied to the last snapshot
+	*/
+	void Print(RankKey rank, const ReportOptions &options);
+
+private:
+	/**
+	*	@brief a call site, records having the same frames
+	*/
+	struct Site
+	{
+		ULONG offset;	///< first frame in arena_
+		ULONG depth;
+		ULONG hash;
+		ULONG64 ustAddress;	///< ust address in the latest snapshot having the site
+		std::vector<ULONG64> counts;	///< count per snapshot
+		std::vector<ULONG64> totals;	///< total size per snapshot
+		LONG64 slope;	///< bytes per snapshot
+		bool monotonic;
+	};
+
+	std::vector<Site> sites_;
+
+	/**
+	*	@brief frames of all sites
+	*/
+	std::vector<ULONG64> arena_;
+
+	/**
+	*	@brief open addressing table of indexes in sites_, -1 for empty
+	*	@note the size is a power of 2 and kept at least twice of the number of sites
+	*/
+	std::vector<int> buckets_;
+
+	/**
+	*	@brief modules of all snapshots, frames are printed as module+offset from them
+	*/
+	std::vector<ModuleInfo> modules_;
+
+	/**
+	*	@brief number of added snapshots
+	*/
+	ULONG points_;
+
+	/**
+	*	@brief find the site having frames, add it if not found
+	*	@return index in sites_
+	*/
+	int FindOrAdd(ULONG hash, const ULONG64 *frames, ULONG depth);
+
+	/**
+	*	@brief double buckets_ and rehash all sites
+	*/
+	void Grow();
+
+	/**
+	*	@brief compute slope and monotonic of all sites
+	*/
+	void Measure();
+
+	/**
+	*	@brief add modules of the snapshot not added yet
+	*/
+	void AddModules(const std::vector<ModuleInfo> &modules);
+
+	/**
+	*	@brief print a series
+	*/
+	void PrintSeries(PCSTR name, const std::vector<ULONG64> &series);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	TrendAnalyzer& operator=(const TrendAnalyzer&);
+};
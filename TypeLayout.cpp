@@ -0,0 +1,137 @@
+#include "common.h"
+#include "Utility.h"
+#include "TypeLayout.h"
+
+#define UNRESOLVED 0xffffffff
+#define NOT_FOUND 0xfffffffe
+
+static const char *typeNames[] = {
+	"_HEAP",
+	"_LFH_HEAP",
+	"_LFH_BLOCK_ZONE",
+	"_HEAP_SUBSEGMENT",
+	"_HEAP_USERDATA_HEADER",
+	"_DPH_HEAP_BLOCK",
+	"_DPH_HEAP_ROOT",
+	"_PEB",
+	"_PEB_LDR_DATA",
+	"_LDR_DATA_TABLE_ENTRY",
+	"_STACK_TRACE_DATABASE",
+};
+
+static const struct
+{
+	TypeLayout::Type type;
+	const char *name;
+} fields[] = {
+	{ TypeLayout::HEAP, "Encoding" },
+	{ TypeLayout::HEAP, "VirtualAllocdBlocks" },
+	{ TypeLayout::HEAP, "FrontEndHeap" },
+	{ TypeLayout::HEAP, "FrontEndHeapType" },
+	{ TypeLayout::LFH_HEAP, "SubSegmentZones" },
+	{ TypeLayout::LFH_BLOCK_ZONE, "NextIndex" },
+	{ TypeLayout::LFH_BLOCK_ZONE, "FreePointer" },
+	{ TypeLayout::HEAP_SUBSEGMENT, "UserBlocks" },
+	{ TypeLayout::HEAP_SUBSEGMENT, "BlockSize" },
+	{ TypeLayout::HEAP_SUBSEGMENT, "BlockCount" },
+	{ TypeLayout::HEAP_USERDATA_HEADER, "EncodedOffsets" },
+	{ TypeLayout::HEAP_USERDATA_HEADER, "FirstAllocationOffset" },
+	{ TypeLayout::HEAP_USERDATA_HEADER, "BusyBitmap" },
+	{ TypeLayout::DPH_HEAP_BLOCK, "pUserAllocation" },
+	{ TypeLayout::DPH_HEAP_BLOCK, "pVirtualBlock" },
+	{ TypeLayout::DPH_HEAP_BLOCK, "nVirtualBlockSize" },
+	{ TypeLayout::DPH_HEAP_BLOCK, "nUserRequestedSize" },
+	{ TypeLayout::DPH_HEAP_BLOCK, "StackTrace" },
+	{ TypeLayout::DPH_HEAP_ROOT, "BusyNodesTable" },
+	{ TypeLayout::DPH_HEAP_ROOT, "NextHeap" },
+	{ TypeLayout::DPH_HEAP_ROOT, "NormalHeap" },
+	{ TypeLayout::PEB, "Ldr" },
+	{ TypeLayout::PEB, "NtGlobalFlag" },
+	{ TypeLayout::PEB, "NumberOfHeaps" },
+	{ TypeLayout::PEB, "ProcessHeaps" },
+	{ TypeLayout::PEB, "OSMajorVersion" },
+	{ TypeLayout::PEB, "OSMinorVersion" },
+	{ TypeLayout::PEB_LDR_DATA, "InMemoryOrderModuleList" },
+	{ TypeLayout::LDR_DATA_TABLE_ENTRY, "DllBase" },
+	{ TypeLayout::LDR_DATA_TABLE_ENTRY, "SizeOfImage" },
+	{ TypeLayout::LDR_DATA_TABLE_ENTRY, "FullDllName" },
+	{ TypeLayout::STACK_TRACE_DATABASE, "NextFreeLowerMemory" },
+	{ TypeLayout::STACK_TRACE_DATABASE, "NumberOfEntriesAdded" },
+	{ TypeLayout::STACK_TRACE_DATABASE, "NumberOfBuckets" },
+	{ TypeLayout::STACK_TRACE_DATABASE, "Buckets" },
+};
+
+TypeLayout::TypeLayout(const std::string &module)
+: module_(module)
+, sizes_(TYPE_COUNT, UNRESOLVED)
+, offsets_(FIELD_COUNT, UNRESOLVED)
+, fieldSizes_(FIELD_COUNT, 0)
+{
+}
+
+ULONG TypeLayout::GetSize(Type type)
+{
+	if (sizes_[type] == UNRESOLVED)
+	{
+		sizes_[type] = ::GetTypeSize((module_ + "!" + typeNames[type]).c_str());
+	}
+	return sizes_[type];
+}
+
+BOOL TypeLayout::GetOffset(Field field, ULONG &offset)
+{
+	if (offsets_[field] == UNRESOLVED)
+	{
+		std::string type = module_ + "!" + typeNames[fields[field].type];
+		if (::GetFieldOffsetAndSize(type.c_str(), fields[field].name, &offsets_[field], &fieldSizes_[field]) != 0)
+		{
+			offsets_[field] = NOT_FOUND;
+		}
+	}
+	offset = offsets_[field];
+	return offset != NOT_FOUND;
+}
+
+void TypeLayout::ResolveAll()
+{
+#ifdef HEAPSTAT_OFFLINE
+	// types not used by the walk are not reported
+	SetLayoutMessages(false);
+#endif
+	for (int type = 0; type < TYPE_COUNT; type++)
+	{
+		GetSize((Type)type);
+	}
+	for (int field = 0; field < FIELD_COUNT; field++)
+	{
+		ULONG offset;
+		GetOffset((Field)field, offset);
+	}
+#ifdef HEAPSTAT_OFFLINE
+	SetLayoutMessages(true);
+#endif
+}
+
+BOOL TypeLayout::GetValueSize(Field field, ULONG valueSize, ULONG &size)
+{
+	size = fieldSizes_[field] != 0 ? fieldSizes_[field] : valueSize;
+	if (size > valueSize)
+	{
+		dprintf("%s::%s is 0x%x bytes, larger than 0x%x\n",
+			typeNames[fields[field].type], fields[field].name, size, valueSize);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL TypeLayout::ReadStruct(ULONG64 address, Type type, std::vector<UCHAR> &raw)
+{
+	ULONG size = GetSize(type);
+	if (size == 0)
+	{
+		return FALSE;
+	}
+	raw.resize(size);
+	ULONG cb;
+	return ReadTargetMemory(address, &raw[0], size, &cb) && cb == size;
+}
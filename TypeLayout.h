@@ -0,0 +1,167 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "MemoryCache.h"
+
+/**
+*	@brief offsets and sizes of ntdll types used by the 64 bit walkers
+*	@note resolved through the debugger on first use and cached by TargetContext, which is
+*	      rebuilt for another process or when symbols are reloaded,
+*	      walkers read a structure at once by ReadStruct and decode fields by GetField
+*/
+class TypeLayout
+{
+public:
+	enum Type
+	{
+		HEAP,
+		LFH_HEAP,
+		LFH_BLOCK_ZONE,
+		HEAP_SUBSEGMENT,
+		HEAP_USERDATA_HEADER,
+		DPH_HEAP_BLOCK,
+		DPH_HEAP_ROOT,
+		PEB,
+		PEB_LDR_DATA,
+		LDR_DATA_TABLE_ENTRY,
+		STACK_TRACE_DATABASE,
+		TYPE_COUNT
+	};
+
+	enum Field
+	{
+		HEAP_Encoding,
+		HEAP_VirtualAllocdBlocks,
+		HEAP_FrontEndHeap,
+		HEAP_FrontEndHeapType,
+		LFH_HEAP_SubSegmentZones,
+		LFH_BLOCK_ZONE_NextIndex,
+		LFH_BLOCK_ZONE_FreePointer,
+		HEAP_SUBSEGMENT_UserBlocks,
+		HEAP_SUBSEGMENT_BlockSize,
+		HEAP_SUBSEGMENT_BlockCount,
+		HEAP_USERDATA_HEADER_EncodedOffsets,
+		HEAP_USERDATA_HEADER_FirstAllocationOffset,
+		HEAP_USERDATA_HEADER_BusyBitmap,
+		DPH_HEAP_BLOCK_pUserAllocation,
+		DPH_HEAP_BLOCK_pVirtualBlock,
+		DPH_HEAP_BLOCK_nVirtualBlockSize,
+		DPH_HEAP_BLOCK_nUserRequestedSize,
+		DPH_HEAP_BLOCK_StackTrace,
+		DPH_HEAP_ROOT_BusyNodesTable,
+		DPH_HEAP_ROOT_NextHeap,
+		DPH_HEAP_ROOT_NormalHeap,
+		PEB_Ldr,
+		PEB_NtGlobalFlag,
+		PEB_NumberOfHeaps,
+		PEB_ProcessHeaps,
+		PEB_OSMajorVersion,
+		PEB_OSMinorVersion,
+		PEB_LDR_DATA_InMemoryOrderModuleList,
+		LDR_DATA_TABLE_ENTRY_DllBase,
+		LDR_DATA_TABLE_ENTRY_SizeOfImage,
+		LDR_DATA_TABLE_ENTRY_FullDllName,
+		STACK_TRACE_DATABASE_NextFreeLowerMemory,
+		STACK_TRACE_DATABASE_NumberOfEntriesAdded,
+		STACK_TRACE_DATABASE_NumberOfBuckets,
+		STACK_TRACE_DATABASE_Buckets,
+		FIELD_COUNT
+	};
+
+	/**
+	*	@brief constructor
+	*	@param module [in] module name used to qualify type names
+	*/
+	TypeLayout(const std::string &module);
+
+	/**
+	*	@brief size of the type
+	*	@retval 0 the type is not found
+	*/
+	ULONG GetSize(Type type);
+
+	/**
+	*	@brief offset of the field in its type
+	*	@retval FALSE the field is not found (e.g. not in this OS version)
+	*/
+	BOOL GetOffset(Field field, ULONG &offset);
+
+	/**
+	*	@brief resolve all sizes and offsets
+	*	@note layouts are read only after this, so that threads can share them
+	*/
+	void ResolveAll();
+
+	/**
+	*	@brief read whole structure of the type at once
+	*/
+	BOOL ReadStruct(ULONG64 address, Type type, std::vector<UCHAR> &raw);
+
+	/**
+	*	@brief decode a field from a structure read by ReadStruct
+	*	@note a field smaller than value is zero extended, a larger one is not decoded
+	*/
+	template <typename T>
+	BOOL GetField(const std::vector<UCHAR> &raw, Field field, T &value)
+	{
+		ULONG offset, size;
+		if (!GetOffset(field, offset) || !GetValueSize(field, sizeof(T), size) || raw.size() < offset + size)
+		{
+			return FALSE;
+		}
+		memset(&value, 0, sizeof(T));
+		memcpy(&value, &raw[offset], size);
+		return TRUE;
+	}
+
+	/**
+	*	@brief read a field of the structure at address
+	*	@note a field smaller than value is zero extended, a larger one is not read
+	*/
+	template <typename T>
+	BOOL ReadField(ULONG64 address, Field field, T &value)
+	{
+		ULONG offset, size;
+		ULONG cb;
+		if (!GetOffset(field, offset) || !GetValueSize(field, sizeof(T), size))
+		{
+			return FALSE;
+		}
+		memset(&value, 0, sizeof(T));
+		return ReadTargetMemory(address + offset, &value, size, &cb) && cb == size;
+	}
+
+private:
+	/**
+	*	@brief module name, "ntdll"
+	*/
+	std::string module_;
+
+	/**
+	*	@brief resolved sizes indexed by Type, UNRESOLVED until first use
+	*/
+	std::vector<ULONG> sizes_;
+
+	/**
+	*	@brief resolved offsets indexed by Field, UNRESOLVED until first use
+	*/
+	std::vector<ULONG> offsets_;
+
+	/**
+	*	@brief sizes of resolved fields indexed by Field, 0 if not given by the debugger
+	*/
+	std::vector<ULONG> fieldSizes_;
+
+	/**
+	*	@brief number of bytes to copy from a resolved field into a value
+	*	@retval FALSE the field is larger than the value
+	*/
+	BOOL GetValueSize(Field field, ULONG valueSize, ULONG &size);
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	TypeLayout& operator=(const TypeLayout&);
+};
@@ -1,13 +1,18 @@
-#include <windows.h>
-#include <atlstr.h>
+#include <algorithm>
 #include "common.h"
 #include "Utility.h"
 #include "UmdhProcessor.h"
 
-UmdhProcessor::UmdhProcessor(PCSTR filename)
-: output_(INVALID_HANDLE_VALUE)
-, isTarget64_(IsTarget64())
-, ntGlobalFlag_(GetNtGlobalFlag())
+/**
+*	@brief size of each of the two output buffers
+*/
+#define OUTPUT_BUFFER_SIZE 0x100000
+
+UmdhProcessor::UmdhProcessor(TargetContext &context, PCSTR filename, bool grouped)
+: output_(OUTPUT_BUFFER_SIZE)
+, isTarget64_(context.IsTarget64())
+, traces_(context.GetTraceStore())
+, grouped_(grouped)
 {
 	LPSTR buffer[MAX_PATH];
 	if (!GetCurrentDirectory(_countof(buffer),(LPSTR)buffer))
@@ -16,8 +21,8 @@ UmdhProcessor::UmdhProcessor(PCSTR filename)
 	}
 	dprintf("current directory: %s\n", buffer);
 
-	output_ = CreateFile(filename, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (output_ == INVALID_HANDLE_VALUE)
+	HANDLE file = CreateFile(filename, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
 	{
 		DWORD lastError = GetLastError();
 		switch (lastError)
@@ -34,43 +39,35 @@ UmdhProcessor::UmdhProcessor(PCSTR filename)
 		}
 		throw -1;
 	}
-	CString str = "// Loaded modules:\r\n"
+	std::string str = "// Loaded modules:\r\n"
 		"//     Base Size Module\r\n";
 
-	std::vector<ModuleInfo> modules = GetLoadedModules();
-	for (std::vector<ModuleInfo>::iterator itr = modules.begin(); itr != modules.end(); itr++)
+	const std::vector<ModuleInfo> &modules = context.GetLoadedModules();
+	for (std::vector<ModuleInfo>::const_iterator itr = modules.begin(); itr != modules.end(); itr++)
 	{
-		CString line;
-		line.Format("//    %16I64X %8I64X %s\r\n", itr->DllBase, itr->SizeOfImage, itr->FullDllName);
-		str += line;
+		str += FormatString("//    %16I64X %8I64X %s\r\n", itr->DllBase, itr->SizeOfImage, itr->FullDllName);
 	}
 	str += "//\r\n";
-	DWORD written;
-	if (!WriteFile(output_, (LPCSTR)str, str.GetLength(), &written, NULL) || written != (DWORD)str.GetLength())
-	{
-		dprintf("%s: WriteFile failed %d (written %d)\n", __FUNCTION__, GetLastError(), written);
-		CloseHandle(output_);
-		output_ = INVALID_HANDLE_VALUE;
-		throw -1;
-	}
+	output_.Open(file);
+	output_.Append(str);
 }
 
 UmdhProcessor::~UmdhProcessor()
 {
-	if (output_ != INVALID_HANDLE_VALUE)
+	if (grouped_ && output_.IsOpen())
 	{
-		CloseHandle(output_);
+		WriteGroups();
 	}
+	output_.Close();
 }
 
 void UmdhProcessor::StartHeap(ULONG64 heapAddress)
 {
-	if (output_ == INVALID_HANDLE_VALUE)
+	if (grouped_ || !output_.IsOpen())
 	{
 		return;
 	}
-	CString str;
-	str.Format("\r\n"
+	output_.Append(FormatString("\r\n"
 		"*- - - - - - - - - - Start of data for heap @ %I64X - - - - - - - - - -\r\n"
 		"\r\n"
 		"REQUESTED bytes + OVERHEAD at ADDRESS by BackTraceID\r\n"
@@ -78,67 +75,133 @@ void UmdhProcessor::StartHeap(ULONG64 heapAddress)
 		"\r\n"
 		"*- - - - - - - - - - Heap %I64X Hogs - - - - - - - - - -\r\n"
 		"\r\n",
-		heapAddress, heapAddress);
-	
-	DWORD written;
-	if (!WriteFile(output_, (LPCSTR)str, str.GetLength(), &written, NULL) || written != (DWORD)str.GetLength())
-	{
-		dprintf("%s: WriteFile failed %d (written %d)\n", __FUNCTION__, GetLastError(), written);
-		CloseHandle(output_);
-		output_ = INVALID_HANDLE_VALUE;
-	}
+		heapAddress, heapAddress));
 }
 
 void UmdhProcessor::FinishHeap(ULONG64 heapAddress)
 {
-	if (output_ == INVALID_HANDLE_VALUE)
+	if (grouped_ || !output_.IsOpen())
 	{
 		return;
 	}
-	CString str;
-	str.Format("\r\n"
+	output_.Append(FormatString("\r\n"
 		"*- - - - - - - - - - End of data for heap @ %I64X - - - - - - - - - -\r\n"
-		"\r\n", heapAddress);
+		"\r\n", heapAddress));
+	processed_.clear();
+}
 
-	DWORD written;
-	if (!WriteFile(output_, (LPCSTR)str, str.GetLength(), &written, NULL) || written != (DWORD)str.GetLength())
+void UmdhProcessor::RegisterBatch(const HeapRecord *records, size_t count)
+{
+	if (!output_.IsOpen())
 	{
-		dprintf("%s: WriteFile failed %d (written %d)\n", __FUNCTION__, GetLastError(), written);
-		CloseHandle(output_);
-		output_ = INVALID_HANDLE_VALUE;
+		return;
+	}
+	if (grouped_)
+	{
+		for (const HeapRecord *itr = records; itr != records + count; ++itr)
+		{
+			ULONG64 backtrace = itr->ustAddress != 0 ? GetStackTraceArrayPtr(itr->ustAddress, isTarget64_) : 0;
+			TraceGroup &group = groups_[backtrace];
+			group.ustAddress = itr->ustAddress;
+			group.count++;
+			group.userSize += itr->userSize;
+			group.overhead += itr->size - itr->userSize;
+		}
+		return;
+	}
+
+	// same as "%I64X bytes + %I64X at %I64X by BackTrace%I64X\r\n" and "\t%I64X\r\n" per frame
+	for (const HeapRecord *itr = records; itr != records + count; ++itr)
+	{
+		ULONG64 backtrace = itr->ustAddress != 0 ? GetStackTraceArrayPtr(itr->ustAddress, isTarget64_) : 0;
+		bool first = itr->ustAddress != 0 && processed_.Find(backtrace) == NULL;
+		if (first)
+		{
+			output_.Append("\r\n");
+		}
+		output_.AppendHex(itr->userSize);
+		output_.Append(" bytes + ");
+		output_.AppendHex(itr->size - itr->userSize);
+		output_.Append(" at ");
+		output_.AppendHex(itr->userAddress);
+		output_.Append(" by BackTrace");
+		output_.AppendHex(backtrace);
+		output_.Append("\r\n");
+		if (first)
+		{
+			WriteFrames(itr->ustAddress);
+			output_.Append("\r\n");
+			processed_[backtrace] = true;
+		}
 	}
-	processed_.clear();
 }
 
-void UmdhProcessor::Register(ULONG64 ustAddress,
-		ULONG64 size, ULONG64 address,
-		ULONG64 userSize, ULONG64 userAddress)
+void UmdhProcessor::WriteFrames(ULONG64 ustAddress)
 {
-	UNREFERENCED_PARAMETER(address);
+	const ULONG64 *frames;
+	ULONG depth = traces_.Get(ustAddress, frames);
+	for (const ULONG64 *frame = frames; frame != frames + depth; frame++)
+	{
+		output_.Append("\t");
+		output_.AppendHex(*frame);
+		output_.Append("\r\n");
+	}
+}
 
-	ULONG64 backtrace = ustAddress != 0 ? GetStackTraceArrayPtr(ustAddress, isTarget64_) : 0;
-	CString str;
-	str.Format("%I64X bytes + %I64X at %I64X by BackTrace%I64X\r\n",
-		userSize, size - userSize, userAddress, backtrace);
-	if (ustAddress != 0 && processed_.find(backtrace) == processed_.end())
+/**
+*	@brief order of trace groups, larger total first, then by backtrace for stable diffs
+*/
+class TraceGroupOrder
+{
+public:
+	template <typename T>
+	bool operator()(const T *lhs, const T *rhs) const
 	{
-		str = "\r\n" + str;
-		std::vector<ULONG64> trace = ::GetStackTrace(ustAddress, isTarget64_, ntGlobalFlag_);
-		for (std::vector<ULONG64>::iterator itr = trace.begin(); itr != trace.end(); itr++)
+		ULONG64 left = lhs->second.userSize + lhs->second.overhead;
+		ULONG64 right = rhs->second.userSize + rhs->second.overhead;
+		if (left != right)
 		{
-			CString line;
-			line.Format("\t%I64X\r\n", *itr);
-			str += line;
+			return left > right;
 		}
-		str += "\r\n";
-		processed_.insert(backtrace);
+		return lhs->first < rhs->first;
 	}
+};
 
-	DWORD written;
-	if (!WriteFile(output_, (LPCSTR)str, str.GetLength(), &written, NULL) || written != (DWORD)str.GetLength())
+void UmdhProcessor::WriteGroups()
+{
+	std::vector<const AddressMap<TraceGroup>::Entry*> groups;
+	groups.reserve(groups_.size());
+	for (AddressMap<TraceGroup>::iterator itr = groups_.begin(); itr != groups_.end(); ++itr)
+	{
+		groups.push_back(&*itr);
+	}
+	std::sort(groups.begin(), groups.end(), TraceGroupOrder());
+
+	output_.Append("\r\n"
+		"*- - - - - - - - - - Start of data for all heaps - - - - - - - - - -\r\n"
+		"\r\n"
+		"REQUESTED bytes + OVERHEAD in COUNT allocations by BackTraceID\r\n"
+		"     STACK\r\n"
+		"\r\n"
+		"*- - - - - - - - - - Hogs - - - - - - - - - -\r\n"
+		"\r\n");
+	for (std::vector<const AddressMap<TraceGroup>::Entry*>::iterator itr = groups.begin(); itr != groups.end(); ++itr)
 	{
-		dprintf("%s: WriteFile failed %d (written %d)\n", __FUNCTION__, GetLastError(), written);
-		CloseHandle(output_);
-		output_ = INVALID_HANDLE_VALUE;
+		const TraceGroup &group = (*itr)->second;
+		output_.AppendHex(group.userSize);
+		output_.Append(" bytes + ");
+		output_.AppendHex(group.overhead);
+		output_.Append(" in ");
+		output_.AppendHex(group.count);
+		output_.Append(" allocations by BackTrace");
+		output_.AppendHex((*itr)->first);
+		output_.Append("\r\n");
+		if (group.ustAddress != 0)
+		{
+			WriteFrames(group.ustAddress);
+		}
+		output_.Append("\r\n");
 	}
+	output_.Append("*- - - - - - - - - - End of data for all heaps - - - - - - - - - -\r\n"
+		"\r\n");
 }
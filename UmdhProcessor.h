@@ -1,15 +1,17 @@
 #pragma once
 
-#include <set>
 #include "IProcessor.h"
+#include "TargetContext.h"
+#include "AsyncFileWriter.h"
+#include "AddressMap.h"
 
 class UmdhProcessor : public IProcessor
 {
 private:
 	/**
-	*	@brief output file handle
+	*	@brief output file
 	*/
-	HANDLE output_;
+	AsyncFileWriter output_;
 
 	/**
 	*	@brief target is x64 or not
@@ -17,14 +19,45 @@ private:
 	const bool isTarget64_;
 
 	/**
-	*	@brief gflag
+	*	@brief decoded stack traces
 	*/
-	const ULONG32 ntGlobalFlag_;
+	TraceStore &traces_;
 
 	/**
 	*	@brief already processed backtrace entries
 	*/
-	std::set<ULONG64> processed_;
+	AddressMap<bool> processed_;
+
+	/**
+	*	@brief allocations of a backtrace over all heaps
+	*/
+	struct TraceGroup
+	{
+		ULONG64 ustAddress;
+		ULONG64 count;
+		ULONG64 userSize;
+		ULONG64 overhead;
+	};
+
+	/**
+	*	@brief aggregate per backtrace instead of writing each entry
+	*/
+	const bool grouped_;
+
+	/**
+	*	@brief backtrace to TraceGroup, used if grouped_
+	*/
+	AddressMap<TraceGroup> groups_;
+
+	/**
+	*	@brief write groups_ in descending order of total bytes
+	*/
+	void WriteGroups();
+
+	/**
+	*	@brief write frames of the trace
+	*/
+	void WriteFrames(ULONG64 ustAddress);
 
 	/**
 	*	@brief operator (disabled)
@@ -40,14 +73,16 @@ private:
 public:
 	/**
 	*	@brief constructor
+	*	@param context [in] target information
 	*	@param filename [in] output file path
+	*	@param grouped [in] write each backtrace once with count and total over all heaps
 	*	@note opens output file and write header
 	*/
-	UmdhProcessor(PCSTR filename);
+	UmdhProcessor(TargetContext &context, PCSTR filename, bool grouped = false);
 
 	/**
 	*	@brief destractor
-	*	@note closes output file
+	*	@note writes groups if grouped and closes output file
 	*/
 	~UmdhProcessor();
 
@@ -57,11 +92,9 @@ public:
 	void StartHeap(ULONG64 heapAddress);
 
 	/**
-	*	@copydoc IProcessor::Register()
+	*	@copydoc IProcessor::RegisterBatch()
 	*/
-	void Register(ULONG64 ustAddress,
-		ULONG64 size, ULONG64 address,
-		ULONG64 userSize, ULONG64 userAddress);
+	void RegisterBatch(const HeapRecord *records, size_t count);
 
 	/**
 	*	@copydoc IProcessor::FinishHeap()
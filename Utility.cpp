@@ -1,5 +1,36 @@
 #include "common.h"
 #include "Utility.h"
+#include "TypeLayout.h"
+#include <stdarg.h>
+
+#ifndef HEAPSTAT_OFFLINE
+#include <dbgeng.h>
+#endif
+
+Settings &GetSettings()
+{
+	static Settings settings = {
+#ifdef HEAPSTAT_OFFLINE
+		false, // cacheEnabled, the mapped dump is faster than the cache
+#else
+		true, // cacheEnabled
+#endif
+		PAGE_SIZE, // cachePageSize
+		0x4000, // cacheMaxPages
+		true, // bulkRead
+		0x100000, // bulkChunkSize
+		false, // sweepTraces
+		"ntdll,verifier,msvcr,ucrtbase,vcruntime", // skipModules
+#ifdef HEAPSTAT_OFFLINE
+		0, // walkThreads, the mapped dump can be read by threads
+		true, // pipeline
+#else
+		1, // walkThreads, the debugger engine is not called by threads
+		false, // pipeline
+#endif
+	};
+	return settings;
+}
 
 bool IsTarget64()
 {
@@ -25,32 +56,32 @@ ULONG64 GetPebAddress()
 		if (!READMEMORY(teb, teb32))
 		{
 			dprintf("read TEB32 at %p failed\n", teb);
-			return NULL;
+			return 0;
 		}
 
 		ULONG32 peb32; // _TEB::ProcessEnvironmentBlock
 		if (!READMEMORY(teb32 + 0x30, peb32))
 		{
 			dprintf("read PEB32 at %p failed\n", teb32 + 0x30);
-			return NULL;
+			return 0;
 		}
 		return peb32;
 	}
 	else
 	{
 		ULONG64 address;
-		GetPebAddress(NULL, &address);
+		GetPebAddress(0, &address);
 		return address;
 	}
 }
 
-ULONG32 GetNtGlobalFlag()
+ULONG32 GetNtGlobalFlag(TypeLayout &layout)
 {
 	ULONG32 ntGlobalFlag;
 	ULONG64 address = GetPebAddress();
 	if (IsTarget64())
 	{
-		if (GetFieldValue(address, "ntdll!_PEB", "NtGlobalFlag", ntGlobalFlag) != 0)
+		if (!layout.ReadField(address, TypeLayout::PEB_NtGlobalFlag, ntGlobalFlag))
 		{
 			dprintf("read NtGlobalFlag failed\n");
 			return 0;
@@ -68,18 +99,18 @@ ULONG32 GetNtGlobalFlag()
 	return ntGlobalFlag;
 }
 
-ULONG64 GetOSVersion()
+ULONG64 GetOSVersion(TypeLayout &layout)
 {
 	ULONG32 osMajorVersion, osMinorVersion;
 	ULONG64 address =  GetPebAddress();
 	if (IsTarget64())
 	{
-		if (GetFieldValue(address, "ntdll!_PEB", "OSMajorVersion", osMajorVersion) != 0)
+		if (!layout.ReadField(address, TypeLayout::PEB_OSMajorVersion, osMajorVersion))
 		{
 			dprintf("read OSMajorVersion failed\n");
 			return 0;
 		}
-		if (GetFieldValue(address, "ntdll!_PEB", "OSMinorVersion", osMinorVersion) != 0)
+		if (!layout.ReadField(address, TypeLayout::PEB_OSMinorVersion, osMinorVersion))
 		{
 			dprintf("read OSMinorVersion failed\n");
 			return 0;
@@ -114,69 +145,7 @@ ULONG64 GetStackTraceArrayPtr(ULONG64 ustAddress, bool isTarget64)
 	}
 }
 
-std::vector<ULONG64> GetStackTrace(ULONG64 ustAddress, bool isTarget64, ULONG32 ntGlobalFlag)
-{
-	std::vector<ULONG64> trace;
-
-	ULONG cb;
-	USHORT depth;
-	ULONG64 offset;
-
-	if (ntGlobalFlag & NT_GLOBAL_FLAG_HPA)
-	{
-		//dprintf("hpa enabled\n");
-		offset = isTarget64 ? 0xe : 0xa;
-	}
-	else if (ntGlobalFlag & NT_GLOBAL_FLAG_UST)
-	{
-		//dprintf("ust enabled\n");
-		offset = isTarget64 ? 0xc : 0x8;
-	}
-	else
-	{
-		dprintf("please set ust or hpa by gflags.exe\n");
-		return trace;
-	}
-
-	if (!READMEMORY(ustAddress + offset, depth))
-	{
-		dprintf("read depth failed at %p + %p\n", ustAddress, offset);
-		return trace;
-	}
-
-	ULONG64 address = GetStackTraceArrayPtr(ustAddress, isTarget64);
-	if (isTarget64)
-	{
-		for (int i = 0; i < depth; i++)
-		{
-			ULONG64 sp;
-			if (!READMEMORY(address, sp))
-			{
-				dprintf("read sp failed\n");
-				return trace;
-			}
-			trace.push_back(sp);
-			address += sizeof(sp);
-		}
-	}
-	else
-	{
-		for (int i = 0; i < depth; i++)
-		{
-			ULONG32 sp;
-			if (!READMEMORY(address, sp))
-			{
-				dprintf("read sp failed\n");
-				return trace;
-			}
-			trace.push_back((ULONG64)sp);
-			address += sizeof(sp);
-		}
-	}
-	return trace;
-}
-
-std::vector<ModuleInfo> GetLoadedModules()
+std::vector<ModuleInfo> GetLoadedModules(TypeLayout &layout)
 {
 	std::vector<ModuleInfo> info;
 	ULONG cb;
@@ -184,21 +153,21 @@ std::vector<ModuleInfo> GetLoadedModules()
 	if (IsTarget64())
 	{
 		ULONG64 ldr;
-		if (GetFieldValue(pebAddress, "ntdll!_PEB", "Ldr", ldr) != 0)
+		if (!layout.ReadField(pebAddress, TypeLayout::PEB_Ldr, ldr))
 		{
 			dprintf("read Ldr failed\n");
 			goto ERROR_EXIT;
 		}
 
 		ULONG offset;
-		if (GetFieldOffset("ntdll!_PEB_LDR_DATA", "InMemoryOrderModuleList", &offset) != 0)
+		if (!layout.GetOffset(TypeLayout::PEB_LDR_DATA_InMemoryOrderModuleList, offset))
 		{
 			dprintf("GetFieldOffset(_PEB_LDR_DATA::InMemoryOrderModuleList) failed\n");
 			goto ERROR_EXIT;
 		}
 		ULONG64 headAddress = ldr + offset;
 		LIST_ENTRY64 inMemoryOrderModuleList;
-		if (GetFieldValue(ldr, "ntdll!_PEB_LDR_DATA", "InMemoryOrderModuleList", inMemoryOrderModuleList) != 0)
+		if (!READMEMORY(headAddress, inMemoryOrderModuleList))
 		{
 			dprintf("read InMemoryOrderModuleList failed\n");
 			goto ERROR_EXIT;
@@ -216,14 +185,21 @@ std::vector<ModuleInfo> GetLoadedModules()
 			}
 
 			// LDR_DATA_TABLE_ENTRY at address - sizeof(entry)
-			ULONG64 dllBase, sizeOfImage;
-			if (GetFieldValue(address - sizeof(entry), "ntdll!_LDR_DATA_TABLE_ENTRY", "DllBase", dllBase) != 0)
+			std::vector<UCHAR> raw;
+			if (!layout.ReadStruct(address - sizeof(entry), TypeLayout::LDR_DATA_TABLE_ENTRY, raw))
+			{
+				dprintf("read LDR_DATA_TABLE_ENTRY around %p failed\n", address - sizeof(entry));
+				goto ERROR_EXIT;
+			}
+			ULONG64 dllBase;
+			ULONG32 sizeOfImage;
+			if (!layout.GetField(raw, TypeLayout::LDR_DATA_TABLE_ENTRY_DllBase, dllBase))
 			{
 				dprintf("read DllBase around %p failed\n", address - sizeof(entry));
 				goto ERROR_EXIT;
 			}
 			moduleInfo.DllBase = dllBase;
-			if (GetFieldValue(address - sizeof(entry), "ntdll!_LDR_DATA_TABLE_ENTRY", "SizeOfImage", sizeOfImage) != 0)
+			if (!layout.GetField(raw, TypeLayout::LDR_DATA_TABLE_ENTRY_SizeOfImage, sizeOfImage))
 			{
 				dprintf("read SizeOfImage around %p failed\n", address - sizeof(entry));
 				goto ERROR_EXIT;
@@ -237,20 +213,20 @@ std::vector<ModuleInfo> GetLoadedModules()
 				USHORT MaximumLength;
 				ULONG64 Buffer;
 			} fullDllName;
-			if (GetFieldValue(address - sizeof(entry), "ntdll!_LDR_DATA_TABLE_ENTRY", "FullDllName", fullDllName) != 0)
+			if (!layout.GetField(raw, TypeLayout::LDR_DATA_TABLE_ENTRY_FullDllName, fullDllName))
 			{
 				dprintf("read FullDllName around %p failed\n", address - sizeof(entry));
 				goto ERROR_EXIT;
 			}
-			std::vector<wchar_t> unicode;
-			unicode.resize(fullDllName.Length / sizeof(wchar_t));
-			if (!ReadMemory(fullDllName.Buffer, &unicode[0], fullDllName.Length, &cb) || cb != fullDllName.Length)
+			std::vector<WCHAR> unicode;
+			unicode.resize(fullDllName.Length / sizeof(WCHAR));
+			if (!ReadTargetMemory(fullDllName.Buffer, &unicode[0], fullDllName.Length, &cb) || cb != fullDllName.Length)
 			{
 				dprintf("read unicode at %p %d failed\n", fullDllName.Buffer, (int)fullDllName.Length);
 				goto ERROR_EXIT;
 			}
 		
-			int written = WideCharToMultiByte(CP_ACP, 0, &unicode[0], fullDllName.Length / sizeof(wchar_t),
+			int written = WideCharToMultiByte(CP_ACP, 0, &unicode[0], fullDllName.Length / sizeof(WCHAR),
 				moduleInfo.FullDllName, sizeof(moduleInfo.FullDllName), NULL, NULL);
 			if (written < 0 || written >= sizeof(moduleInfo.FullDllName))
 			{
@@ -317,15 +293,15 @@ std::vector<ModuleInfo> GetLoadedModules()
 				dprintf("read FullDllName at %p failed\n", address - sizeof(entry) + 0x24);
 				goto ERROR_EXIT;
 			}
-			std::vector<wchar_t> unicode;
-			unicode.resize(fullDllName.Length / sizeof(wchar_t));
-			if (!ReadMemory(fullDllName.Buffer, &unicode[0], fullDllName.Length, &cb) || cb != fullDllName.Length)
+			std::vector<WCHAR> unicode;
+			unicode.resize(fullDllName.Length / sizeof(WCHAR));
+			if (!ReadTargetMemory(fullDllName.Buffer, &unicode[0], fullDllName.Length, &cb) || cb != fullDllName.Length)
 			{
 				dprintf("read unicode at %p %d failed\n", (ULONG64)fullDllName.Buffer, (int)fullDllName.Length);
 				goto ERROR_EXIT;
 			}
 		
-			int written = WideCharToMultiByte(CP_ACP, 0, &unicode[0], fullDllName.Length / sizeof(wchar_t),
+			int written = WideCharToMultiByte(CP_ACP, 0, &unicode[0], fullDllName.Length / sizeof(WCHAR),
 				moduleInfo.FullDllName, sizeof(moduleInfo.FullDllName), NULL, NULL);
 			if (written < 0 || written >= sizeof(moduleInfo.FullDllName))
 			{
@@ -343,15 +319,14 @@ ERROR_EXIT:
 	return info;
 }
 
-std::string GetNtDllName()
+std::string GetNtDllName(const std::vector<ModuleInfo> &modules)
 {
 	if (!IsTarget64() && IsPtr64())
 	{
 		// WOW64
-		std::vector<ModuleInfo> modules = GetLoadedModules();
-		for (std::vector<ModuleInfo>::iterator itr = modules.begin(); itr != modules.end(); ++itr)
+		for (std::vector<ModuleInfo>::const_iterator itr = modules.begin(); itr != modules.end(); ++itr)
 		{
-			CHAR *ptr = strrchr(itr->FullDllName, '\\');
+			const CHAR *ptr = strrchr(itr->FullDllName, '\\');
 			if (ptr != NULL && strcmp(ptr + 1, "ntdll.dll") == 0)
 			{
 				CHAR name[] = "ntdll_01234567";
@@ -361,4 +336,110 @@ std::string GetNtDllName()
 		}
 	}
 	return "ntdll";
-}
\ No newline at end of file
+}
+
+std::string FormatString(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int length = _vscprintf(format, args);
+	va_end(args);
+	if (length <= 0)
+	{
+		return std::string();
+	}
+	std::vector<char> buffer(length + 1);
+	va_start(args, format);
+	_vsnprintf_s(&buffer[0], buffer.size(), _TRUNCATE, format, args);
+	va_end(args);
+	return std::string(&buffer[0], length);
+}
+
+#ifndef HEAPSTAT_OFFLINE
+HRESULT CreateDebugInterface(REFIID iid, PVOID *object)
+{
+	typedef HRESULT (STDAPICALLTYPE *DebugCreateFunc)(REFIID, PVOID *);
+	HMODULE dbgeng = GetModuleHandleA("dbgeng.dll");
+	DebugCreateFunc debugCreate = dbgeng != NULL ? (DebugCreateFunc)GetProcAddress(dbgeng, "DebugCreate") : NULL;
+	if (debugCreate == NULL)
+	{
+		return E_NOINTERFACE;
+	}
+	return debugCreate(iid, object);
+}
+
+ULONG GetFieldOffsetAndSize(PCSTR type, PCSTR field, PULONG offset, PULONG size)
+{
+	// GetFieldOffset in wdbgexts.h, keeping the size filled in FIELD_INFO
+	FIELD_INFO fieldInfo = { (PUCHAR)field, (PUCHAR)"", 0, DBG_DUMP_FIELD_FULL_NAME | DBG_DUMP_FIELD_RETURN_ADDRESS, 0, NULL };
+	SYM_DUMP_PARAM symbol = { sizeof(SYM_DUMP_PARAM), (PUCHAR)type, DBG_DUMP_NO_PRINT, 0, NULL, NULL, NULL, 1, &fieldInfo };
+	ULONG result = Ioctl(IG_DUMP_SYMBOL_INFO, &symbol, symbol.size);
+	*offset = (ULONG)(fieldInfo.address - symbol.addr);
+	*size = fieldInfo.size;
+	return result;
+}
+
+BOOL GetSymbolRanges(PCSTR key, std::vector<AddressRange> &ranges)
+{
+	IDebugSymbols3 *symbols = NULL;
+	if (FAILED(CreateDebugInterface(__uuidof(IDebugSymbols3), (PVOID *)&symbols)))
+	{
+		return FALSE;
+	}
+
+	BOOL result = TRUE;
+	if (strchr(key, '!') == NULL)
+	{
+		// extents of modules
+		ULONG loaded, unloaded;
+		if (FAILED(symbols->GetNumberModules(&loaded, &unloaded)))
+		{
+			result = FALSE;
+		}
+		for (ULONG i = 0; result && i < loaded; i++)
+		{
+			CHAR name[MAX_PATH];
+			DEBUG_MODULE_PARAMETERS params;
+			if (FAILED(symbols->GetModuleNameString(DEBUG_MODNAME_MODULE, i, 0, name, sizeof(name), NULL)) ||
+				FAILED(symbols->GetModuleParameters(1, NULL, i, &params)))
+			{
+				result = FALSE;
+			}
+			else if (strncmp(name, key, strlen(key)) == 0)
+			{
+				AddressRange range = { params.Base, params.Base + params.Size };
+				ranges.push_back(range);
+			}
+		}
+		symbols->Release();
+		return result;
+	}
+
+	std::string pattern = std::string(key) + "*";
+	ULONG64 handle;
+	if (FAILED(symbols->StartSymbolMatch(pattern.c_str(), &handle)))
+	{
+		symbols->Release();
+		return FALSE;
+	}
+	ULONG64 offset;
+	while (SUCCEEDED(symbols->GetNextSymbolMatch(handle, NULL, 0, NULL, &offset)))
+	{
+		DEBUG_MODULE_AND_ID id;
+		ULONG entries = 0;
+		DEBUG_SYMBOL_ENTRY entry;
+		if (FAILED(symbols->GetSymbolEntriesByOffset(offset, 0, &id, NULL, 1, &entries)) || entries == 0 ||
+			FAILED(symbols->GetSymbolEntryInformation(&id, &entry)) || entry.Size == 0)
+		{
+			// size unknown (e.g. export symbols)
+			result = FALSE;
+			break;
+		}
+		AddressRange range = { offset, offset + entry.Size };
+		ranges.push_back(range);
+	}
+	symbols->EndSymbolMatch(handle);
+	symbols->Release();
+	return result;
+}
+#endif
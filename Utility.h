@@ -5,13 +5,36 @@
 #pragma once
 #include <vector>
 #include <string>
+#include "MemoryCache.h"
 
 #define NT_GLOBAL_FLAG_UST 0x00001000 // user mode stack trace database enabled
 #define NT_GLOBAL_FLAG_HPA 0x02000000 // page heap enabled
 
 #define PAGE_SIZE 0x1000
 
-#define READMEMORY(address, var) (ReadMemory(address, &var, sizeof(var), &cb) && cb == sizeof(var))
+#define READMEMORY(address, var) (ReadTargetMemory(address, &var, sizeof(var), &cb) && cb == sizeof(var))
+#define READREGION(reader, address, var) ((reader).Read(address, &var, sizeof(var), &cb) && cb == sizeof(var))
+
+/**
+*	@brief settings shared by extension commands, changed by !config
+*/
+struct Settings
+{
+	bool cacheEnabled; // read target memory through MemoryCache
+	ULONG cachePageSize; // bytes of a cache page
+	ULONG cacheMaxPages; // maximum number of cached pages
+	bool bulkRead; // read committed span of heap segments and LFH user blocks by RegionReader
+	ULONG bulkChunkSize; // bytes read at once by RegionReader
+	bool sweepTraces; // decode whole ust database by sequential reads before walking heaps
+	std::string skipModules; // comma separated prefixes of modules skipped to find the caller
+	ULONG walkThreads; // threads walking heaps (offline build only), 0 for the number of processors
+	bool pipeline; // process heap entries on another thread while walking (offline build only)
+};
+
+/**
+*	@brief get settings of this debugger session
+*/
+Settings &GetSettings();
 
 /**
 *	@brief is target process 64 bit or not (32 bit)
@@ -25,10 +48,13 @@ bool IsTarget64();
 */
 ULONG64 GetPebAddress();
 
+class TypeLayout;
+
 /**
 *	@brief get NtGlobalFlag from PEB
+*	@param layout [in] ntdll types of the target, used for 64 bit target
 */
-ULONG32 GetNtGlobalFlag();
+ULONG32 GetNtGlobalFlag(TypeLayout &layout);
 
 #define OS_VERSION_WIN7 (((ULONG64)6 << 32) | 1)
 #define OS_VERSION_WIN8 (((ULONG64)6 << 32) | 2)
@@ -36,20 +62,16 @@ ULONG32 GetNtGlobalFlag();
 
 /**
 *	@brief get OSMajorVersion and OSMinorVersion
+*	@param layout [in] ntdll types of the target, used for 64 bit target
 *	@return ((OSMajorVersion << 32) | OSMinorVersion)
 */
-ULONG64 GetOSVersion();
+ULONG64 GetOSVersion(TypeLayout &layout);
 
 /**
 *	@brief get pointer to stack trace array
 */
 ULONG64 GetStackTraceArrayPtr(ULONG64 ustAddress, bool isTarget64);
 
-/**
-*	@brief get stack trace from user mode stack trace database
-*/
-std::vector<ULONG64> GetStackTrace(ULONG64 ustAddress, bool isTarget64, ULONG32 ntGlobalFlag);
-
 /**
 *	@brief module information from LDR_DATA_TABLE_ENTRY
 */
@@ -62,10 +84,50 @@ struct ModuleInfo
 
 /**
 *	@brief get information of loaded modules in PEB::InMemoryOrderModuleList
+*	@param layout [in] ntdll types of the target, used for 64 bit target
 */
-std::vector<ModuleInfo> GetLoadedModules();
+std::vector<ModuleInfo> GetLoadedModules(TypeLayout &layout);
 
 /**
 *	@brief get ntdll module name
+*	@param modules [in] loaded modules given by GetLoadedModules
+*/
+std::string GetNtDllName(const std::vector<ModuleInfo> &modules);
+
+/**
+*	@brief format like printf
+*	@note same format as dprintf except %p and %ly
 */
-std::string GetNtDllName();
\ No newline at end of file
+std::string FormatString(const char *format, ...);
+
+/**
+*	@brief get offset and size of a field like GetFieldOffset
+*	@param size [out] size of the field in bytes
+*	@return 0 if succeeded
+*/
+ULONG GetFieldOffsetAndSize(PCSTR type, PCSTR field, PULONG offset, PULONG size);
+
+/**
+*	@brief address range [start, end)
+*/
+struct AddressRange
+{
+	ULONG64 start;
+	ULONG64 end;
+};
+
+/**
+*	@brief get address ranges of symbols which "module!symbol" starts with the key
+*	@param key [in] "module!symbol" prefix, a key without '!' matches extents of modules
+*	@param ranges [out] ranges of matched functions or modules
+*	@retval FALSE sizes of symbols are not available, match frames by names instead
+*/
+BOOL GetSymbolRanges(PCSTR key, std::vector<AddressRange> &ranges);
+
+#ifndef HEAPSTAT_OFFLINE
+/**
+*	@brief create an interface of the debugger engine
+*	@note dbgeng.dll is loaded by the debugger, so no import library is needed
+*/
+HRESULT CreateDebugInterface(REFIID iid, PVOID *object);
+#endif
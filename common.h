@@ -1,4 +1,8 @@
+#ifdef HEAPSTAT_OFFLINE
+#include "OfflineApi.h"
+#else
 #include <windows.h>
 
 #define KDEXT_64BIT
 #include <wdbgexts.h>
+#endif
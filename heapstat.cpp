@@ -3,6 +3,16 @@
 #include "SummaryProcessor.h"
 #include "BySizeProcessor.h"
 #include "UmdhProcessor.h"
+#include "CompositeProcessor.h"
+#include "HeapSnapshot.h"
+#include "TrendAnalyzer.h"
+#include "TargetContext.h"
+#include "ReportOptions.h"
+#include "TaskPool.h"
+#include "PipelineProcessor.h"
+#include "EntryScan.h"
+#include "RecordSort.h"
+#include "FragmentationProcessor.h"
 #include <list>
 #include <string>
 
@@ -69,26 +79,16 @@ typedef struct {
 	ULONG64 largestEntry;
 } UstRecord;
 
-// representation of heap entry
-typedef struct _HeapRecord {
-	ULONG64 ustAddress;
-	ULONG64 size;
-	ULONG64 address;
-	ULONG64 userSize;
-	ULONG64 userAddress;
-	bool operator< (const struct _HeapRecord& rhs) const
-	{
-		return address < rhs.address;
-	}
-} HeapRecord;
-
 // common parameter
 typedef struct {
 	ULONG32 ntGlobalFlag;
 	ULONG64 osVersion;
 	BOOL verbose;
 	bool isTarget64;
-	std::string ntdllName;
+	TypeLayout *layout; // ntdll types for 64 bit target
+	FragmentationProcessor *fragmentation; // NULL unless free entries are reported
+	bool hasLFHKey; // lfhKey is resolved (Windows 8.1 or later)
+	ULONG32 lfhKey; // ntdll!RtlpLFHKey
 } CommonParams;
 
 #define DPRINTF(...) do { if (params.verbose) { dprintf(__VA_ARGS__); } } while (0)
@@ -158,110 +158,48 @@ static BOOL WalkBalancedLinks(ULONG64 address,
 	return TRUE;
 }
 
-static BOOL DecodeHeapEntry(HeapEntry *entry, const HeapEntry *encoding)
+/**
+*	@brief xor of the four bytes in the low dword, zero if SmallTagIndex matches the first three bytes
+*/
+static ULONG32 GetEntryChecksum(ULONG64 header)
 {
-	UCHAR *entry_ = (UCHAR*)entry;
-	const UCHAR *encoding_ = (const UCHAR *)encoding;
-	for (int i = 0; i < sizeof(HeapEntry); i++)
-	{
-		entry_[i] ^= encoding_[i];
-	}
-	return (entry_[0] ^ entry_[1] ^ entry_[2] ^ entry_[3]) == 0x00;
+	ULONG32 check = (ULONG32)header;
+	check ^= check >> 16;
+	check ^= check >> 8;
+	return check & 0xff;
 }
 
-static BOOL DecodeHeap64Entry(Heap64Entry *entry, const Heap64Entry *encoding)
+static BOOL DecodeHeapEntry(HeapEntry *entry, const HeapEntry *encoding)
 {
-	UCHAR *entry_ = (UCHAR*)entry;
-	const UCHAR *encoding_ = (const UCHAR *)encoding;
-	for (int i = 0; i < sizeof(Heap64Entry); i++)
-	{
-		entry_[i] ^= encoding_[i];
-	}
-	return (entry_[0x8] ^ entry_[0x9] ^ entry_[0xa] ^ entry_[0xb]) == 0x00;
+	// xor the header as a qword instead of byte by byte
+	ULONG64 header, key;
+	memcpy(&header, entry, sizeof(header));
+	memcpy(&key, encoding, sizeof(key));
+	header ^= key;
+	memcpy(entry, &header, sizeof(header));
+	return GetEntryChecksum(header) == 0x00;
 }
 
-static ULONG64 GetHeapAddress(ULONG index)
+static BOOL DecodeHeap64Entry(Heap64Entry *entry, const Heap64Entry *encoding)
 {
-	const bool isTarget64 = IsTarget64();
-
-	ULONG64 address = GetPebAddress();
-
-	ULONG cb;
-	ULONG32 numberOfHeaps;
-
-	if (isTarget64)
-	{
-		if (GetFieldValue(address, "ntdll!_PEB", "NumberOfHeaps", numberOfHeaps) != 0)
-		{
-			dprintf("read NumberOfHeaps failed\n");
-			return 0;
-		}
-	}
-	else
-	{
-		if (!READMEMORY(address + 0x88, numberOfHeaps))
-		{
-			dprintf("read NumberOfHeaps failed\n");
-			return 0;
-		}
-	}
-
-	if (index >= numberOfHeaps)
-	{
-		return 0;
-	}
-
-	ULONG64 processHeaps;
-	if (isTarget64)
-	{
-		if (GetFieldValue(address, "ntdll!_PEB", "ProcessHeaps", processHeaps) != 0)
-		{
-			dprintf("read ProcessHeaps failed\n");
-			return 0;
-		}
-	}
-	else
-	{
-		ULONG32 value;
-		if (!READMEMORY(address + 0x90, value))
-		{
-			dprintf("read ProcessHeaps failed\n");
-			return 0;
-		}
-		processHeaps = value;
-	}
-
-	ULONG64 heap;
-	if (isTarget64)
-	{
-		if (!READMEMORY((ULONG64)processHeaps + 8 * index, heap))
-		{
-			dprintf("read heap address failed\n");
-			return 0;
-		}
-	}
-	else
-	{
-		ULONG32 value;
-		if (!READMEMORY((ULONG64)processHeaps + 4 * index, value))
-		{
-			dprintf("read heap address failed\n");
-			return 0;
-		}
-		heap = value;
-	}
-
-	return heap;
+	// PreviousBlockPrivateData is xored too, the checksum is in the second qword
+	ULONG64 header[2], key[2];
+	memcpy(header, entry, sizeof(header));
+	memcpy(key, encoding, sizeof(key));
+	header[0] ^= key[0];
+	header[1] ^= key[1];
+	memcpy(entry, header, sizeof(header));
+	return GetEntryChecksum(header[1]) == 0x00;
 }
 
-static BOOL ParseHeapRecord32(ULONG64 address, const HeapEntry &entry, ULONG32 ntGlobalFlag, HeapRecord &record)
+static BOOL ParseHeapRecord32(ULONG64 address, const HeapEntry &entry, ULONG32 ntGlobalFlag, RegionReader &reader, HeapRecord &record)
 {
 	const ULONG blockUnit = 8;
 	ULONG cb;
 	if (ntGlobalFlag & NT_GLOBAL_FLAG_UST)
 	{
 		ULONG32 ustAddress;
-		if (!READMEMORY(address + sizeof(entry), ustAddress))
+		if (!READREGION(reader, address + sizeof(entry), ustAddress))
 		{
 			dprintf("read ustAddress at %p failed\n", address + sizeof(entry));
 			return FALSE;
@@ -270,7 +208,7 @@ static BOOL ParseHeapRecord32(ULONG64 address, const HeapEntry &entry, ULONG32 n
 		{
 			record.ustAddress = ustAddress;
 			USHORT extra;
-			if (READMEMORY(address + sizeof(entry) + 0xc, extra))
+			if (READREGION(reader, address + sizeof(entry) + 0xc, extra))
 			{
 				if (extra < sizeof(entry) + 0x10)
 				{
@@ -311,14 +249,14 @@ static BOOL ParseHeapRecord32(ULONG64 address, const HeapEntry &entry, ULONG32 n
 	return TRUE;
 }
 
-static BOOL ParseHeapRecord64(ULONG64 address, const Heap64Entry &entry, ULONG32 ntGlobalFlag, HeapRecord &record)
+static BOOL ParseHeapRecord64(ULONG64 address, const Heap64Entry &entry, ULONG32 ntGlobalFlag, RegionReader &reader, HeapRecord &record)
 {
 	const ULONG blockUnit = 16;
 	ULONG cb;
 	if (ntGlobalFlag & NT_GLOBAL_FLAG_UST)
 	{
 		ULONG64 ustAddress;
-		if (!READMEMORY(address + sizeof(entry), ustAddress))
+		if (!READREGION(reader, address + sizeof(entry), ustAddress))
 		{
 			dprintf("read ustAddress at %p failed\n", address + sizeof(entry));
 			return FALSE;
@@ -327,7 +265,7 @@ static BOOL ParseHeapRecord64(ULONG64 address, const Heap64Entry &entry, ULONG32
 		{
 			record.ustAddress = ustAddress;
 			USHORT extra;
-			if (READMEMORY(address + sizeof(entry) + 0x1c, extra))
+			if (READREGION(reader, address + sizeof(entry) + 0x1c, extra))
 			{
 				if (extra + sizeof(entry.PreviousBlockPrivateData) < sizeof(entry) + 0x20)
 				{
@@ -368,7 +306,81 @@ static BOOL ParseHeapRecord64(ULONG64 address, const Heap64Entry &entry, ULONG32
 	return TRUE;
 }
 
-static BOOL AnalyzeLFHZone32(ULONG64 lfh, ULONG64 zone, const CommonParams &params, std::set<HeapRecord> &lfhRecords)
+/**
+*	@brief UserBlocks larger than this are not read in bulk
+*	@note BlockCount and block size come from the target, a corrupt subsegment or a wrong LFH key
+*	      gives up to 4GB, real ones are much smaller
+*/
+static const ULONG64 MAX_SUBSEGMENT_SPAN = 0x1000000;
+
+/**
+*	@brief subsegments read at once even if the busy bitmap is known, if at least one block in this many is busy
+*/
+static const ULONG DENSE_SUBSEGMENT_RATIO = 4;
+
+/**
+*	@brief read _HEAP_USERDATA_HEADER::BusyBitmap of a subsegment
+*	@param bitmap [in] address of the RTL_BITMAP
+*	@param pointerSize [in] size of pointers in the target, RTL_BITMAP::Buffer follows SizeOfBitMap aligned to it
+*	@param busyMask [out] (blockCount + 31) / 32 words, bit (i % 32) of busyMask[i / 32] is set if block i is busy
+*	@retval FALSE the bitmap is not readable or does not cover all blocks
+*/
+static BOOL ReadBusyBitmap(ULONG64 bitmap, ULONG pointerSize, USHORT blockCount, std::vector<ULONG> &busyMask)
+{
+	ULONG cb;
+	ULONG sizeOfBitMap; // RTL_BITMAP::SizeOfBitMap
+	if (blockCount == 0 || !READMEMORY(bitmap, sizeOfBitMap) || sizeOfBitMap < blockCount)
+	{
+		return FALSE;
+	}
+	ULONG64 buffer = 0; // RTL_BITMAP::Buffer
+	if (!ReadTargetMemory(bitmap + pointerSize, &buffer, pointerSize, &cb) || cb != pointerSize || buffer == 0)
+	{
+		return FALSE;
+	}
+	busyMask.resize((blockCount + 31) / 32);
+	const ULONG size = (ULONG)(busyMask.size() * sizeof(ULONG));
+	if (!ReadTargetMemory(buffer, &busyMask[0], size, &cb) || cb != size)
+	{
+		busyMask.clear();
+		return FALSE;
+	}
+	if (blockCount % 32 != 0)
+	{
+		busyMask.back() &= (1U << (blockCount % 32)) - 1;
+	}
+	return TRUE;
+}
+
+/**
+*	@brief set bits of all blocks, so that every header is read and classified
+*/
+static void MarkAllBlocks(USHORT blockCount, std::vector<ULONG> &busyMask)
+{
+	busyMask.assign((blockCount + 31) / 32, 0xffffffff);
+	if (blockCount % 32 != 0)
+	{
+		busyMask.back() = (1U << (blockCount % 32)) - 1;
+	}
+}
+
+/**
+*	@brief true if reading all blocks at once is cheaper than reading busy ones one by one
+*/
+static bool IsDenseSubsegment(const std::vector<ULONG> &busyMask, USHORT blockCount)
+{
+	ULONG busyCount = 0;
+	for (size_t i = 0; i < busyMask.size(); i++)
+	{
+		for (ULONG bits = busyMask[i]; bits != 0; bits &= bits - 1)
+		{
+			busyCount++;
+		}
+	}
+	return busyCount * DENSE_SUBSEGMENT_RATIO >= blockCount;
+}
+
+static BOOL AnalyzeLFHZone32(ULONG64 lfh, ULONG64 zone, const CommonParams &params, std::vector<HeapRecord> &lfhRecords)
 {
 	DPRINTF("_LFH_BLOCK_ZONE %p\n", zone);
 	ULONG cb;
@@ -439,15 +451,12 @@ static BOOL AnalyzeLFHZone32(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 					return FALSE;
 				}
 
-				ULONG32 lfhKey;
+				// failure to resolve the key is printed by AnalyzeHeap
+				if (!params.hasLFHKey)
 				{
-					ULONG32 pLFHKey = (ULONG32)GetExpression((params.ntdllName + "!RtlpLFHKey").c_str());
-					if (!READMEMORY(pLFHKey, lfhKey))
-					{
-						dprintf("read LFHKey failed\n");
-						return FALSE;
-					}
+					return FALSE;
 				}
+				const ULONG32 lfhKey = params.lfhKey;
 
 				// decode
 				encodedOffsets ^= userBlocks ^ lfh ^ lfhKey;
@@ -472,42 +481,74 @@ static BOOL AnalyzeLFHZone32(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 				address = userBlocks + 0x10; // sizeof(_LFH_BLOCK_ZONE);
 				blockStride = blockSize * blockUnit;
 			}
-			for (USHORT i = 0; i < blockCount; i++)
+			// busy blocks from the bitmap of the subsegment, if the header has it
+			std::vector<ULONG> busyMask;
+			const bool hasBitmap = params.osVersion >= OS_VERSION_WIN8 &&
+				ReadBusyBitmap(userBlocks + 0x14, sizeof(ULONG32), blockCount, busyMask); // _HEAP_USERDATA_HEADER::BusyBitmap
+
+			// read all blocks of the subsegment at once, unless the bitmap tells only a few of them are busy
+			const ULONG64 span = (ULONG64)blockCount * blockStride;
+			const Settings &settings = GetSettings();
+			const bool bulkRead = settings.bulkRead && span <= MAX_SUBSEGMENT_SPAN &&
+				(!hasBitmap || IsDenseSubsegment(busyMask, blockCount));
+			const ULONG64 chunkSize = span < settings.bulkChunkSize ? span : settings.bulkChunkSize;
+			RegionReader reader(address, address + span, bulkRead ? (ULONG)chunkSize : 0);
+
+			if (!hasBitmap)
 			{
-				DPRINTF("entry %p\n", address);
-				HeapEntry entry;
-				if (!READMEMORY(address, entry))
+				// classify blocks by signatures in the bulk read, headers of free blocks are not copied
+				const ULONG64 headerSpan = blockCount != 0 ? (ULONG64)(blockCount - 1) * blockStride + sizeof(HeapEntry) : 0;
+				const UCHAR *headers = headerSpan != 0 && headerSpan <= span ? reader.GetPointer(address, (ULONG)headerSpan) : NULL;
+				if (headers != NULL)
 				{
-					dprintf("read LFH HeapEntry at %p failed\n", address);
-					return FALSE;
+					busyMask.resize((blockCount + 31) / 32);
+					ScanBusyBlocks(headers + offsetof(HeapEntry, ExtendedBlockSignature), blockStride, blockCount,
+						(params.ntGlobalFlag & NT_GLOBAL_FLAG_UST) != 0, &busyMask[0]);
 				}
-				entry.Size = blockSize;
-
-				bool busy = false;
-				if (params.ntGlobalFlag & NT_GLOBAL_FLAG_UST)
+				else
 				{
-					busy = (entry.ExtendedBlockSignature == 0xc2);
+					MarkAllBlocks(blockCount, busyMask);
 				}
-				else
+			}
+			const ULONG64 firstBlock = address;
+			for (size_t word = 0; word < busyMask.size(); word++)
+			{
+				for (ULONG bits = busyMask[word]; bits != 0; bits &= bits - 1)
 				{
-					if (entry.ExtendedBlockSignature > 0x80)
+					address = firstBlock + ((ULONG64)word * 32 + CountTrailingZeros(bits)) * blockStride;
+					DPRINTF("entry %p\n", address);
+					HeapEntry entry;
+					if (!READREGION(reader, address, entry))
 					{
-						busy = true;
-						entry.ExtendedBlockSignature -= 0x80;
+						dprintf("read LFH HeapEntry at %p failed\n", address);
+						return FALSE;
 					}
-				}
-				if (busy)
-				{
-					HeapRecord record;
-					if (ParseHeapRecord32(address, entry, params.ntGlobalFlag, record))
+					entry.Size = blockSize;
+
+					bool busy = false;
+					if (params.ntGlobalFlag & NT_GLOBAL_FLAG_UST)
+					{
+						busy = (entry.ExtendedBlockSignature == 0xc2);
+					}
+					else
 					{
-						DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
-							record.ustAddress, record.userAddress, record.userSize, entry.Size * blockUnit - record.userSize);
-						lfhRecords.insert(record);
+						if (entry.ExtendedBlockSignature > 0x80)
+						{
+							busy = true;
+							entry.ExtendedBlockSignature -= 0x80;
+						}
+					}
+					if (busy)
+					{
+						HeapRecord record;
+						if (ParseHeapRecord32(address, entry, params.ntGlobalFlag, reader, record))
+						{
+							DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
+								record.ustAddress, record.userAddress, record.userSize, entry.Size * blockUnit - record.userSize);
+							lfhRecords.push_back(record);
+						}
 					}
 				}
-
-				address += blockStride;
 			}
 		}
 		subsegment += subsegmentSize;
@@ -515,19 +556,20 @@ static BOOL AnalyzeLFHZone32(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 	return TRUE;
 }
 
-static BOOL AnalyzeLFHZone64(ULONG64 lfh, ULONG64 zone, const CommonParams &params, std::set<HeapRecord> &lfhRecords)
+static BOOL AnalyzeLFHZone64(ULONG64 lfh, ULONG64 zone, const CommonParams &params, std::vector<HeapRecord> &lfhRecords)
 {
 	DPRINTF("_LFH_BLOCK_ZONE %p\n", zone);
 	ULONG cb;
 
+	TypeLayout &layout = *params.layout;
 	ULONG64 subsegment;
-	ULONG subsegmentSize = GetTypeSize("ntdll!_HEAP_SUBSEGMENT");
+	ULONG subsegmentSize = layout.GetSize(TypeLayout::HEAP_SUBSEGMENT);
 	ULONG64 endSubsegment;
 	if (params.osVersion >= OS_VERSION_WIN81)
 	{
 		subsegment = zone + 0x20;
 		LONG32 nextIndex;
-		if (GetFieldValue(zone, "ntdll!_LFH_BLOCK_ZONE", "NextIndex", nextIndex) != 0)
+		if (!layout.ReadField(zone, TypeLayout::LFH_BLOCK_ZONE_NextIndex, nextIndex))
 		{
 			dprintf("read _LFH_BLOCK_ZONE::NextIndex failed\n");
 		}
@@ -535,9 +577,9 @@ static BOOL AnalyzeLFHZone64(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 	}
 	else
 	{
-		subsegment = zone + GetTypeSize("ntdll!_LFH_BLOCK_ZONE");
+		subsegment = zone + layout.GetSize(TypeLayout::LFH_BLOCK_ZONE);
 		ULONG64 freePointer;
-		if (GetFieldValue(zone, "ntdll!_LFH_BLOCK_ZONE", "FreePointer", freePointer) != 0)
+		if (!layout.ReadField(zone, TypeLayout::LFH_BLOCK_ZONE_FreePointer, freePointer))
 		{
 			dprintf("read _LFH_BLOCK_ZONE::FreePointer failed\n");
 			return FALSE;
@@ -547,9 +589,15 @@ static BOOL AnalyzeLFHZone64(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 	while (subsegment + subsegmentSize <= endSubsegment)
 	{
 		DPRINTF("_HEAP_SUBSEGMENT %p\n", subsegment);
+		std::vector<UCHAR> raw;
+		if (!layout.ReadStruct(subsegment, TypeLayout::HEAP_SUBSEGMENT, raw))
+		{
+			dprintf("read _HEAP_SUBSEGMENT failed\n");
+			return FALSE;
+		}
 		USHORT blockSize; // _HEAP_SUBSEGMENT::BlockSize
 		USHORT blockCount; // _HEAP_SUBSEGMENT::BlockCount
-		if (GetFieldValue(subsegment, "ntdll!_HEAP_SUBSEGMENT", "BlockSize", blockSize) != 0)
+		if (!layout.GetField(raw, TypeLayout::HEAP_SUBSEGMENT_BlockSize, blockSize))
 		{
 			dprintf("read _HEAP_SUBSEGMENT::BlockSize failed\n");
 			return FALSE;
@@ -559,13 +607,13 @@ static BOOL AnalyzeLFHZone64(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 			// rest are unused subsegments
 			break;
 		}
-		if (GetFieldValue(subsegment, "ntdll!_HEAP_SUBSEGMENT", "BlockCount", blockCount) != 0)
+		if (!layout.GetField(raw, TypeLayout::HEAP_SUBSEGMENT_BlockCount, blockCount))
 		{
 			dprintf("read _HEAP_SUBSEGMENT::BlockCount failed\n");
 			return FALSE;
 		}
 		ULONG64 userBlocks; // _HEAP_SUBSEGMENT::UserBlocks
-		if (GetFieldValue(subsegment, "ntdll!_HEAP_SUBSEGMENT", "UserBlocks", userBlocks) != 0)
+		if (!layout.GetField(raw, TypeLayout::HEAP_SUBSEGMENT_UserBlocks, userBlocks))
 		{
 			dprintf("read _HEAP_SUBSEGMENT::UserBlocks failed\n");
 			return FALSE;
@@ -578,26 +626,18 @@ static BOOL AnalyzeLFHZone64(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 			if (params.osVersion >= OS_VERSION_WIN81)
 			{
 				ULONG32 encodedOffsets;
-				if (GetFieldValue(userBlocks, "ntdll!_HEAP_USERDATA_HEADER", "EncodedOffsets", encodedOffsets))
+				if (!layout.ReadField(userBlocks, TypeLayout::HEAP_USERDATA_HEADER_EncodedOffsets, encodedOffsets))
 				{
 					dprintf("read _HEAP_USERDATA_HEADER::EncodedOffsets failed\n");
 					return FALSE;
 				}
 
-				ULONG32 lfhKey;
+				// failure to resolve the key is printed by AnalyzeHeap
+				if (!params.hasLFHKey)
 				{
-					ULONG64 pLFHKey;
-					if (!GetExpressionEx("ntdll!RtlpLFHKey", &pLFHKey, NULL))
-					{
-						dprintf("get ntdll!RtlpLFHKey failed\n");
-						return FALSE;
-					}
-					if (!READMEMORY(pLFHKey, lfhKey))
-					{
-						dprintf("read LFHKey failed\n");
-						return FALSE;
-					}
+					return FALSE;
 				}
+				const ULONG32 lfhKey = params.lfhKey;
 
 				// decode
 				encodedOffsets ^= (ULONG32)userBlocks ^ (ULONG32)lfh ^ (ULONG32)lfhKey;
@@ -626,7 +666,7 @@ static BOOL AnalyzeLFHZone64(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 			else if (params.osVersion >= OS_VERSION_WIN8)
 			{
 				USHORT firstAllocationOffset;
-				if (GetFieldValue(userBlocks, "ntdll!_HEAP_USERDATA_HEADER", "FirstAllocationOffset", firstAllocationOffset))
+				if (!layout.ReadField(userBlocks, TypeLayout::HEAP_USERDATA_HEADER_FirstAllocationOffset, firstAllocationOffset))
 				{
 					dprintf("read _HEAP_USERDATA_HEADER::FirstAllocationOffset failed\n");
 					return FALSE;
@@ -636,45 +676,79 @@ static BOOL AnalyzeLFHZone64(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 			}
 			else
 			{
-				address = userBlocks + GetTypeSize("ntdll!_LFH_BLOCK_ZONE");
+				address = userBlocks + layout.GetSize(TypeLayout::LFH_BLOCK_ZONE);
 				blockStride = blockSize * blockUnit;
 			}
-			for (USHORT i = 0; i < blockCount; i++)
+			// busy blocks from the bitmap of the subsegment, if the header has it
+			std::vector<ULONG> busyMask;
+			ULONG bitmapOffset;
+			const bool hasBitmap = params.osVersion >= OS_VERSION_WIN8 &&
+				layout.GetOffset(TypeLayout::HEAP_USERDATA_HEADER_BusyBitmap, bitmapOffset) &&
+				ReadBusyBitmap(userBlocks + bitmapOffset, sizeof(ULONG64), blockCount, busyMask);
+
+			// read all blocks of the subsegment at once, unless the bitmap tells only a few of them are busy
+			const ULONG64 span = (ULONG64)blockCount * blockStride;
+			const Settings &settings = GetSettings();
+			const bool bulkRead = settings.bulkRead && span <= MAX_SUBSEGMENT_SPAN &&
+				(!hasBitmap || IsDenseSubsegment(busyMask, blockCount));
+			const ULONG64 chunkSize = span < settings.bulkChunkSize ? span : settings.bulkChunkSize;
+			RegionReader reader(address, address + span, bulkRead ? (ULONG)chunkSize : 0);
+
+			if (!hasBitmap)
 			{
-				DPRINTF("entry %p\n", address);
-				Heap64Entry entry;
-				if (!READMEMORY(address, entry))
+				// classify blocks by signatures in the bulk read, headers of free blocks are not copied
+				const ULONG64 headerSpan = blockCount != 0 ? (ULONG64)(blockCount - 1) * blockStride + sizeof(Heap64Entry) : 0;
+				const UCHAR *headers = headerSpan != 0 && headerSpan <= span ? reader.GetPointer(address, (ULONG)headerSpan) : NULL;
+				if (headers != NULL)
 				{
-					dprintf("read LFH HeapEntry at %p failed\n", address);
-					return FALSE;
+					busyMask.resize((blockCount + 31) / 32);
+					ScanBusyBlocks(headers + offsetof(Heap64Entry, ExtendedBlockSignature), blockStride, blockCount,
+						(params.ntGlobalFlag & NT_GLOBAL_FLAG_UST) != 0, &busyMask[0]);
 				}
-				entry.Size = blockSize;
-
-				bool busy = false;
-				if (params.ntGlobalFlag & NT_GLOBAL_FLAG_UST)
+				else
 				{
-					busy = (entry.ExtendedBlockSignature == 0xc2);
+					MarkAllBlocks(blockCount, busyMask);
 				}
-				else
+			}
+			const ULONG64 firstBlock = address;
+			for (size_t word = 0; word < busyMask.size(); word++)
+			{
+				for (ULONG bits = busyMask[word]; bits != 0; bits &= bits - 1)
 				{
-					if (entry.ExtendedBlockSignature > 0x80)
+					address = firstBlock + ((ULONG64)word * 32 + CountTrailingZeros(bits)) * blockStride;
+					DPRINTF("entry %p\n", address);
+					Heap64Entry entry;
+					if (!READREGION(reader, address, entry))
+					{
+						dprintf("read LFH HeapEntry at %p failed\n", address);
+						return FALSE;
+					}
+					entry.Size = blockSize;
+
+					bool busy = false;
+					if (params.ntGlobalFlag & NT_GLOBAL_FLAG_UST)
 					{
-						busy = true;
-						entry.ExtendedBlockSignature -= 0x80;
+						busy = (entry.ExtendedBlockSignature == 0xc2);
 					}
-				}
-				if (busy)
-				{
-					HeapRecord record;
-					if (ParseHeapRecord64(address, entry, params.ntGlobalFlag, record))
+					else
+					{
+						if (entry.ExtendedBlockSignature > 0x80)
+						{
+							busy = true;
+							entry.ExtendedBlockSignature -= 0x80;
+						}
+					}
+					if (busy)
 					{
-						DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
-							record.ustAddress, record.userAddress, record.userSize, entry.Size * blockUnit - record.userSize);
-						lfhRecords.insert(record);
+						HeapRecord record;
+						if (ParseHeapRecord64(address, entry, params.ntGlobalFlag, reader, record))
+						{
+							DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
+								record.ustAddress, record.userAddress, record.userSize, entry.Size * blockUnit - record.userSize);
+							lfhRecords.push_back(record);
+						}
 					}
 				}
-
-				address += blockStride;
 			}
 		}
 		subsegment += subsegmentSize;
@@ -682,7 +756,13 @@ static BOOL AnalyzeLFHZone64(ULONG64 lfh, ULONG64 zone, const CommonParams &para
 	return TRUE;
 }
 
-static BOOL AnalyzeLFH32(ULONG64 heapAddress, const CommonParams &params, std::set<HeapRecord> &lfhRecords)
+/**
+*	@brief get _LFH_BLOCK_ZONE list of the heap
+*	@param frontEndHeap [out] _LFH_HEAP of the heap
+*	@param zones [out] zones in the list, empty if LFH is not enabled
+*	@retval FALSE the list is broken, zones found until then are kept
+*/
+static BOOL GetLFHZones32(ULONG64 heapAddress, const CommonParams &params, ULONG64 &frontEndHeap, std::vector<ULONG64> &zones)
 {
 	DPRINTF("analyze LFH for HEAP %p\n", heapAddress);
 	ULONG cb;
@@ -699,13 +779,14 @@ static BOOL AnalyzeLFH32(ULONG64 heapAddress, const CommonParams &params, std::s
 		return TRUE;
 	}
 
-	ULONG32 frontEndHeap;
+	ULONG32 frontEndHeap32;
 	offset = params.osVersion >= OS_VERSION_WIN8 ? 0xd0: 0xd4;
-	if (!READMEMORY(heapAddress + offset, frontEndHeap))
+	if (!READMEMORY(heapAddress + offset, frontEndHeap32))
 	{
 		dprintf("read FrontEndHeap failed\n");
 		return FALSE;
 	}
+	frontEndHeap = frontEndHeap32;
 	if (frontEndHeap == 0)
 	{
 		return TRUE;
@@ -713,7 +794,7 @@ static BOOL AnalyzeLFH32(ULONG64 heapAddress, const CommonParams &params, std::s
 
 	DPRINTF("_LFH_HEAP %p\n", (ULONG64)frontEndHeap);
 	offset = params.osVersion >= OS_VERSION_WIN8 ? 0x4 : 0x18;
-	ULONG32 start = frontEndHeap + offset; // _LFH_HEAP::SubSegmentZones
+	ULONG32 start = frontEndHeap32 + offset; // _LFH_HEAP::SubSegmentZones
 	ULONG32 zone = start;
 	while (true)
 	{
@@ -728,20 +809,21 @@ static BOOL AnalyzeLFH32(ULONG64 heapAddress, const CommonParams &params, std::s
 		{
 			break;
 		}
-		if (!AnalyzeLFHZone32(frontEndHeap, zone, params, lfhRecords))
-		{
-			return FALSE;
-		}
+		zones.push_back(zone);
 	}
 	return TRUE;
 }
 
-static BOOL AnalyzeLFH64(ULONG64 heapAddress, const CommonParams &params, std::set<HeapRecord> &lfhRecords)
+/**
+*	@copydoc GetLFHZones32
+*/
+static BOOL GetLFHZones64(ULONG64 heapAddress, const CommonParams &params, ULONG64 &frontEndHeap, std::vector<ULONG64> &zones)
 {
 	DPRINTF("analyze LFH for HEAP %p\n", heapAddress);
 	ULONG cb;
 	UCHAR type; // _HEAP::FrontEndHeapType
-	if (GetFieldValue(heapAddress, "ntdll!_HEAP", "FrontEndHeapType", type) != 0)
+	TypeLayout &layout = *params.layout;
+	if (!layout.ReadField(heapAddress, TypeLayout::HEAP_FrontEndHeapType, type))
 	{
 		dprintf("read FrontEndHeapType failed\n");
 		return FALSE;
@@ -751,8 +833,7 @@ static BOOL AnalyzeLFH64(ULONG64 heapAddress, const CommonParams &params, std::s
 		return TRUE;
 	}
 
-	ULONG64 frontEndHeap;
-	if (GetFieldValue(heapAddress, "ntdll!_HEAP", "FrontEndHeap", frontEndHeap) != 0)
+	if (!layout.ReadField(heapAddress, TypeLayout::HEAP_FrontEndHeap, frontEndHeap))
 	{
 		dprintf("read FrontEndHeap failed\n");
 		return FALSE;
@@ -764,7 +845,7 @@ static BOOL AnalyzeLFH64(ULONG64 heapAddress, const CommonParams &params, std::s
 
 	DPRINTF("_LFH_HEAP %p\n", frontEndHeap);
 	ULONG offset;
-	if (GetFieldOffset("ntdll!_LFH_HEAP", "SubSegmentZones", &offset) != 0)
+	if (!layout.GetOffset(TypeLayout::LFH_HEAP_SubSegmentZones, offset))
 	{
 		dprintf("get SubSegmentZones offset failed\n");
 		return FALSE;
@@ -784,15 +865,12 @@ static BOOL AnalyzeLFH64(ULONG64 heapAddress, const CommonParams &params, std::s
 		{
 			break;
 		}
-		if (!AnalyzeLFHZone64(frontEndHeap, zone, params, lfhRecords))
-		{
-			return FALSE;
-		}
+		zones.push_back(zone);
 	}
 	return TRUE;
 }
 
-static BOOL AnalyzeVirtualAllocd32(ULONG64 heapAddress, const HeapEntry &encoding, const CommonParams &params, std::set<HeapRecord> &records)
+static BOOL AnalyzeVirtualAllocd32(ULONG64 heapAddress, const HeapEntry &encoding, const CommonParams &params, std::vector<HeapRecord> &records)
 {
 	DPRINTF("analyze VirtualAllocdBlocks for HEAP %p\n", heapAddress);
 	ULONG cb;
@@ -855,7 +933,7 @@ static BOOL AnalyzeVirtualAllocd32(ULONG64 heapAddress, const HeapEntry &encodin
 
 		DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
 			record.ustAddress, record.userAddress, record.userSize, record.size - record.userSize);
-		records.insert(record);
+		records.push_back(record);
 
 		if (!READMEMORY(listEntry.Flink, listEntry))
 		{
@@ -866,18 +944,19 @@ static BOOL AnalyzeVirtualAllocd32(ULONG64 heapAddress, const HeapEntry &encodin
 	return TRUE;
 }
 
-static BOOL AnalyzeVirtualAllocd64(ULONG64 heapAddress, const Heap64Entry &encoding, const CommonParams &params, std::set<HeapRecord> &records)
+static BOOL AnalyzeVirtualAllocd64(ULONG64 heapAddress, const Heap64Entry &encoding, const CommonParams &params, std::vector<HeapRecord> &records)
 {
 	DPRINTF("analyze VirtualAllocdBlocks for HEAP %p\n", heapAddress);
 	ULONG cb;
+	TypeLayout &layout = *params.layout;
 	LIST_ENTRY64 listEntry;
-	if (GetFieldValue(heapAddress, "ntdll!_HEAP", "VirtualAllocdBlocks", listEntry) != 0)
+	if (!layout.ReadField(heapAddress, TypeLayout::HEAP_VirtualAllocdBlocks, listEntry))
 	{
 		dprintf("read VirtualAllocdBlocks failed\n");
 		return FALSE;
 	}
 	ULONG offset;
-	GetFieldOffset("ntdll!_HEAP", "VirtualAllocdBlocks", &offset);
+	layout.GetOffset(TypeLayout::HEAP_VirtualAllocdBlocks, offset);
 	while (listEntry.Flink != heapAddress + offset)
 	{
 		HeapRecord record;
@@ -930,9 +1009,9 @@ static BOOL AnalyzeVirtualAllocd64(ULONG64 heapAddress, const Heap64Entry &encod
 
 		DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
 			record.ustAddress, record.userAddress, record.userSize, record.size - record.userSize);
-		records.insert(record);
+		records.push_back(record);
 
-		if (GetFieldValue(listEntry.Flink, "ntdll!_LIST_ENTRY", "Flink", listEntry) != 0)
+		if (!READMEMORY(listEntry.Flink, listEntry))
 		{
 			dprintf("read ListEntry at %p failed\n", listEntry.Flink);
 			return FALSE;
@@ -941,245 +1020,252 @@ static BOOL AnalyzeVirtualAllocd64(ULONG64 heapAddress, const Heap64Entry &encod
 	return TRUE;
 }
 
-static void Register(
-		const HeapRecord &record,
-		std::set<HeapRecord> &lfhRecords,
-		IProcessor *processor)
+/**
+*	@brief records delivered to a processor by IProcessor::RegisterBatch
+*	@note flushed when full and when destroyed, so destroy it before IProcessor::FinishHeap
+*/
+class RecordBatch
 {
-	while (!lfhRecords.empty() && lfhRecords.begin()->address < record.address)
+public:
+	RecordBatch(IProcessor *processor)
+	: processor_(processor)
+	, count_(0)
 	{
-		std::set<HeapRecord>::iterator itr = lfhRecords.begin();
-		//dprintf("Register: insert entry %p\n", itr->address);
-		processor->Register(itr->ustAddress,
-			itr->size, itr->address, itr->userSize, itr->userAddress);
-		lfhRecords.erase(lfhRecords.begin());
 	}
-	processor->Register(record.ustAddress,
-		record.size, record.address, record.userSize, record.userAddress);
-}
 
-static BOOL AnalyzeHeap32(ULONG64 heapAddress, const CommonParams &params, IProcessor *processor)
-{
-	std::set<HeapRecord> lfhRecords;
-	AnalyzeLFH32(heapAddress, params, lfhRecords);
-	DPRINTF("found %d LFH records in heap %p\n", (int)lfhRecords.size(), heapAddress);
+	~RecordBatch()
+	{
+		Flush();
+	}
 
-	const ULONG blockUnit = 8;
-	ULONG cb;
-	HeapEntry encoding;
-	if (!READMEMORY(heapAddress + 0x50, encoding))
+	void Add(const HeapRecord &record)
 	{
-		dprintf("read Encoding failed\n");
-		return FALSE;
+		records_[count_++] = record;
+		if (count_ == BATCH_SIZE)
+		{
+			Flush();
+		}
+	}
+
+	void Flush()
+	{
+		if (count_ != 0)
+		{
+			processor_->RegisterBatch(records_, count_);
+			count_ = 0;
+		}
 	}
 
-	std::set<HeapRecord> vallocRecords;
-	AnalyzeVirtualAllocd32(heapAddress, encoding, params, vallocRecords);
-	DPRINTF("found %d valloc records in heap %p\n", (int)vallocRecords.size(), heapAddress);
+private:
+	enum { BATCH_SIZE = 256 };
+
+	IProcessor *processor_;
+	HeapRecord records_[BATCH_SIZE];
+	size_t count_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	RecordBatch& operator=(const RecordBatch&);
+};
+
+/**
+*	@brief collect busy entries of a heap segment in address order
+*	@param freeStats [out] busy and free entries are counted if not NULL
+*	@retval FALSE an entry cannot be decoded, records found until then are kept
+*/
+static BOOL WalkSegment32(const HeapSegment &segment, const HeapEntry &encoding, const CommonParams &params, std::vector<HeapRecord> &records,
+						   FreeBlockStats *freeStats)
+{
+	const ULONG blockUnit = 8;
+	ULONG cb;
+
+	// committed span is read in large chunks if bulk read is enabled
+	const Settings &settings = GetSettings();
+	const ULONG64 committedEnd = segment.LastValidEntry - (ULONG64)segment.NumberOfUnCommittedPages * PAGE_SIZE;
+	RegionReader reader(segment.FirstEntry, committedEnd, settings.bulkRead ? settings.bulkChunkSize : 0);
 
-	int index = 0;
-	while ((heapAddress & 0xffff) == 0)
+	ULONG64 address = segment.FirstEntry;
+	while (address < segment.LastValidEntry)
 	{
-		HeapSegment segment;
-		if (!READMEMORY(heapAddress, segment))
+		HeapEntry entry;
+		if (!READREGION(reader, address, entry))
+		{
+			dprintf("ReadMemory failed at %p, LastValidEntry is %p\n", address, (ULONG64)segment.LastValidEntry);
+			break;//return FALSE;
+		}
+		if (!DecodeHeapEntry(&entry, &encoding))
 		{
-			dprintf("read HEAP_SEGMENT at %p failed\n", heapAddress);
+			dprintf("DecodeHeapEntry failed at %p\n", address);
 			return FALSE;
 		}
-		DPRINTF("Segment at %p to %p\n", heapAddress, (ULONG64)segment.LastValidEntry);
-		DPRINTF("NumberOfUnCommittedPages:%p, NumberOfUnCommittedRanges:%p\n", (ULONG64)segment.NumberOfUnCommittedPages, (ULONG64)segment.NumberOfUnCommittedRanges);
 
-		std::set<HeapRecord> lfhRecordsInSegment;
-		for (std::set<HeapRecord>::iterator itr = lfhRecords.begin();
-			itr != lfhRecords.end();
-			itr++)
+		// skip the last entry in the segment
+		const UCHAR busy = 0x01;
+		if (address + entry.Size * blockUnit >= segment.LastValidEntry - segment.NumberOfUnCommittedPages * PAGE_SIZE)
 		{
-			if (segment.FirstEntry < itr->address && itr->address < segment.LastValidEntry)
+			DPRINTF("uncommitted bytes follows\n");
+			if (freeStats != NULL && address + entry.Size * blockUnit == committedEnd)
 			{
-				lfhRecordsInSegment.insert(*itr);
+				// usually the free space before the uncommitted range
+				freeStats->Add(entry.Size * blockUnit, (entry.Flags & busy) != 0);
 			}
+			break;
 		}
-		DPRINTF("%d LFH records in segment %p\n", (int)lfhRecordsInSegment.size(), heapAddress);
 
-		ULONG64 address = segment.FirstEntry;
-		while (address < segment.LastValidEntry)
+		DPRINTF("addr:%p, %04x, %02x, %02x, %04x, %02x, %02x\n", address, entry.Size, entry.Flags, entry.SmallTagIndex, entry.PreviousSize, entry.SegmentOffset, entry.ExtendedBlockSignature);
+		if (entry.ExtendedBlockSignature == 0x03)
 		{
-			HeapEntry entry;
-			if (!READMEMORY(address, entry))
-			{
-				dprintf("ReadMemory failed at %p, LastValidEntry is %p\n", address, (ULONG64)segment.LastValidEntry);
-				break;//return FALSE;
-			}
-			if (!DecodeHeapEntry(&entry, &encoding))
-			{
-				dprintf("DecodeHeapEntry failed at %p\n", address);
-				return FALSE;
-			}
-
-			// skip the last entry in the segment
-			if (address + entry.Size * blockUnit >= segment.LastValidEntry - segment.NumberOfUnCommittedPages * PAGE_SIZE)
-			{
-				DPRINTF("uncommitted bytes follows\n");
-				break;
-			}
-
-			DPRINTF("addr:%p, %04x, %02x, %02x, %04x, %02x, %02x\n", address, entry.Size, entry.Flags, entry.SmallTagIndex, entry.PreviousSize, entry.SegmentOffset, entry.ExtendedBlockSignature);
-			if (entry.ExtendedBlockSignature == 0x03)
+			break;
+		}
+		else
+		{
+			if (freeStats != NULL)
 			{
-				break;
+				freeStats->Add(entry.Size * blockUnit, (entry.Flags & busy) != 0);
 			}
-			else
+			if (entry.Flags == busy)
 			{
-				UCHAR busy = 0x01;
-				if (entry.Flags == busy)
+				HeapRecord record;
+				if (ParseHeapRecord32(address, entry, params.ntGlobalFlag, reader, record))
 				{
-					HeapRecord record;
-					if (ParseHeapRecord32(address, entry, params.ntGlobalFlag, record))
-					{
-						DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
-							record.ustAddress, record.userAddress, record.userSize, entry.Size * blockUnit - record.userSize);
-						Register(record, lfhRecordsInSegment, processor);
-					}
+					DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
+						record.ustAddress, record.userAddress, record.userSize, entry.Size * blockUnit - record.userSize);
+					records.push_back(record);
 				}
 			}
-			address += entry.Size * blockUnit;
-		}
-		for (std::set<HeapRecord>::iterator itr = lfhRecordsInSegment.begin();
-			itr != lfhRecordsInSegment.end();
-			itr++)
-		{
-			//dprintf("insert entry %p\n", itr->address);
-			processor->Register(itr->ustAddress,
-				itr->size, itr->address,
-				itr->userSize, itr->userAddress);
 		}
-		heapAddress = segment.SegmentListEntry.Flink - 0x10;
-		index++;
-	}
-	for (std::set<HeapRecord>::iterator itr = vallocRecords.begin();
-		itr != vallocRecords.end();
-		itr++)
-	{
-		processor->Register(itr->ustAddress,
-			itr->size, itr->address,
-			itr->userSize, itr->userAddress);
+		address += entry.Size * blockUnit;
 	}
 	return TRUE;
 }
 
-static BOOL AnalyzeHeap64(ULONG64 heapAddress, const CommonParams &params, IProcessor *processor)
+/**
+*	@copydoc WalkSegment32
+*/
+static BOOL WalkSegment64(const Heap64Segment &segment, const Heap64Entry &encoding, const CommonParams &params, std::vector<HeapRecord> &records,
+						   FreeBlockStats *freeStats)
 {
-	std::set<HeapRecord> lfhRecords;
-	AnalyzeLFH64(heapAddress, params, lfhRecords);
-	DPRINTF("found %d LFH records in heap %p\n", (int)lfhRecords.size(), heapAddress);
-
 	const ULONG blockUnit = 16;
 	ULONG cb;
-	Heap64Entry encoding;
-	if (GetFieldValue(heapAddress, "ntdll!_HEAP", "Encoding", encoding) != 0)
-	{
-		dprintf("read Encoding failed\n");
-		return FALSE;
-	}
 
-	std::set<HeapRecord> vallocRecords;
-	AnalyzeVirtualAllocd64(heapAddress, encoding, params, vallocRecords);
-	DPRINTF("found %d valloc records in heap %p\n", (int)vallocRecords.size(), heapAddress);
+	// committed span is read in large chunks if bulk read is enabled
+	const Settings &settings = GetSettings();
+	const ULONG64 committedEnd = segment.LastValidEntry - (ULONG64)segment.NumberOfUnCommittedPages * PAGE_SIZE;
+	RegionReader reader(segment.FirstEntry, committedEnd, settings.bulkRead ? settings.bulkChunkSize : 0);
 
-	int index = 0;
-	while ((heapAddress & 0xffff) == 0)
+	ULONG64 address = segment.FirstEntry;
+	while (address < segment.LastValidEntry)
 	{
-		Heap64Segment segment;
-		if (!READMEMORY(heapAddress, segment))
+		Heap64Entry entry;
+		if (!READREGION(reader, address, entry))
+		{
+			dprintf("ReadMemory failed at %p, LastValidEntry is %p\n", address, segment.LastValidEntry);
+			break;//return FALSE;
+		}
+		if (!DecodeHeap64Entry(&entry, &encoding))
 		{
-			dprintf("read HEAP_SEGMENT at %p failed\n", heapAddress);
+			dprintf("DecodeHeap64Entry failed at %p\n", address);
 			return FALSE;
 		}
-		DPRINTF("Segment at %p to %p\n", heapAddress, segment.LastValidEntry);
-		DPRINTF("NumberOfUnCommittedPages:%p, NumberOfUnCommittedRanges:%p\n", (ULONG64)segment.NumberOfUnCommittedPages, (ULONG64)segment.NumberOfUnCommittedRanges);
 
-		std::set<HeapRecord> lfhRecordsInSegment;
-		for (std::set<HeapRecord>::iterator itr = lfhRecords.begin();
-			itr != lfhRecords.end();
-			itr++)
+		// skip the last entry in the segment
+		const UCHAR busy = 0x01;
+		if (address + entry.Size * blockUnit >= segment.LastValidEntry - segment.NumberOfUnCommittedPages * PAGE_SIZE)
 		{
-			if (segment.FirstEntry < itr->address && itr->address < segment.LastValidEntry)
+			DPRINTF("uncommitted bytes follows\n");
+			if (freeStats != NULL && address + entry.Size * blockUnit == committedEnd)
 			{
-				lfhRecordsInSegment.insert(*itr);
+				// usually the free space before the uncommitted range
+				freeStats->Add(entry.Size * blockUnit, (entry.Flags & busy) != 0);
 			}
+			break;
 		}
-		DPRINTF("%d LFH records in segment %p\n", (int)lfhRecordsInSegment.size(), heapAddress);
 
-		ULONG64 address = segment.FirstEntry;
-		while (address < segment.LastValidEntry)
+		DPRINTF("addr:%p, %04x, %02x, %02x, %04x, %02x, %02x\n", address, entry.Size, entry.Flags, entry.SmallTagIndex, entry.PreviousSize, entry.SegmentOffset, entry.ExtendedBlockSignature);
+		if (entry.ExtendedBlockSignature == 0x03)
 		{
-			Heap64Entry entry;
-			if (!READMEMORY(address, entry))
-			{
-				dprintf("ReadMemory failed at %p, LastValidEntry is %p\n", address, segment.LastValidEntry);
-				break;//return FALSE;
-			}
-			if (!DecodeHeap64Entry(&entry, &encoding))
-			{
-				dprintf("DecodeHeap64Entry failed at %p\n", address);
-				return FALSE;
-			}
-
-			// skip the last entry in the segment
-			if (address + entry.Size * blockUnit >= segment.LastValidEntry - segment.NumberOfUnCommittedPages * PAGE_SIZE)
-			{
-				DPRINTF("uncommitted bytes follows\n");
-				break;
-			}
-
-			DPRINTF("addr:%p, %04x, %02x, %02x, %04x, %02x, %02x\n", address, entry.Size, entry.Flags, entry.SmallTagIndex, entry.PreviousSize, entry.SegmentOffset, entry.ExtendedBlockSignature);
-			if (entry.ExtendedBlockSignature == 0x03)
+			break;
+		}
+		else
+		{
+			if (freeStats != NULL)
 			{
-				break;
+				freeStats->Add(entry.Size * blockUnit, (entry.Flags & busy) != 0);
 			}
-			else
+			if (entry.Flags == busy)
 			{
-				UCHAR busy = 0x01;
-				if (entry.Flags == busy)
+				HeapRecord record;
+				if (ParseHeapRecord64(address, entry, params.ntGlobalFlag, reader, record))
 				{
-					HeapRecord record;
-					if (ParseHeapRecord64(address, entry, params.ntGlobalFlag, record))
-					{
-						DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
-							record.ustAddress, record.userAddress, record.userSize, entry.Size * blockUnit - record.userSize);
-						Register(record, lfhRecordsInSegment, processor);
-					}
+					DPRINTF("ust:%p, userPtr:%p, userSize:%p, extra:%p\n",
+						record.ustAddress, record.userAddress, record.userSize, entry.Size * blockUnit - record.userSize);
+					records.push_back(record);
 				}
 			}
-			address += entry.Size * blockUnit;
 		}
-		for (std::set<HeapRecord>::iterator itr = lfhRecordsInSegment.begin();
-			itr != lfhRecordsInSegment.end();
-			itr++)
+		address += entry.Size * blockUnit;
+	}
+	return TRUE;
+}
+
+/**
+*	@brief result of walking a heap segment
+*/
+struct SegmentWalk
+{
+	ULONG64 address;
+	HeapSegment segment32;
+	Heap64Segment segment64;
+	ULONG64 firstEntry;
+	ULONG64 lastValidEntry;
+	std::vector<HeapRecord> records;
+	FreeBlockStats freeStats; // counted only if free entries are reported
+	BOOL result;
+};
+
+/**
+*	@brief deliver records of a segment merged with LFH records in the segment, in address order
+*	@note LFH records after the last entry are delivered only if the segment was walked to the end
+*/
+static void RegisterSegment(const SegmentWalk &segment, const std::vector<HeapRecord> &lfhRecords,
+							const CommonParams &params, RecordBatch &batch)
+{
+	// LFH records between FirstEntry and LastValidEntry (exclusive)
+	size_t lfh = LowerBoundRecord(lfhRecords, segment.firstEntry + 1);
+	size_t lfhEnd = LowerBoundRecord(lfhRecords, segment.lastValidEntry);
+	if (lfhEnd < lfh)
+	{
+		lfhEnd = lfh;
+	}
+	DPRINTF("%d LFH records in segment %p\n", (int)(lfhEnd - lfh), segment.address);
+
+	// merge in one pass, LFH records are delivered before the entry following them
+	for (std::vector<HeapRecord>::const_iterator itr = segment.records.begin();
+		itr != segment.records.end();
+		itr++)
+	{
+		while (lfh < lfhEnd && lfhRecords[lfh].address < itr->address)
 		{
-			//dprintf("insert entry %p\n", itr->address);
-			processor->Register(itr->ustAddress,
-				itr->size, itr->address,
-				itr->userSize, itr->userAddress);
+			batch.Add(lfhRecords[lfh++]);
 		}
-		heapAddress = segment.SegmentListEntry.Flink - 0x18;
-		index++;
+		batch.Add(*itr);
 	}
-	for (std::set<HeapRecord>::iterator itr = vallocRecords.begin();
-		itr != vallocRecords.end();
-		itr++)
+	if (!segment.result)
 	{
-		processor->Register(itr->ustAddress,
-			itr->size, itr->address,
-			itr->userSize, itr->userAddress);
+		return;
+	}
+	for (; lfh < lfhEnd; lfh++)
+	{
+		batch.Add(lfhRecords[lfh]);
 	}
-	return TRUE;
 }
 
 static BOOL AnalyzeDphHeapBlock32(ULONG64 address, const CommonParams &params, void *arg)
 {
 	ULONG cb;
-	std::set<HeapRecord> *records = static_cast<std::set<HeapRecord> *>(arg);
+	std::vector<HeapRecord> *records = static_cast<std::vector<HeapRecord> *>(arg);
 	DPRINTF("_DPH_HEAP_BLOCK %p\n", address);
 	ULONG32 pUserAllocation;
 	// _DPH_HEAP_BLOCK::pUserAllocation
@@ -1228,14 +1314,16 @@ static BOOL AnalyzeDphHeapBlock32(ULONG64 address, const CommonParams &params, v
 		record.address = pVirtualBlock;
 		record.userSize = nUserRequestedSize;
 		record.userAddress = pUserAllocation;
-		records->insert(record);
+		records->push_back(record);
 	}
 	return TRUE;
 }
 
-static BOOL AnalyzeDphHeap32(ULONG64 heapList, IProcessor *processor, const CommonParams &params)
+/**
+*	@brief get _DPH_HEAP_ROOT list of page heaps
+*/
+static BOOL GetDphHeapRoots32(ULONG64 heapList, const CommonParams &params, std::vector<ULONG64> &heapRoots)
 {
-	std::vector<ULONG64> heapRoots;
 	ULONG cb;
 	LIST_ENTRY32 listEntry;
 	if (!READMEMORY(heapList, listEntry))
@@ -1254,51 +1342,62 @@ static BOOL AnalyzeDphHeap32(ULONG64 heapList, IProcessor *processor, const Comm
 			return FALSE;
 		}
 	}
+	return TRUE;
+}
 
-	for (std::vector<ULONG64>::iterator itr = heapRoots.begin(); itr != heapRoots.end(); itr++)
-	{
-		ULONG cb;
-		// _DPH_HEAP_ROOT::NormalHeap
-		ULONG32 normalHeap;
-		if (!READMEMORY(*itr + 0xb4, normalHeap))
-		{
-			dprintf("read NormalHeap at %p failed\n", *itr + 0xb4);
-			return FALSE;
-		}
-
-		DPRINTF("heap at %p, _DPH_HEAP_ROOT %p\n", (ULONG64)normalHeap, *itr);
-		processor->StartHeap(normalHeap);
-		std::set<HeapRecord> records;
+/**
+*	@brief result of walking a page heap
+*/
+struct DphHeapWalk
+{
+	ULONG64 heapRoot;
+	ULONG64 normalHeap;
+	BOOL found; // NormalHeap is read
+	BOOL result;
+	std::vector<HeapRecord> records; // sorted by address
+};
 
-		// _DPH_HEAP_ROOT::BusyNodesTable
-		if (!WalkBalancedLinks(*itr + 0x20, params, AnalyzeDphHeapBlock32, &records))
-		{
-			dprintf("WalkBalancedLinks failed\n");
-			return FALSE;
-		}
+/**
+*	@brief collect allocated blocks of a page heap
+*/
+static void WalkDphHeap32(DphHeapWalk &heap, const CommonParams &params)
+{
+	ULONG cb;
+	// _DPH_HEAP_ROOT::NormalHeap
+	ULONG32 normalHeap;
+	if (!READMEMORY(heap.heapRoot + 0xb4, normalHeap))
+	{
+		dprintf("read NormalHeap at %p failed\n", heap.heapRoot + 0xb4);
+		heap.found = FALSE;
+		return;
+	}
+	heap.normalHeap = normalHeap;
 
-		for (std::set<HeapRecord>::iterator itr_ = records.begin();
-			itr_ != records.end();
-			itr_++)
-		{
-			processor->Register(itr_->ustAddress,
-				itr_->size, itr_->address,
-				itr_->userSize, itr_->userAddress);
-		}
-		processor->FinishHeap(normalHeap);
+	DPRINTF("heap at %p, _DPH_HEAP_ROOT %p\n", heap.normalHeap, heap.heapRoot);
+	// _DPH_HEAP_ROOT::BusyNodesTable
+	if (!WalkBalancedLinks(heap.heapRoot + 0x20, params, AnalyzeDphHeapBlock32, &heap.records))
+	{
+		dprintf("WalkBalancedLinks failed\n");
+		heap.result = FALSE;
 	}
-	return TRUE;
+	SortRecords(heap.records);
 }
 
 static BOOL AnalyzeDphHeapBlock64(ULONG64 address, const CommonParams &params, void *arg)
 {
 	ULONG cb;
-	const char *type = "ntdll!_DPH_HEAP_BLOCK";
-	std::set<HeapRecord> *records = static_cast<std::set<HeapRecord> *>(arg);
+	TypeLayout &layout = *params.layout;
+	std::vector<HeapRecord> *records = static_cast<std::vector<HeapRecord> *>(arg);
 	DPRINTF("_DPH_HEAP_BLOCK %p\n", address);
+	std::vector<UCHAR> raw;
+	if (!layout.ReadStruct(address, TypeLayout::DPH_HEAP_BLOCK, raw))
+	{
+		dprintf("read _DPH_HEAP_BLOCK failed\n");
+		return FALSE;
+	}
 	ULONG64 pUserAllocation;
 	// _DPH_HEAP_BLOCK::pUserAllocation
-	if (GetFieldValue(address, type, "pUserAllocation", pUserAllocation) != 0)
+	if (!layout.GetField(raw, TypeLayout::DPH_HEAP_BLOCK_pUserAllocation, pUserAllocation))
 	{
 		dprintf("read pUserAllocation failed\n");
 		return FALSE;
@@ -1311,25 +1410,25 @@ static BOOL AnalyzeDphHeapBlock64(ULONG64 address, const CommonParams &params, v
 		ULONG64 pVirtualBlock, stackTrace;
 		ULONG64 nVirtualBlockSize, nUserRequestedSize;
 
-		if (GetFieldValue(address, type, "pVirtualBlock", pVirtualBlock) != 0)
+		if (!layout.GetField(raw, TypeLayout::DPH_HEAP_BLOCK_pVirtualBlock, pVirtualBlock))
 		{
 			dprintf("read pVirtualBlock failed\n");
 			return FALSE;
 		}
 
-		if (GetFieldValue(address, type, "nVirtualBlockSize", nVirtualBlockSize) != 0)
+		if (!layout.GetField(raw, TypeLayout::DPH_HEAP_BLOCK_nVirtualBlockSize, nVirtualBlockSize))
 		{
 			dprintf("read nVirtualBlockSize failed\n");
 			return FALSE;
 		}
 
-		if (GetFieldValue(address, type, "nUserRequestedSize", nUserRequestedSize) != 0)
+		if (!layout.GetField(raw, TypeLayout::DPH_HEAP_BLOCK_nUserRequestedSize, nUserRequestedSize))
 		{
 			dprintf("read nUserRequestedSize failed\n");
 			return FALSE;
 		}
 
-		if (GetFieldValue(address, type, "StackTrace", stackTrace))
+		if (!layout.GetField(raw, TypeLayout::DPH_HEAP_BLOCK_StackTrace, stackTrace))
 		{
 			dprintf("read StackTrace failed\n");
 			return FALSE;
@@ -1343,14 +1442,16 @@ static BOOL AnalyzeDphHeapBlock64(ULONG64 address, const CommonParams &params, v
 		record.address = pVirtualBlock;
 		record.userSize = nUserRequestedSize;
 		record.userAddress = pUserAllocation;
-		records->insert(record);
+		records->push_back(record);
 	}
 	return TRUE;
 }
 
-static BOOL AnalyzeDphHeap64(ULONG64 heapList, IProcessor *processor, const CommonParams &params)
+/**
+*	@copydoc GetDphHeapRoots32
+*/
+static BOOL GetDphHeapRoots64(ULONG64 heapList, const CommonParams &params, std::vector<ULONG64> &heapRoots)
 {
-	std::vector<ULONG64> heapRoots;
 	ULONG cb;
 	LIST_ENTRY64 listEntry;
 	if (!READMEMORY(heapList, listEntry))
@@ -1361,7 +1462,7 @@ static BOOL AnalyzeDphHeap64(ULONG64 heapList, IProcessor *processor, const Comm
 	while (listEntry.Flink != heapList)
 	{
 		ULONG offset;
-		::GetFieldOffset("ntdll!_DPH_HEAP_ROOT", "NextHeap", &offset);
+		params.layout->GetOffset(TypeLayout::DPH_HEAP_ROOT_NextHeap, offset);
 		ULONG64 heapRoot = listEntry.Flink - offset;
 		DPRINTF("push heapRoot %p\n", heapRoot);
 		heapRoots.push_back(heapRoot);
@@ -1371,71 +1472,519 @@ static BOOL AnalyzeDphHeap64(ULONG64 heapList, IProcessor *processor, const Comm
 			return FALSE;
 		}
 	}
+	return TRUE;
+}
 
-	for (std::vector<ULONG64>::iterator itr = heapRoots.begin(); itr != heapRoots.end(); itr++)
+/**
+*	@copydoc WalkDphHeap32
+*/
+static void WalkDphHeap64(DphHeapWalk &heap, const CommonParams &params)
+{
+	if (!params.layout->ReadField(heap.heapRoot, TypeLayout::DPH_HEAP_ROOT_NormalHeap, heap.normalHeap))
 	{
-		ULONG offset;
+		dprintf("read NormalHeap failed\n");
+		heap.found = FALSE;
+		return;
+	}
+
+	DPRINTF("heap at %p, _DPH_HEAP_ROOT %p\n", heap.normalHeap, heap.heapRoot);
+	ULONG offset;
+	params.layout->GetOffset(TypeLayout::DPH_HEAP_ROOT_BusyNodesTable, offset);
+	if (!WalkBalancedLinks(heap.heapRoot + offset, params, AnalyzeDphHeapBlock64, &heap.records))
+	{
+		dprintf("WalkBalancedLinks failed\n");
+		heap.result = FALSE;
+	}
+	SortRecords(heap.records);
+}
 
-		ULONG64 normalHeap;
-		if (GetFieldValue(*itr, "ntdll!_DPH_HEAP_ROOT", "NormalHeap", normalHeap))
+/**
+*	@brief result of walking a heap, filled by tasks and registered in the order of the serial walk
+*/
+struct HeapWalk
+{
+	ULONG index;
+	ULONG64 address;
+	BOOL result; // FALSE if Encoding or a segment is not readable
+	HeapEntry encoding32;
+	Heap64Entry encoding64;
+	ULONG64 frontEndHeap;
+	std::vector<ULONG64> zones;
+	std::vector<std::vector<HeapRecord> > zoneRecords;
+	std::vector<BOOL> zoneResults;
+	std::vector<SegmentWalk> segments;
+	std::vector<HeapRecord> vallocRecords; // sorted by address
+};
+
+/**
+*	@brief walk subsegments of a _LFH_BLOCK_ZONE
+*/
+class LFHZoneTask : public ITask
+{
+public:
+	LFHZoneTask(HeapWalk &heap, size_t index, const CommonParams &params)
+	: heap_(heap)
+	, index_(index)
+	, params_(params)
+	{
+	}
+
+	void Run(TaskPool &/*pool*/, ULONG /*worker*/)
+	{
+		if (params_.isTarget64)
 		{
-			dprintf("read NormalHeap failed\n");
-			return FALSE;
+			heap_.zoneResults[index_] = AnalyzeLFHZone64(heap_.frontEndHeap, heap_.zones[index_], params_, heap_.zoneRecords[index_]);
+		}
+		else
+		{
+			heap_.zoneResults[index_] = AnalyzeLFHZone32(heap_.frontEndHeap, heap_.zones[index_], params_, heap_.zoneRecords[index_]);
+		}
+	}
+
+private:
+	HeapWalk &heap_;
+	const size_t index_;
+	const CommonParams &params_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	LFHZoneTask& operator=(const LFHZoneTask&);
+};
+
+/**
+*	@brief walk entries of a heap segment
+*/
+class SegmentTask : public ITask
+{
+public:
+	SegmentTask(HeapWalk &heap, size_t index, const CommonParams &params)
+	: heap_(heap)
+	, index_(index)
+	, params_(params)
+	{
+	}
+
+	void Run(TaskPool &/*pool*/, ULONG /*worker*/)
+	{
+		SegmentWalk &segment = heap_.segments[index_];
+		FreeBlockStats *freeStats = params_.fragmentation != NULL ? &segment.freeStats : NULL;
+		if (params_.isTarget64)
+		{
+			segment.result = WalkSegment64(segment.segment64, heap_.encoding64, params_, segment.records, freeStats);
+		}
+		else
+		{
+			segment.result = WalkSegment32(segment.segment32, heap_.encoding32, params_, segment.records, freeStats);
 		}
+	}
+
+private:
+	HeapWalk &heap_;
+	const size_t index_;
+	const CommonParams &params_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	SegmentTask& operator=(const SegmentTask&);
+};
 
-		DPRINTF("heap at %p, _DPH_HEAP_ROOT %p\n", normalHeap, *itr);
-		processor->StartHeap(normalHeap);
-		std::set<HeapRecord> records;
+/**
+*	@brief walk VirtualAllocdBlocks of a heap
+*/
+class VirtualAllocdTask : public ITask
+{
+public:
+	VirtualAllocdTask(HeapWalk &heap, const CommonParams &params)
+	: heap_(heap)
+	, params_(params)
+	{
+	}
 
-		GetFieldOffset("ntdll!_DPH_HEAP_ROOT", "BusyNodesTable", &offset);
-		if (!WalkBalancedLinks(*itr + offset, params, AnalyzeDphHeapBlock64, &records))
+	void Run(TaskPool &/*pool*/, ULONG /*worker*/)
+	{
+		if (params_.isTarget64)
+		{
+			AnalyzeVirtualAllocd64(heap_.address, heap_.encoding64, params_, heap_.vallocRecords);
+		}
+		else
+		{
+			AnalyzeVirtualAllocd32(heap_.address, heap_.encoding32, params_, heap_.vallocRecords);
+		}
+		SortRecords(heap_.vallocRecords);
+	}
+
+private:
+	HeapWalk &heap_;
+	const CommonParams &params_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	VirtualAllocdTask& operator=(const VirtualAllocdTask&);
+};
+
+/**
+*	@brief find LFH zones and segments of a heap, and spawn tasks walking them
+*/
+class HeapTask : public ITask
+{
+public:
+	HeapTask(HeapWalk &heap, const CommonParams &params)
+	: heap_(heap)
+	, params_(params)
+	{
+	}
+
+	void Run(TaskPool &pool, ULONG worker)
+	{
+		const CommonParams &params = params_;
+		DPRINTF("heap[%d] at %p\n", heap_.index, heap_.address);
+
+		// zones found before the list is broken are walked
+		if (params.isTarget64)
+		{
+			GetLFHZones64(heap_.address, params, heap_.frontEndHeap, heap_.zones);
+		}
+		else
+		{
+			GetLFHZones32(heap_.address, params, heap_.frontEndHeap, heap_.zones);
+		}
+		heap_.zoneRecords.resize(heap_.zones.size());
+		heap_.zoneResults.resize(heap_.zones.size(), TRUE);
+		for (size_t i = 0; i < heap_.zones.size(); i++)
+		{
+			pool.Spawn(new LFHZoneTask(heap_, i, params), worker);
+		}
+
+		ULONG cb;
+		if (params.isTarget64 ?
+			!params.layout->ReadField(heap_.address, TypeLayout::HEAP_Encoding, heap_.encoding64) :
+			!READMEMORY(heap_.address + 0x50, heap_.encoding32))
+		{
+			dprintf("read Encoding failed\n");
+			heap_.result = FALSE;
+			return;
+		}
+		pool.Spawn(new VirtualAllocdTask(heap_, params), worker);
+
+		// the heap is the first segment
+		ULONG64 address = heap_.address;
+		while ((address & 0xffff) == 0)
+		{
+			SegmentWalk segment;
+			segment.address = address;
+			segment.result = TRUE;
+			if (params.isTarget64 ? !READMEMORY(address, segment.segment64) : !READMEMORY(address, segment.segment32))
+			{
+				dprintf("read HEAP_SEGMENT at %p failed\n", address);
+				heap_.result = FALSE;
+				break;
+			}
+			ULONG64 unCommittedPages, unCommittedRanges;
+			if (params.isTarget64)
+			{
+				segment.firstEntry = segment.segment64.FirstEntry;
+				segment.lastValidEntry = segment.segment64.LastValidEntry;
+				unCommittedPages = segment.segment64.NumberOfUnCommittedPages;
+				unCommittedRanges = segment.segment64.NumberOfUnCommittedRanges;
+				address = segment.segment64.SegmentListEntry.Flink - 0x18;
+			}
+			else
+			{
+				segment.firstEntry = segment.segment32.FirstEntry;
+				segment.lastValidEntry = segment.segment32.LastValidEntry;
+				unCommittedPages = segment.segment32.NumberOfUnCommittedPages;
+				unCommittedRanges = segment.segment32.NumberOfUnCommittedRanges;
+				address = segment.segment32.SegmentListEntry.Flink - 0x10;
+			}
+			DPRINTF("Segment at %p to %p\n", segment.address, segment.lastValidEntry);
+			DPRINTF("NumberOfUnCommittedPages:%p, NumberOfUnCommittedRanges:%p\n", unCommittedPages, unCommittedRanges);
+			heap_.segments.push_back(segment);
+		}
+		for (size_t i = 0; i < heap_.segments.size(); i++)
+		{
+			pool.Spawn(new SegmentTask(heap_, i, params), worker);
+		}
+	}
+
+private:
+	HeapWalk &heap_;
+	const CommonParams &params_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	HeapTask& operator=(const HeapTask&);
+};
+
+/**
+*	@brief deliver records of a walked heap, segments in list order followed by VirtualAllocdBlocks
+*	@retval FALSE the heap is broken, records before the broken part are delivered
+*/
+static BOOL RegisterHeap(const HeapWalk &heap, const CommonParams &params, IProcessor *processor)
+{
+	processor->StartHeap(heap.address);
+	if (params.fragmentation != NULL)
+	{
+		params.fragmentation->StartHeap(heap.address);
+	}
+	{
+		RecordBatch batch(processor);
+
+		// zones after a broken zone are not walked
+		std::vector<HeapRecord> lfhRecords;
+		for (size_t i = 0; i < heap.zones.size(); i++)
+		{
+			lfhRecords.insert(lfhRecords.end(), heap.zoneRecords[i].begin(), heap.zoneRecords[i].end());
+			if (!heap.zoneResults[i])
+			{
+				break;
+			}
+		}
+		SortRecords(lfhRecords);
+		DPRINTF("found %d LFH records in heap %p\n", (int)lfhRecords.size(), heap.address);
+		DPRINTF("found %d valloc records in heap %p\n", (int)heap.vallocRecords.size(), heap.address);
+
+		for (std::vector<SegmentWalk>::const_iterator itr = heap.segments.begin(); itr != heap.segments.end(); ++itr)
+		{
+			RegisterSegment(*itr, lfhRecords, params, batch);
+			if (params.fragmentation != NULL)
+			{
+				params.fragmentation->RegisterSegment(itr->address, itr->freeStats);
+			}
+			if (!itr->result)
+			{
+				return FALSE;
+			}
+		}
+		if (!heap.result)
 		{
-			dprintf("WalkBalancedLinks failed\n");
 			return FALSE;
 		}
-		
-		for (std::set<HeapRecord>::iterator itr_ = records.begin();
-			itr_ != records.end();
-			itr_++)
+		for (std::vector<HeapRecord>::const_iterator itr = heap.vallocRecords.begin();
+			itr != heap.vallocRecords.end();
+			itr++)
 		{
-			processor->Register(itr_->ustAddress,
-				itr_->size, itr_->address,
-				itr_->userSize, itr_->userAddress);
+			batch.Add(*itr);
 		}
-		processor->FinishHeap(normalHeap);
 	}
+	processor->FinishHeap(heap.address);
 	return TRUE;
 }
 
-static BOOL AnalyzeDphHeap(IProcessor *processor, const CommonParams &params)
+/**
+*	@brief walk blocks of a page heap
+*/
+class DphHeapTask : public ITask
+{
+public:
+	DphHeapTask(DphHeapWalk &heap, const CommonParams &params)
+	: heap_(heap)
+	, params_(params)
+	{
+	}
+
+	void Run(TaskPool &/*pool*/, ULONG /*worker*/)
+	{
+		if (params_.isTarget64)
+		{
+			WalkDphHeap64(heap_, params_);
+		}
+		else
+		{
+			WalkDphHeap32(heap_, params_);
+		}
+	}
+
+private:
+	DphHeapWalk &heap_;
+	const CommonParams &params_;
+
+	/**
+	*	@brief operator (disabled)
+	*	@note to avoid C4512 warning
+	*/
+	DphHeapTask& operator=(const DphHeapTask&);
+};
+
+/**
+*	@brief deliver records of a walked page heap
+*	@retval FALSE the page heap is broken
+*/
+static BOOL RegisterHeap(const DphHeapWalk &heap, const CommonParams &/*params*/, IProcessor *processor)
+{
+	if (!heap.found)
+	{
+		return FALSE;
+	}
+	processor->StartHeap(heap.normalHeap);
+	if (!heap.result)
+	{
+		return FALSE;
+	}
+	RecordBatch batch(processor);
+	for (std::vector<HeapRecord>::const_iterator itr = heap.records.begin();
+		itr != heap.records.end();
+		itr++)
+	{
+		batch.Add(*itr);
+	}
+	batch.Flush();
+	processor->FinishHeap(heap.normalHeap);
+	return TRUE;
+}
+
+/**
+*	@brief number of threads walking heaps
+*/
+static ULONG GetWalkThreads(const CommonParams &params)
+{
+#ifdef HEAPSTAT_OFFLINE
+	// verbose messages and the memory cache are not shared by threads
+	const Settings &settings = GetSettings();
+	if (params.verbose || settings.cacheEnabled)
+	{
+		return 1;
+	}
+	if (settings.walkThreads != 0)
+	{
+		return settings.walkThreads;
+	}
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	return systemInfo.dwNumberOfProcessors;
+#else
+	UNREFERENCED_PARAMETER(params);
+	return 1;
+#endif
+}
+
+/**
+*	@brief whether heap entries are processed on another thread while walking
+*/
+static bool UsePipeline(const CommonParams &params)
+{
+#ifdef HEAPSTAT_OFFLINE
+	// processors read ust records, which are not shared by threads through the cache
+	const Settings &settings = GetSettings();
+	return settings.pipeline && !params.verbose && !settings.cacheEnabled;
+#else
+	UNREFERENCED_PARAMETER(params);
+	return false;
+#endif
+}
+
+/**
+*	@brief run tasks walking heaps, and deliver records in the order of heaps
+*	@param threads [in] with more than one thread all heaps are walked at once,
+*	                    otherwise one by one to keep only one heap in memory
+*/
+template <typename Walk, typename Task>
+static BOOL WalkHeaps(std::vector<Walk> &heaps, ULONG threads, const CommonParams &params, IProcessor *processor)
+{
+	size_t first = 0;
+	while (first < heaps.size())
+	{
+		size_t last = threads > 1 ? heaps.size() : first + 1;
+		TaskPool pool(threads);
+		for (size_t i = first; i < last; i++)
+		{
+			pool.Spawn(new Task(heaps[i], params));
+		}
+		pool.Run();
+		for (size_t i = first; i < last; i++)
+		{
+			if (!RegisterHeap(heaps[i], params, processor))
+			{
+				return FALSE;
+			}
+			heaps[i] = Walk();
+		}
+		first = last;
+	}
+	return TRUE;
+}
+
+static BOOL AnalyzeDphHeap(IProcessor *processor, const CommonParams &params, ULONG threads)
 {
 	ULONG64 heapList = GetExpression("verifier!AVrfpDphPageHeapList");
 	DPRINTF("verifier!AVrfpDphPageHeapList: %p\n", heapList);
-	if (params.isTarget64)
+	std::vector<ULONG64> heapRoots;
+	if (params.isTarget64 ?
+		!GetDphHeapRoots64(heapList, params, heapRoots) :
+		!GetDphHeapRoots32(heapList, params, heapRoots))
 	{
-		return AnalyzeDphHeap64(heapList, processor, params);
+		return FALSE;
 	}
-	else
+
+	std::vector<DphHeapWalk> heaps(heapRoots.size());
+	for (size_t i = 0; i < heapRoots.size(); i++)
 	{
-		return AnalyzeDphHeap32(heapList, processor, params);
+		heaps[i].heapRoot = heapRoots[i];
+		heaps[i].normalHeap = 0;
+		heaps[i].found = TRUE;
+		heaps[i].result = TRUE;
 	}
+	return WalkHeaps<DphHeapWalk, DphHeapTask>(heaps, threads, params, processor);
 }
 
-static BOOL AnalyzeHeap(IProcessor *processor, BOOL verbose)
+/**
+*	@brief walk heaps of the target and deliver entries to the processor
+*	@param fragmentation [in] processor of free entries, NULL not to count them
+*/
+static BOOL AnalyzeHeap(TargetContext &context, IProcessor *processor, BOOL verbose,
+						FragmentationProcessor *fragmentation = NULL)
 {
-	ULONG64 heapAddress;
 	CommonParams params;
 
-	params.osVersion = GetOSVersion();
+	params.osVersion = context.GetOSVersion();
 	params.verbose = verbose;
-	params.ntGlobalFlag = GetNtGlobalFlag();
-	params.isTarget64 = IsTarget64();
-	params.ntdllName = GetNtDllName();
+	params.ntGlobalFlag = context.GetNtGlobalFlag();
+	params.isTarget64 = context.IsTarget64();
+	params.layout = &context.GetLayout();
+	params.fragmentation = fragmentation;
 	DPRINTF("target is %s\n", params.isTarget64 ? "x64" : "x86");
+	if ((params.ntGlobalFlag & (NT_GLOBAL_FLAG_HPA | NT_GLOBAL_FLAG_UST)) && GetSettings().sweepTraces)
+	{
+		TraceStore &traces = context.GetTraceStore();
+		if (traces.Sweep(context.GetNtDllName(), context.GetLayout()))
+		{
+			traces.PrintDatabase();
+		}
+	}
+
+	// resolved once per walk, tasks walking LFH zones only read it
+	params.hasLFHKey = false;
+	params.lfhKey = 0;
+	if (params.osVersion >= OS_VERSION_WIN81 && !(params.ntGlobalFlag & NT_GLOBAL_FLAG_HPA))
+	{
+		params.hasLFHKey = context.GetLFHKey(params.lfhKey) != FALSE;
+	}
+
+	const ULONG threads = GetWalkThreads(params);
+	if (threads > 1)
+	{
+		// resolve what tasks look up lazily before threads share it
+		params.layout->ResolveAll();
+	}
+
+	// destroyed after the walk, when the processor has received all entries
+	PipelineProcessor pipeline(processor);
+	if (UsePipeline(params) && pipeline.Start())
+	{
+		processor = &pipeline;
+	}
+
 	if (params.ntGlobalFlag & NT_GLOBAL_FLAG_HPA)
 	{
 		DPRINTF("hpa enabled\n");
-		return AnalyzeDphHeap(processor, params);
+		return AnalyzeDphHeap(processor, params, threads);
 	}
 	else if (params.ntGlobalFlag & NT_GLOBAL_FLAG_UST)
 	{
@@ -1446,25 +1995,78 @@ static BOOL AnalyzeHeap(IProcessor *processor, BOOL verbose)
 		dprintf("set ust or hpa by gflags.exe for detailed information\n");
 	}
 
-	for (ULONG heapIndex = 0; (heapAddress = GetHeapAddress(heapIndex)) != 0; heapIndex++)
+	const std::vector<ULONG64> &heapAddresses = context.GetProcessHeaps();
+	std::vector<HeapWalk> heaps;
+	for (ULONG heapIndex = 0; heapIndex < heapAddresses.size() && heapAddresses[heapIndex] != 0; heapIndex++)
 	{
-		DPRINTF("heap[%d] at %p\n", heapIndex, heapAddress);
-		processor->StartHeap(heapAddress);
-		if (params.isTarget64)
-		{
-			if (!AnalyzeHeap64(heapAddress, params, processor))
-			{
-				return FALSE;
-			}
-		}
-		else
-		{
-			if (!AnalyzeHeap32(heapAddress, params, processor))
+		HeapWalk heap;
+		heap.index = heapIndex;
+		heap.address = heapAddresses[heapIndex];
+		heap.result = TRUE;
+		heap.frontEndHeap = 0;
+		heaps.push_back(heap);
+	}
+	return WalkHeaps<HeapWalk, HeapTask>(heaps, threads, params, processor);
+}
+
+/**
+*	@brief parse -n, --min-total, --min-count and --sort shared by heapstat and bysize
+*	@param token [in] current option
+*	@param nextToken [in,out] context of strtok_s to get the value
+*	@param options [out] parsed options
+*	@param error [out] true if the value is invalid (already printed)
+*	@retval FALSE token is not a report option
+*/
+static BOOL ParseReportOption(const char *token, char **nextToken, ReportOptions &options, bool &error)
+{
+	const char *delim = " ";
+	error = false;
+	if (strcmp("--sort", token) == 0)
+	{
+		const char *value = strtok_s(NULL, delim, nextToken);
+		static const struct
+		{
+			const char *name;
+			ReportOptions::SortKey key;
+		} keys[] = {
+			{ "total", ReportOptions::SORT_TOTAL },
+			{ "count", ReportOptions::SORT_COUNT },
+			{ "max", ReportOptions::SORT_MAX },
+			{ "avg", ReportOptions::SORT_AVERAGE },
+		};
+		for (size_t i = 0; value != NULL && i < _countof(keys); i++)
+		{
+			if (strcmp(keys[i].name, value) == 0)
 			{
-				return FALSE;
+				options.sortKey = keys[i].key;
+				return TRUE;
 			}
 		}
-		processor->FinishHeap(heapAddress);
+		dprintf("specify total, count, max or avg after --sort\n");
+		error = true;
+		return TRUE;
+	}
+
+	ULONG64 *target = strcmp("-n", token) == 0 ? &options.top :
+		strcmp("--min-total", token) == 0 ? &options.minTotal :
+		strcmp("--min-count", token) == 0 ? &options.minCount : NULL;
+	if (target == NULL)
+	{
+		return FALSE;
+	}
+	const char *value = strtok_s(NULL, delim, nextToken);
+	if (value == NULL)
+	{
+		dprintf("no value specified after %s\n", token);
+		error = true;
+		return TRUE;
+	}
+	char *end = NULL;
+	*target = _strtoui64(value, &end, 16);
+	if ((size_t)(end - value) != strlen(value))
+	{
+		dprintf("invalid character after %s\n", token);
+		error = true;
 	}
 	return TRUE;
 }
@@ -1478,11 +2080,38 @@ DECLARE_API(help)
 	UNREFERENCED_PARAMETER(hCurrentProcess);
 
 	dprintf("Help for extension dll heapstat.dll\n"
-			"   heapstat [-v] [-k module!symbol] - Shows statistics of heaps\n"
-			"   bysize [-v] [-s size]            - Shows statistics of heaps by size\n"
-			"   umdh <file>                      - Generate umdh output\n"
+			"   heapstat [-v] [-k module!symbol]... [-x module!symbol]... [report options]\n"
+			"            [-all] [-frag] [-umdh <file>] [-save <file> | -load <file>]\n"
+			"                                    - Shows statistics of heaps\n"
+			"                                      -k selects and -x drops traces having the frame\n"
+			"                                      -all adds bysize, -frag adds free bytes and\n"
+			"                                      fragmentation per segment, and -umdh writes umdh\n"
+			"                                      output in the same heap walk\n"
+			"                                      -save writes heap records and stack traces to file\n"
+			"                                      and -load reports them without reading the target\n"
+			"   trend [--rank slope|monotonic] [-n count] [--min-total size] [--min-count count]\n"
+			"         <file> <file>...           - Shows growth per call site over snapshots saved\n"
+			"                                      by heapstat -save, oldest first\n"
+			"   bysize [-v] [-s size] [report options]\n"
+			"                                    - Shows statistics of heaps by size\n"
+			"   umdh [-g] <file>                 - Generate umdh output\n"
+			"                                      -g writes each backtrace once with count and total\n"
+			"                                      over all heaps, larger total first\n"
 			"   ust <addr>                       - Shows stacktrace of the ust record at <addr>\n"
-			"   help                             - Shows this help\n");
+			"   ust -db                          - Shows size and number of traces of the ust database\n"
+			"   config [-cache on|off] [-pagesize size] [-pages count]\n"
+			"          [-bulk on|off] [-chunk size] [-sweep on|off]\n"
+			"          [-skip prefix,prefix,...]\n"
+#ifdef HEAPSTAT_OFFLINE
+			"          [-threads count] [-pipeline on|off]\n"
+#endif
+			"                                    - Shows or changes settings\n"
+			"   help                             - Shows this help\n"
+			"report options (numbers in hex):\n"
+			"   -n count                         - Shows top count records only\n"
+			"   --min-total size                 - Hides records smaller than size in total\n"
+			"   --min-count count                - Hides records allocated less than count\n"
+			"   --sort total|count|max|avg       - Orders records by the key\n");
 }
 
 DECLARE_API(heapstat)
@@ -1493,7 +2122,15 @@ DECLARE_API(heapstat)
 	UNREFERENCED_PARAMETER(hCurrentProcess);
 
 	BOOL verbose = FALSE;
-	char *key = NULL;
+	std::vector<const char *> includes;
+	std::vector<const char *> excludes;
+	ReportOptions options;
+	bool error;
+	BOOL all = FALSE;
+	BOOL frag = FALSE;
+	const char *umdhFile = NULL;
+	const char *saveFile = NULL;
+	const char *loadFile = NULL;
 
 	std::vector<char> buffer;
 	buffer.resize(strlen(args) + 1);
@@ -1503,41 +2140,252 @@ DECLARE_API(heapstat)
 	token = strtok_s(&buffer[0], delim, &nextToken);
 	while (token != NULL)
 	{
-		if (strcmp("-v", token) == 0)
+		if (ParseReportOption(token, &nextToken, options, error))
+		{
+			if (error)
+			{
+				return;
+			}
+		}
+		else if (strcmp("-v", token) == 0)
 		{
 			dprintf("verbose mode\n");
 			verbose = TRUE;
 		}
-		else if (strcmp("-k", token) == 0)
+		else if (strcmp("-all", token) == 0)
+		{
+			all = TRUE;
+		}
+		else if (strcmp("-frag", token) == 0)
 		{
+			frag = TRUE;
+		}
+		else if (strcmp("-umdh", token) == 0 || strcmp("-save", token) == 0 || strcmp("-load", token) == 0)
+		{
+			const char *option = token;
 			token = strtok_s(NULL, delim, &nextToken);
 			if (token == NULL)
 			{
-				dprintf("no key specified after -k\n");
+				dprintf("no file specified after %s\n", option);
 				return;
 			}
-			key = token;
+			const char *&file = strcmp("-umdh", option) == 0 ? umdhFile :
+				strcmp("-save", option) == 0 ? saveFile : loadFile;
+			file = token;
+		}
+		else if (strcmp("-k", token) == 0 || strcmp("-x", token) == 0)
+		{
+			const char *option = token;
+			token = strtok_s(NULL, delim, &nextToken);
+			if (token == NULL)
+			{
+				dprintf("no key specified after %s\n", option);
+				return;
+			}
+			(strcmp("-k", option) == 0 ? includes : excludes).push_back(token);
 		}
 		token = strtok_s(NULL, delim, &nextToken);
 	}
 
-	SummaryProcessor processor;
+	if (saveFile != NULL && loadFile != NULL)
+	{
+		dprintf("-save and -load cannot be used together\n");
+		return;
+	}
+	if (frag && loadFile != NULL)
+	{
+		// snapshots have busy entries only
+		dprintf("-frag and -load cannot be used together\n");
+		return;
+	}
+	if (loadFile != NULL)
+	{
+		// symbols are resolved by the target, which may not be the process saved in the snapshot
+		for (size_t i = 0; i < includes.size() + excludes.size(); i++)
+		{
+			const char *key = i < includes.size() ? includes[i] : excludes[i - includes.size()];
+			if (strchr(key, '!') != NULL)
+			{
+				dprintf("%s: only module names can be given to -k and -x with -load\n", key);
+				return;
+			}
+		}
+	}
+	HeapSnapshotReader snapshot;
+	if (loadFile != NULL && !snapshot.Load(loadFile))
+	{
+		return;
+	}
+
+	MemoryCacheScope cache(verbose);
+	TargetContext &context = loadFile != NULL ? snapshot.GetContext() : TargetContext::Get();
+	if (frag && (context.GetNtGlobalFlag() & NT_GLOBAL_FLAG_HPA))
+	{
+		// page heap blocks are not in heap segments
+		dprintf("-frag cannot be used with hpa, which allocates outside heap segments\n");
+		return;
+	}
+	SummaryProcessor processor(context);
+	BySizeProcessor bySize(0);
+	FragmentationProcessor fragmentation;
+
+	// all reports from one heap walk
+	CompositeProcessor composite;
+	composite.Add(&processor);
+	if (all)
+	{
+		composite.Add(&bySize);
+	}
+	UmdhProcessor *umdh(0);
+	if (umdhFile != NULL)
+	{
+		if (!(context.GetNtGlobalFlag() & (NT_GLOBAL_FLAG_UST | NT_GLOBAL_FLAG_HPA)))
+		{
+			dprintf("please set ust or hpa by gflags.exe\n");
+			return;
+		}
+		try
+		{
+			umdh = new UmdhProcessor(context, umdhFile);
+		}
+		catch (...)
+		{
+			return;
+		}
+		composite.Add(umdh);
+	}
+	HeapSnapshotWriter writer;
+	if (saveFile != NULL)
+	{
+		composite.Add(&writer);
+	}
 
-	if (!AnalyzeHeap(&processor, verbose))
+	BOOL result = TRUE;
+	if (loadFile != NULL)
+	{
+		snapshot.Replay(&composite);
+	}
+	else
+	{
+		result = AnalyzeHeap(context, &composite, verbose, frag ? &fragmentation : NULL);
+	}
+	delete umdh; // flush the umdh output even if the walk failed
+	if (!result)
+	{
+		return;
+	}
+	if (saveFile != NULL && !writer.Save(saveFile, context))
 	{
 		return;
 	}
 
-	if (key == NULL)
+	if (includes.empty() && excludes.empty())
 	{
-		processor.Print();
+		processor.Print(options);
 	}
 	else
 	{
-		processor.Print(key);
+		// modules of the snapshot, not of the target
+		FrameFilter filter(context.GetSymbolTable(), loadFile != NULL ? &context.GetLoadedModules() : NULL);
+		for (std::vector<const char *>::iterator itr = includes.begin(); itr != includes.end(); ++itr)
+		{
+			filter.Include(*itr);
+		}
+		for (std::vector<const char *>::iterator itr = excludes.begin(); itr != excludes.end(); ++itr)
+		{
+			filter.Exclude(*itr);
+		}
+		processor.Print(filter, options);
+	}
+
+	if (all)
+	{
+		bySize.Print(options);
+	}
+	if (frag)
+	{
+		fragmentation.Print();
 	}
 }
 
+DECLARE_API(trend)
+{
+	UNREFERENCED_PARAMETER(dwProcessor);
+	UNREFERENCED_PARAMETER(dwCurrentPc);
+	UNREFERENCED_PARAMETER(hCurrentThread);
+	UNREFERENCED_PARAMETER(hCurrentProcess);
+
+	TrendAnalyzer::RankKey rank = TrendAnalyzer::RANK_SLOPE;
+	ReportOptions options;
+	bool error;
+	std::vector<const char *> files;
+
+	std::vector<char> buffer;
+	buffer.resize(strlen(args) + 1);
+	memcpy(&buffer[0], args, buffer.size());
+	char *token, *nextToken = NULL;
+	const char *delim = " ";
+	token = strtok_s(&buffer[0], delim, &nextToken);
+	while (token != NULL)
+	{
+		if (strcmp("--rank", token) == 0)
+		{
+			token = strtok_s(NULL, delim, &nextToken);
+			if (token != NULL && strcmp("slope", token) == 0)
+			{
+				rank = TrendAnalyzer::RANK_SLOPE;
+			}
+			else if (token != NULL && strcmp("monotonic", token) == 0)
+			{
+				rank = TrendAnalyzer::RANK_MONOTONIC;
+			}
+			else
+			{
+				dprintf("specify slope or monotonic after --rank\n");
+				return;
+			}
+		}
+		else if (strcmp("--sort", token) == 0)
+		{
+			// sites are ordered by their growth, not by the last snapshot
+			dprintf("--sort cannot be used with trend, use --rank\n");
+			return;
+		}
+		else if (ParseReportOption(token, &nextToken, options, error))
+		{
+			if (error)
+			{
+				return;
+			}
+		}
+		else
+		{
+			files.push_back(token);
+		}
+		token = strtok_s(NULL, delim, &nextToken);
+	}
+	if (files.size() < 2)
+	{
+		dprintf("specify two or more snapshot files\n");
+		return;
+	}
+
+	// one snapshot in memory at a time, only aggregated series are kept
+	TrendAnalyzer trend;
+	for (std::vector<const char *>::iterator itr = files.begin(); itr != files.end(); ++itr)
+	{
+		HeapSnapshotReader snapshot;
+		if (!snapshot.Load(*itr))
+		{
+			return;
+		}
+		SummaryProcessor processor(snapshot.GetContext());
+		snapshot.Replay(&processor);
+		trend.AddPoint(snapshot.GetContext(), processor);
+	}
+	trend.Print(rank, options);
+}
+
 DECLARE_API(bysize)
 {
 	UNREFERENCED_PARAMETER(dwProcessor);
@@ -1547,6 +2395,8 @@ DECLARE_API(bysize)
 
 	BOOL verbose = FALSE;
 	ULONG64 size = 0;
+	ReportOptions options;
+	bool error;
 
 	std::vector<char> buffer;
 	buffer.resize(strlen(args) + 1);
@@ -1556,7 +2406,14 @@ DECLARE_API(bysize)
 	token = strtok_s(&buffer[0], delim, &nextToken);
 	while (token != NULL)
 	{
-		if (strcmp("-v", token) == 0)
+		if (ParseReportOption(token, &nextToken, options, error))
+		{
+			if (error)
+			{
+				return;
+			}
+		}
+		else if (strcmp("-v", token) == 0)
 		{
 			dprintf("verbose mode\n");
 			verbose = TRUE;
@@ -1583,14 +2440,16 @@ DECLARE_API(bysize)
 		token = strtok_s(NULL, delim, &nextToken);
 	}
 
+	MemoryCacheScope cache(verbose);
+	TargetContext &context = TargetContext::Get();
 	BySizeProcessor processor(size);
 
-	if (!AnalyzeHeap(&processor, verbose))
+	if (!AnalyzeHeap(context, &processor, verbose))
 	{
 		return;
 	}
 
-	processor.Print();
+	processor.Print(options);
 }
 
 DECLARE_API(umdh)
@@ -1600,7 +2459,42 @@ DECLARE_API(umdh)
 	UNREFERENCED_PARAMETER(hCurrentThread);
 	UNREFERENCED_PARAMETER(hCurrentProcess);
 
-	if (!(GetNtGlobalFlag() & (NT_GLOBAL_FLAG_UST | NT_GLOBAL_FLAG_HPA)))
+	// -g groups entries by backtrace over all heaps
+	bool grouped = false;
+	const char *file = NULL;
+
+	std::vector<char> buffer;
+	buffer.resize(strlen(args) + 1);
+	memcpy(&buffer[0], args, buffer.size());
+	char *token, *nextToken = NULL;
+	const char *delim = " ";
+	token = strtok_s(&buffer[0], delim, &nextToken);
+	while (token != NULL)
+	{
+		if (strcmp("-g", token) == 0)
+		{
+			grouped = true;
+		}
+		else if (file == NULL)
+		{
+			file = token;
+		}
+		else
+		{
+			dprintf("specify one file\n");
+			return;
+		}
+		token = strtok_s(NULL, delim, &nextToken);
+	}
+	if (file == NULL)
+	{
+		dprintf("no file specified\n");
+		return;
+	}
+
+	MemoryCacheScope cache(FALSE);
+	TargetContext &context = TargetContext::Get();
+	if (!(context.GetNtGlobalFlag() & (NT_GLOBAL_FLAG_UST | NT_GLOBAL_FLAG_HPA)))
 	{
 		dprintf("please set ust or hpa by gflags.exe\n");
 		return;
@@ -1609,14 +2503,14 @@ DECLARE_API(umdh)
 	UmdhProcessor *processor(0);
 	try
 	{
-		processor = new UmdhProcessor(args);
+		processor = new UmdhProcessor(context, file, grouped);
 	}
 	catch (...)
 	{
 		return;
 	}
 
-	AnalyzeHeap(processor, FALSE);
+	AnalyzeHeap(context, processor, FALSE);
 	delete processor;
 }
 
@@ -1627,12 +2521,169 @@ DECLARE_API(ust)
 	UNREFERENCED_PARAMETER(hCurrentThread);
 	UNREFERENCED_PARAMETER(hCurrentProcess);
 
+	while (*args == ' ')
+	{
+		args++;
+	}
+	if (strncmp("-db", args, 3) == 0)
+	{
+		MemoryCacheScope cache(FALSE);
+		TargetContext &context = TargetContext::Get();
+		TraceStore &traces = context.GetTraceStore();
+		if (traces.Sweep(context.GetNtDllName(), context.GetLayout()))
+		{
+			traces.PrintDatabase();
+		}
+		return;
+	}
+
 	ULONG64 Address = GetExpression(args);
 
-	std::vector<ULONG64> trace = GetStackTrace(Address, IsTarget64(), GetNtGlobalFlag());
-	dprintf("ust at %p depth: %d\n", Address, trace.size());
-	for (std::vector<ULONG64>::iterator itr = trace.begin(); itr != trace.end(); itr++)
+	MemoryCacheScope cache(FALSE);
+	TargetContext &context = TargetContext::Get();
+	const ULONG64 *frames;
+	ULONG depth = context.GetTraceStore().Get(Address, frames);
+	dprintf("ust at %p depth: %d\n", Address, depth);
+	for (const ULONG64 *itr = frames; itr != frames + depth; itr++)
 	{
 		dprintf("%ly\n", *itr);
 	}
 }
+
+DECLARE_API(config)
+{
+	UNREFERENCED_PARAMETER(dwProcessor);
+	UNREFERENCED_PARAMETER(dwCurrentPc);
+	UNREFERENCED_PARAMETER(hCurrentThread);
+	UNREFERENCED_PARAMETER(hCurrentProcess);
+
+	Settings &settings = GetSettings();
+
+	std::vector<char> buffer;
+	buffer.resize(strlen(args) + 1);
+	memcpy(&buffer[0], args, buffer.size());
+	char *token, *nextToken = NULL;
+	const char *delim = " ";
+	token = strtok_s(&buffer[0], delim, &nextToken);
+	while (token != NULL)
+	{
+		if (strcmp("-cache", token) == 0 || strcmp("-bulk", token) == 0 || strcmp("-sweep", token) == 0)
+		{
+			const char *option = token;
+			bool &flag = strcmp("-cache", option) == 0 ? settings.cacheEnabled :
+				strcmp("-bulk", option) == 0 ? settings.bulkRead : settings.sweepTraces;
+			token = strtok_s(NULL, delim, &nextToken);
+			if (token != NULL && strcmp("on", token) == 0)
+			{
+				flag = true;
+			}
+			else if (token != NULL && strcmp("off", token) == 0)
+			{
+				flag = false;
+			}
+			else
+			{
+				dprintf("specify on or off after %s\n", option);
+				return;
+			}
+		}
+#ifdef HEAPSTAT_OFFLINE
+		else if (strcmp("-threads", token) == 0)
+		{
+			token = strtok_s(NULL, delim, &nextToken);
+			if (token == NULL)
+			{
+				dprintf("no value specified after -threads\n");
+				return;
+			}
+			char *end = NULL;
+			ULONG64 value = _strtoui64(token, &end, 16);
+			if ((size_t)(end - token) != strlen(token) || value > 0x100)
+			{
+				dprintf("invalid value after -threads\n");
+				return;
+			}
+			settings.walkThreads = (ULONG)value;
+		}
+		else if (strcmp("-pipeline", token) == 0)
+		{
+			token = strtok_s(NULL, delim, &nextToken);
+			if (token != NULL && strcmp("on", token) == 0)
+			{
+				settings.pipeline = true;
+			}
+			else if (token != NULL && strcmp("off", token) == 0)
+			{
+				settings.pipeline = false;
+			}
+			else
+			{
+				dprintf("specify on or off after -pipeline\n");
+				return;
+			}
+		}
+#endif
+		else if (strcmp("-skip", token) == 0)
+		{
+			token = strtok_s(NULL, delim, &nextToken);
+			if (token == NULL)
+			{
+				dprintf("no module specified after -skip\n");
+				return;
+			}
+			settings.skipModules = token;
+		}
+		else if (strcmp("-pagesize", token) == 0 || strcmp("-pages", token) == 0 || strcmp("-chunk", token) == 0)
+		{
+			const char *option = token;
+			token = strtok_s(NULL, delim, &nextToken);
+			if (token == NULL)
+			{
+				dprintf("no value specified after %s\n", option);
+				return;
+			}
+			char *end = NULL;
+			ULONG64 value = _strtoui64(token, &end, 16);
+			if ((size_t)(end - token) != strlen(token) || value == 0 || value > 0x10000000)
+			{
+				dprintf("invalid value after %s\n", option);
+				return;
+			}
+			if (strcmp("-pagesize", option) == 0)
+			{
+				if ((value & (value - 1)) != 0)
+				{
+					dprintf("page size must be a power of 2\n");
+					return;
+				}
+				settings.cachePageSize = (ULONG)value;
+			}
+			else if (strcmp("-pages", option) == 0)
+			{
+				settings.cacheMaxPages = (ULONG)value;
+			}
+			else
+			{
+				settings.bulkChunkSize = (ULONG)value;
+			}
+		}
+		else
+		{
+			dprintf("unknown option %s\n", token);
+			return;
+		}
+		token = strtok_s(NULL, delim, &nextToken);
+	}
+
+	dprintf("cache: %s, page size: 0x%x, max pages: 0x%x\n",
+		settings.cacheEnabled ? "on" : "off", settings.cachePageSize, settings.cacheMaxPages);
+	dprintf("bulk read: %s, chunk size: 0x%x\n",
+		settings.bulkRead ? "on" : "off", settings.bulkChunkSize);
+	dprintf("sweep ust database: %s\n", settings.sweepTraces ? "on" : "off");
+	dprintf("skipped modules: %s\n", settings.skipModules.c_str());
+#ifdef HEAPSTAT_OFFLINE
+	dprintf("walk threads: 0x%x%s\n", settings.walkThreads, settings.walkThreads == 0 ? " (number of processors)" : "");
+	dprintf("pipeline: %s\n", settings.pipeline ? "on" : "off");
+#endif
+	MemoryCache::PrintStatistics(MemoryCacheScope::GetLastStatistics());
+}
@@ -0,0 +1,162 @@
+/*
+	run heapstat commands on a minidump without the debugger
+
+	usage: heapstatcli [-t layoutfile] [-D name=address]... [<dumpfile>] <command> [args...]
+*/
+#include "../common.h"
+#include "../DumpReader.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+DECLARE_API(help);
+DECLARE_API(heapstat);
+DECLARE_API(trend);
+DECLARE_API(bysize);
+DECLARE_API(umdh);
+DECLARE_API(ust);
+DECLARE_API(config);
+
+typedef void (*Command)(HANDLE, HANDLE, ULONG64, ULONG, PCSTR);
+
+static const struct
+{
+	const char *name;
+	Command command;
+} commands[] = {
+	{ "help", help },
+	{ "heapstat", heapstat },
+	{ "trend", trend },
+	{ "bysize", bysize },
+	{ "umdh", umdh },
+	{ "ust", ust },
+	{ "config", config },
+};
+
+static Command FindCommand(const char *name)
+{
+	for (size_t i = 0; i < _countof(commands); i++)
+	{
+		if (strcmp(commands[i].name, name) == 0)
+		{
+			return commands[i].command;
+		}
+	}
+	return NULL;
+}
+
+/**
+*	@brief true if the command reads snapshot files only
+*/
+static bool RunsWithoutDump(const char *name, int argc, char *argv[], int first)
+{
+	if (strcmp("help", name) == 0 || strcmp("trend", name) == 0)
+	{
+		return true;
+	}
+	if (strcmp("heapstat", name) == 0)
+	{
+		for (int i = first; i < argc; i++)
+		{
+			if (strcmp("-load", argv[i]) == 0)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static int Usage()
+{
+	fprintf(stderr,
+		"usage: heapstatcli [-t layoutfile] [-D name=address]... [<dumpfile>] <command> [args...]\n"
+		"   dumpfile          - may be omitted for help, trend and heapstat -load\n"
+		"   -t layoutfile     - type layouts overriding built-in ones\n"
+		"                       (each line is \"type field offset size\" or \"type size\" in hex)\n"
+		"   -D name=address   - address of a symbol which is not exported\n"
+		"                       (e.g. -D ntdll!RtlpLFHKey=7ffb12345678)\n"
+		"   command           - one of help, heapstat, trend, bysize, umdh, ust, config\n");
+	return 2;
+}
+
+int main(int argc, char *argv[])
+{
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (strcmp("-t", argv[i]) == 0 && i + 1 < argc)
+		{
+			if (!LoadTypeLayouts(argv[++i]))
+			{
+				return 1;
+			}
+		}
+		else if (strcmp("-D", argv[i]) == 0 && i + 1 < argc)
+		{
+			std::string definition = argv[++i];
+			size_t pos = definition.find('=');
+			ULONG64 address;
+			if (pos == std::string::npos ||
+				!GetExpressionEx(definition.substr(pos + 1).c_str(), &address, NULL))
+			{
+				fprintf(stderr, "invalid definition %s\n", definition.c_str());
+				return Usage();
+			}
+			DefineSymbol(definition.substr(0, pos).c_str(), address);
+		}
+		else
+		{
+			return Usage();
+		}
+	}
+	if (argc - i < 1)
+	{
+		return Usage();
+	}
+
+	// a command name in place of the dump file runs the command without a dump
+	const bool hasDump = FindCommand(argv[i]) == NULL;
+	const int nameIndex = hasDump ? i + 1 : i;
+	if (nameIndex >= argc)
+	{
+		return Usage();
+	}
+	const char *name = argv[nameIndex];
+	Command command = FindCommand(name);
+	if (command == NULL)
+	{
+		fprintf(stderr, "unknown command %s\n", name);
+		return Usage();
+	}
+	if (!hasDump && !RunsWithoutDump(name, argc, argv, nameIndex + 1))
+	{
+		fprintf(stderr, "%s needs a dump file\n", name);
+		return Usage();
+	}
+
+	DumpReader dump;
+	if (hasDump)
+	{
+		if (!dump.Open(argv[i]))
+		{
+			return 1;
+		}
+		AttachDump(&dump);
+	}
+
+	std::string args;
+	for (int j = nameIndex + 1; j < argc; j++)
+	{
+		if (!args.empty())
+		{
+			args += " ";
+		}
+		args += argv[j];
+	}
+
+	command(NULL, NULL, 0, 0, args.c_str());
+	fflush(stdout);
+	AttachDump(NULL);
+	return 0;
+}
@@ -0,0 +1,110 @@
+/*
+	measure ScanBusyBlocks kernels against the byte loop of the LFH walk
+
+	usage: scanbench [stride] [count] [iterations]
+*/
+#include "../common.h"
+#include "../EntryScan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+typedef struct {
+	ULONG64 PreviousBlockPrivateData;
+	USHORT Size;
+	UCHAR Flags;
+	UCHAR SmallTagIndex;
+	USHORT PreviousSize;
+	UCHAR SegmentOffset;
+	UCHAR ExtendedBlockSignature;
+} Heap64Entry;
+
+/**
+*	@brief classify blocks as the LFH walk did, copying each header
+*/
+static void ScanByteLoop(const UCHAR *blocks, ULONG stride, ULONG count, bool ust, ULONG *mask)
+{
+	memset(mask, 0, (count + 31) / 32 * sizeof(ULONG));
+	for (ULONG i = 0; i < count; i++)
+	{
+		Heap64Entry entry;
+		memcpy(&entry, blocks + (size_t)i * stride, sizeof(entry));
+		bool busy = ust ? entry.ExtendedBlockSignature == 0xc2 : entry.ExtendedBlockSignature > 0x80;
+		if (busy)
+		{
+			mask[i / 32] |= 1U << (i % 32);
+		}
+	}
+}
+
+/**
+*	@brief fill signatures of blocks, about half of them busy
+*/
+static void FillBlocks(std::vector<UCHAR> &blocks, ULONG stride, ULONG count, bool ust)
+{
+	srand(1);
+	for (ULONG i = 0; i < count; i++)
+	{
+		UCHAR *signature = &blocks[(size_t)i * stride + offsetof(Heap64Entry, ExtendedBlockSignature)];
+		bool busy = (rand() & 1) != 0;
+		if (ust)
+		{
+			*signature = busy ? 0xc2 : (UCHAR)(rand() & 0x7f);
+		}
+		else
+		{
+			*signature = (UCHAR)(busy ? 0x81 + rand() % 0x7f : rand() % 0x81);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	ULONG stride = argc > 1 ? strtoul(argv[1], NULL, 0) : 0x30;
+	ULONG count = argc > 2 ? strtoul(argv[2], NULL, 0) : 0x400;
+	ULONG iterations = argc > 3 ? strtoul(argv[3], NULL, 0) : 0x4000;
+	if (stride < sizeof(Heap64Entry) || count == 0 || iterations == 0)
+	{
+		fprintf(stderr, "usage: scanbench [stride] [count] [iterations]\n");
+		return 2;
+	}
+	printf("stride 0x%x, count 0x%x, iterations 0x%x, supported %s\n",
+		stride, count, iterations, GetScanKernelName(GetScanKernel()));
+
+	std::vector<UCHAR> blocks((size_t)stride * count);
+	std::vector<ULONG> expected((count + 31) / 32), mask((count + 31) / 32);
+	const UCHAR *signatures = &blocks[offsetof(Heap64Entry, ExtendedBlockSignature)];
+	for (int ust = 0; ust < 2; ust++)
+	{
+		FillBlocks(blocks, stride, count, ust != 0);
+		ScanByteLoop(&blocks[0], stride, count, ust != 0, &expected[0]);
+
+		clock_t start = clock();
+		for (ULONG i = 0; i < iterations; i++)
+		{
+			ScanByteLoop(&blocks[0], stride, count, ust != 0, &mask[0]);
+		}
+		double base = (double)(clock() - start) / CLOCKS_PER_SEC;
+		printf("%s byte loop: %.3f s\n", ust ? "ust" : "flag", base);
+
+		for (int kernel = SCAN_SCALAR; kernel <= GetScanKernel(); kernel++)
+		{
+			start = clock();
+			for (ULONG i = 0; i < iterations; i++)
+			{
+				ScanBusyBlocks(signatures, stride, count, ust != 0, &mask[0], (ScanKernel)kernel);
+			}
+			double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+			bool same = memcmp(&mask[0], &expected[0], mask.size() * sizeof(ULONG)) == 0;
+			printf("%s %s: %.3f s (x%.2f)%s\n", ust ? "ust" : "flag", GetScanKernelName((ScanKernel)kernel),
+				elapsed, elapsed > 0 ? base / elapsed : 0.0, same ? "" : " MISMATCH");
+			if (!same)
+			{
+				return 1;
+			}
+		}
+	}
+	return 0;
+}